@@ -36,7 +36,8 @@ enum
 	SCRATCH3_ERROR_COMPILATION_FAILED,
 	SCRATCH3_ERROR_NO_VM,
 	SCRATCH3_ERROR_ALREADY_RUNNING,
-	SCRATCH3_ERROR_TIMEOUT
+	SCRATCH3_ERROR_TIMEOUT,
+	SCRATCH3_ERROR_NOT_FOUND
 };
 
 enum
@@ -62,6 +63,10 @@ typedef struct _Scratch3CompilerOptions
 {
 	int debug; // implies optimization = 0
 	int optimization; // 0 = none, 1 = some, 2 = full
+	int jobs; // number of threads to compile with, 0 = one per core
+	const char *cacheDir; // directory to cache compiled sprites in, NULL = no cache
+	int compressAssets; // compress assets which are not already compressed
+	int bakeAssets; // store decoded assets, so the VM does not decode them
 } Scratch3CompilerOptions;
 
 typedef struct _Scratch3VMOptions
@@ -78,8 +83,28 @@ typedef struct _Scratch3VMOptions
 	int fullscreen;
 	int borderless;
 	int freeAspectRatio;
+
+	size_t heapLimit; // maximum bytes used by strings and lists, 0 for no limit
 } Scratch3VMOptions;
 
+typedef struct _Scratch3HeapStats
+{
+	size_t used; // bytes used by strings and lists
+	size_t peak; // largest value of used
+	size_t limit; // maximum value of used, 0 for no limit
+	size_t failures; // number of allocations denied by the limit
+} Scratch3HeapStats;
+
+typedef struct _Scratch3SourceLocation
+{
+	size_t start, end; // range of offsets in the program compiled from the block
+	const char *sprite; // name of the sprite
+	const char *script; // ID of the top block of the script
+	const char *block; // ID of the block
+	const char *opcode; // opcode of the block
+	const char *proc; // proccode of the enclosing procedure, NULL at top level
+} Scratch3SourceLocation;
+
 typedef void (*Scratch3LogFn)(Scratch3 *S, const char *message, size_t len, int severity, void *up);
 
 SCRATCH3_EXTERN_C SCRATCH3_EXPORT const char *Scratch3GetErrorString(int error);
@@ -100,10 +125,16 @@ SCRATCH3_EXTERN_C SCRATCH3_EXPORT void Scratch3Logf(Scratch3 *S, int severity, c
 
 SCRATCH3_EXTERN_C SCRATCH3_EXPORT int Scratch3Load(Scratch3 *S, const char *name, const void *data, size_t size);
 
+SCRATCH3_EXTERN_C SCRATCH3_EXPORT int Scratch3LoadFile(Scratch3 *S, const char *name, const char *path);
+
 SCRATCH3_EXTERN_C SCRATCH3_EXPORT int Scratch3Compile(Scratch3 *S, const Scratch3CompilerOptions *options);
 
 SCRATCH3_EXTERN_C SCRATCH3_EXPORT const void *Scratch3GetProgram(Scratch3 *S, size_t *size);
 
+// find the block the instruction at an offset in the program was compiled
+// from, the program must be compiled with debug information
+SCRATCH3_EXTERN_C SCRATCH3_EXPORT int Scratch3FindSourceLocation(Scratch3 *S, size_t offset, Scratch3SourceLocation *loc);
+
 SCRATCH3_EXTERN_C SCRATCH3_EXPORT int Scratch3VMInit(Scratch3 *S, const Scratch3VMOptions *options);
 
 SCRATCH3_EXTERN_C SCRATCH3_EXPORT int Scratch3VMStart(Scratch3 *S);
@@ -112,4 +143,6 @@ SCRATCH3_EXTERN_C SCRATCH3_EXPORT int Scratch3VMUpdate(Scratch3 *S);
 
 SCRATCH3_EXTERN_C SCRATCH3_EXPORT int Scratch3VMTerminate(Scratch3 *S);
 
+SCRATCH3_EXTERN_C SCRATCH3_EXPORT int Scratch3VMGetHeapStats(Scratch3 *S, Scratch3HeapStats *stats);
+
 #endif // _SCRATCH3_H_
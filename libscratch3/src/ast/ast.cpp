@@ -11,8 +11,11 @@
 
 #include <rapidjson/document.h>
 #include <rapidjson/error/en.h>
+#include <rapidjson/writer.h>
+#include <rapidjson/stringbuffer.h>
 
 #include "../vm/memory.hpp"
+#include "../codegen/cache.hpp"
 
 //! \brief Check whether an opcode is an event handler.
 //! 
@@ -132,11 +135,14 @@ public:
 		return nullptr;
 	}
 
-	Parser(Scratch3 *S) : S(S) {}
+	Parser(Scratch3 *S, bool hashTargets, bool specialize) :
+		S(S), _hashTargets(hashTargets), _specialize(specialize) {}
 private:
 	std::unordered_map<std::string, ASTNode *> _defs;
 
 	Scratch3 *S;
+	bool _hashTargets; // compute SpriteDef::hash
+	bool _specialize; // copy procedures for common constant arguments
 	bool are_errors = false;
 
 	// Write an error message
@@ -204,6 +210,15 @@ private:
 		assert(target.IsObject());
 
 		SpriteDef *sd = new SpriteDef();
+
+		if (_hashTargets)
+		{
+			rapidjson::StringBuffer buffer;
+			rapidjson::Writer<rapidjson::StringBuffer> writer(buffer);
+			target.Accept(writer);
+			sd->hash = HashBytes(HASH_SEED, buffer.GetString(), buffer.GetSize());
+		}
+
 		sd->variables = new VariableDefList();
 		sd->lists = new ListDefList();
 		sd->scripts = new StatementListList();
@@ -339,6 +354,19 @@ private:
 					delete sl;
 				}
 			}
+
+			if (_specialize)
+			{
+				// copies are made by parsing the definition again
+				SpecializeProcedures(sd, [&](StatementList *script) -> StatementList *
+				{
+					_defs.clear();
+
+					StatementList *sl = new StatementList();
+					ParseScript(blocks, script->sl[0]->nodeid, sl);
+					return sl;
+				});
+			}
 		}
 		else
 			Warn("Missing `blocks` member in target");
@@ -999,6 +1027,7 @@ private:
 		}
 
 		n->nodeid = id;
+		n->opcode = opcode.GetString();
 
 		// Create a StatementList object if requested
 		if (createList)
@@ -1434,7 +1463,7 @@ Program *ParseAST(Scratch3 *S, const char *jsonString, size_t length, const Scra
 	Program *p;
 	
 	// parse the AST
-	Parser parser(S);
+	Parser parser(S, options->cacheDir != nullptr, options->optimization >= 2);
 	p = parser.Parse(jsonString, length);
 
 	return p;
@@ -9,6 +9,10 @@
 #include "statement.hpp"
 #include "visitor.hpp"
 #include "optimize.hpp"
+#include "deadcode.hpp"
+#include "licm.hpp"
+#include "inliner.hpp"
+#include "specialize.hpp"
 
 //! Parse JSON string into AST.
 Program *ParseAST(Scratch3 *S, const char *jsonString, size_t length, const Scratch3CompilerOptions *options);
@@ -251,6 +251,7 @@ const char *AstTypeString(AstType type)
 	case Ast_IndexOf: return "IndexOf";
 	case Ast_ListLength: return "ListLength";
 	case Ast_ListContains: return "ListContains";
+	case Ast_InvariantExpr: return "InvariantExpr";
 	case Ast_Statement: return "Statement";
 	case Ast_StatementList: return "StatementList";
 	case Ast_MoveSteps: return "MoveSteps";
@@ -329,6 +330,7 @@ const char *AstTypeString(AstType type)
 	case Ast_ProcProto: return "ProcProto";
 	case Ast_DefineProc: return "DefineProc";
 	case Ast_Call: return "Call";
+	case Ast_InlineCall: return "InlineCall";
 	case Ast_PenClear: return "PenClear";
 	case Ast_PenStamp: return "PenStamp";
 	case Ast_PenDown: return "PenDown";
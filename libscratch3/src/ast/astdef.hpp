@@ -91,6 +91,9 @@ struct ListContains;
 
 struct PenMenuColorProperty;
 
+// Optimizer Expressions
+struct InvariantExpr;
+
 //
 /////////////////////////////////////////////////////////////////////////////////
 // Internal Reporters
@@ -220,6 +223,7 @@ struct HideList;
 struct ProcProto;
 struct DefineProc;
 struct Call;
+struct InlineCall;
 
 // Pen
 struct PenClear;
@@ -371,6 +375,8 @@ enum AstType
 
 	Ast_PenMenuColorProperty,
 
+	Ast_InvariantExpr,
+
 	Ast_Reporter,
 	
 	Ast_GotoReporter,
@@ -476,6 +482,7 @@ enum AstType
 	Ast_ProcProto,
 	Ast_DefineProc,
 	Ast_Call,
+	Ast_InlineCall,
 
 	Ast_PenClear,
 	Ast_PenStamp,
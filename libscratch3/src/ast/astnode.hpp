@@ -54,6 +54,7 @@ struct ASTNode : public RefCounted
 	}
 
 	std::string nodeid;
+	std::string opcode; // opcode of the block, empty if not parsed from one
 
 	ASTNode() = default;
 	virtual ~ASTNode() = default;
@@ -0,0 +1,188 @@
+#include "deadcode.hpp"
+
+#include <unordered_map>
+#include <unordered_set>
+
+#include "ast.hpp"
+#include "../codegen/cache.hpp"
+
+//! \brief Collects the procedures a script calls and the messages it
+//! sends
+class ReachabilityVisitor : public Visitor
+{
+public:
+	virtual void Visit(StatementList *node) override
+	{
+		for (AutoRelease<Statement> &stmt : node->sl)
+		{
+			if (stmt)
+				stmt->Accept(this);
+		}
+	}
+
+	virtual void Visit(Repeat *node) override { VisitList(node->sl); }
+	virtual void Visit(Forever *node) override { VisitList(node->sl); }
+	virtual void Visit(If *node) override { VisitList(node->sl); }
+	virtual void Visit(RepeatUntil *node) override { VisitList(node->sl); }
+
+	virtual void Visit(IfElse *node) override
+	{
+		VisitList(node->sl1);
+		VisitList(node->sl2);
+	}
+
+	virtual void Visit(Broadcast *node) override { AddMessage(node->e.get()); }
+	virtual void Visit(BroadcastAndWait *node) override { AddMessage(node->e.get()); }
+
+	virtual void Visit(Call *node) override
+	{
+		calls.push_back(node->proccode);
+	}
+
+	std::vector<std::string> calls; // proccodes called
+	std::vector<std::string> messages; // messages sent
+	bool dynamic = false; // whether a message is computed at runtime
+private:
+	inline void VisitList(AutoRelease<StatementList> &sl)
+	{
+		if (sl)
+			sl->Accept(this);
+	}
+
+	void AddMessage(Expression *e)
+	{
+		if (!e)
+			return;
+
+		BroadcastExpr *be = e->As<BroadcastExpr>();
+		if (be)
+		{
+			messages.push_back(be->id);
+			return;
+		}
+
+		BroadcastReporter *br = e->As<BroadcastReporter>();
+		if (br)
+		{
+			messages.push_back(br->value);
+			return;
+		}
+
+		Constexpr *ce = e->As<Constexpr>();
+		if (ce && ce->eval.HasValue() && ce->eval.Type() == ValueType_String)
+		{
+			messages.push_back(ce->eval.GetValue().u.string->str);
+			return;
+		}
+
+		dynamic = true;
+	}
+};
+
+struct ScriptRef
+{
+	size_t sprite; // index of the sprite
+	StatementList *script;
+};
+
+void EliminateDeadCode(Program *program)
+{
+	std::vector<AutoRelease<SpriteDef>> &sprites = program->sprites->sprites;
+
+	std::vector<std::unordered_map<std::string, StatementList *>> procs(sprites.size()); // per sprite, proccode -> definition
+	std::unordered_map<std::string, std::vector<ScriptRef>> handlers; // message -> handlers not yet live
+	std::unordered_set<StatementList *> live;
+	std::vector<ScriptRef> queue;
+
+	for (size_t i = 0; i < sprites.size(); i++)
+	{
+		for (AutoRelease<StatementList> &sl : sprites[i]->scripts->sll)
+		{
+			Statement *first = sl->sl.empty() ? nullptr : sl->sl[0].get();
+
+			DefineProc *proc = first ? first->As<DefineProc>() : nullptr;
+			if (proc)
+			{
+				procs[i][proc->proto->proccode] = sl.get();
+				continue;
+			}
+
+			OnEvent *evt = first ? first->As<OnEvent>() : nullptr;
+			if (evt)
+			{
+				handlers[evt->message].push_back(ScriptRef{ i, sl.get() });
+				continue;
+			}
+
+			live.insert(sl.get());
+			queue.push_back(ScriptRef{ i, sl.get() });
+		}
+	}
+
+	auto markLive = [&](const std::vector<ScriptRef> &refs)
+	{
+		for (const ScriptRef &ref : refs)
+		{
+			if (live.insert(ref.script).second)
+				queue.push_back(ref);
+		}
+	};
+
+	// everything reachable from the scripts started by other events
+	bool dynamic = false;
+	while (!queue.empty())
+	{
+		ScriptRef ref = queue.back();
+		queue.pop_back();
+
+		ReachabilityVisitor visitor;
+		ref.script->Accept(&visitor);
+
+		for (const std::string &proccode : visitor.calls)
+		{
+			auto it = procs[ref.sprite].find(proccode);
+			if (it != procs[ref.sprite].end() && live.insert(it->second).second)
+				queue.push_back(ScriptRef{ ref.sprite, it->second });
+		}
+
+		for (const std::string &message : visitor.messages)
+		{
+			auto it = handlers.find(message);
+			if (it != handlers.end())
+			{
+				markLive(it->second);
+				handlers.erase(it);
+			}
+		}
+
+		if (visitor.dynamic && !dynamic)
+		{
+			// any handler may run
+			dynamic = true;
+			for (auto &p : handlers)
+				markLive(p.second);
+			handlers.clear();
+		}
+	}
+
+	// remove everything else, the hash of the removed indices goes into
+	// the cache key as the sprite no longer depends on itself alone
+	for (AutoRelease<SpriteDef> &sd : sprites)
+	{
+		std::vector<AutoRelease<StatementList>> &sll = sd->scripts->sll;
+		std::vector<AutoRelease<StatementList>> kept;
+		kept.reserve(sll.size());
+
+		uint64_t pruned = 0;
+		for (uint64_t i = 0; i < sll.size(); i++)
+		{
+			if (live.find(sll[i].get()) != live.end())
+				kept.push_back(std::move(sll[i]));
+			else
+				pruned = HashBytes(pruned ? pruned : HASH_SEED, &i, sizeof(i));
+		}
+
+		sll = std::move(kept);
+		sd->pruned = pruned;
+	}
+}
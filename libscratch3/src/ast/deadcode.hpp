@@ -0,0 +1,13 @@
+#pragma once
+
+#include "astdef.hpp"
+
+//! \brief Remove scripts which can never run
+//!
+//! Drops broadcast handlers for messages which are never sent and
+//! procedures which are never called from a live script. If any
+//! broadcast computes its message at runtime, every handler is kept.
+//! Sets SpriteDef::pruned on each sprite.
+//!
+//! \param program The program
+void EliminateDeadCode(Program *program);
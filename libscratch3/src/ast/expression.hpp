@@ -1105,3 +1105,13 @@ struct PenMenuColorProperty : public Expression
 
 	std::string type;
 };
+
+// value of an expression hoisted out of a loop, evaluated once before
+// the first iteration, see licm.hpp
+struct InvariantExpr : public Expression
+{
+	EXPR_IMPL(InvariantExpr, Expression);
+	AST_ACCEPTOR;
+
+	AutoRelease<Expression> e; // hoisted expression
+};
@@ -0,0 +1,211 @@
+#include "inliner.hpp"
+
+#include <unordered_map>
+#include <unordered_set>
+
+#include "ast.hpp"
+
+//! \brief Counts the statements of a script and collects its calls
+class CallScanner : public Visitor
+{
+public:
+	virtual void Visit(StatementList *node) override
+	{
+		for (AutoRelease<Statement> &stmt : node->sl)
+		{
+			if (!stmt)
+				continue;
+
+			size++;
+
+			if (stmt->Is(Ast_Call))
+				calls.push_back(&stmt);
+			else
+				stmt->Accept(this);
+		}
+	}
+
+	virtual void Visit(Repeat *node) override { VisitList(node->sl); }
+	virtual void Visit(Forever *node) override { VisitList(node->sl); }
+	virtual void Visit(If *node) override { VisitList(node->sl); }
+	virtual void Visit(RepeatUntil *node) override { VisitList(node->sl); }
+
+	virtual void Visit(IfElse *node) override
+	{
+		VisitList(node->sl1);
+		VisitList(node->sl2);
+	}
+
+	size_t size = 0; // number of statements, including nested ones
+	std::vector<AutoRelease<Statement> *> calls; // statements which are calls
+private:
+	inline void VisitList(AutoRelease<StatementList> &sl)
+	{
+		if (sl)
+			sl->Accept(this);
+	}
+};
+
+struct ProcedureInfo
+{
+	StatementList *script; // the definition
+	DefineProc *proc;
+	size_t size; // number of statements in the body
+	std::vector<std::string> callees; // proccodes called from the body
+	size_t sites = 0; // number of calls to the procedure
+	size_t remaining = 0; // calls which were not inlined
+	bool duplicate = false; // whether the procedure is defined more than once
+	AutoRelease<StatementList> body; // shared body, if inlined
+};
+
+//! \brief Check whether a procedure may end up calling itself
+static bool IsRecursive(const std::unordered_map<std::string, ProcedureInfo> &procs, const std::string &proccode)
+{
+	std::unordered_set<std::string> visited;
+	std::vector<const std::string *> stack{ &proccode };
+
+	while (!stack.empty())
+	{
+		const std::string *current = stack.back();
+		stack.pop_back();
+
+		auto it = procs.find(*current);
+		if (it == procs.end())
+			continue;
+
+		for (const std::string &callee : it->second.callees)
+		{
+			if (callee == proccode)
+				return true;
+
+			if (visited.insert(callee).second)
+				stack.push_back(&callee);
+		}
+	}
+
+	return false;
+}
+
+//! \brief Check whether a call passes exactly the arguments of a
+//! procedure
+static bool ArgumentsMatch(const Call *call, const ProcProto *proto)
+{
+	if (call->args.size() != proto->arguments.size())
+		return false;
+
+	for (const std::pair<std::string, std::string> &arg : proto->arguments)
+	{
+		if (call->args.find(arg.first) == call->args.end())
+			return false;
+	}
+
+	return true;
+}
+
+void InlineProcedures(SpriteDef *sprite)
+{
+	std::vector<AutoRelease<StatementList>> &sll = sprite->scripts->sll;
+
+	std::unordered_map<std::string, ProcedureInfo> procs; // proccode -> info
+	std::vector<AutoRelease<Statement> *> calls; // every call in the sprite
+
+	for (AutoRelease<StatementList> &sl : sll)
+	{
+		CallScanner scanner;
+		sl->Accept(&scanner);
+
+		DefineProc *proc = sl->sl.empty() ? nullptr : sl->sl[0]->As<DefineProc>();
+		if (proc)
+		{
+			auto r = procs.emplace(proc->proto->proccode, ProcedureInfo{ sl.get(), proc, scanner.size - 1 });
+			if (!r.second)
+				r.first->second.duplicate = true;
+
+			for (AutoRelease<Statement> *call : scanner.calls)
+				r.first->second.callees.push_back((*call)->As<Call>()->proccode);
+		}
+
+		calls.insert(calls.end(), scanner.calls.begin(), scanner.calls.end());
+	}
+
+	if (procs.empty())
+		return;
+
+	for (AutoRelease<Statement> *call : calls)
+	{
+		auto it = procs.find((*call)->As<Call>()->proccode);
+		if (it != procs.end())
+			it->second.sites++;
+	}
+
+	// cost model, a procedure is inlined if it is small and inlining it
+	// at every call site does not grow the sprite by too much
+	for (auto &p : procs)
+	{
+		ProcedureInfo &info = p.second;
+		info.remaining = info.sites;
+
+		if (info.duplicate || info.sites == 0 || info.size > INLINE_MAX_SIZE)
+			continue;
+
+		if (info.size * (info.sites - 1) > INLINE_MAX_GROWTH)
+			continue;
+
+		if (IsRecursive(procs, p.first))
+			continue;
+
+		// filled in once calls in the body itself have been replaced
+		info.body = new StatementList();
+	}
+
+	for (AutoRelease<Statement> *slot : calls)
+	{
+		Call *call = (*slot)->As<Call>();
+
+		auto it = procs.find(call->proccode);
+		if (it == procs.end())
+			continue;
+
+		ProcedureInfo &info = it->second;
+		if (!info.body || !ArgumentsMatch(call, info.proc->proto.get()))
+			continue;
+
+		AutoRelease<InlineCall> ic = new InlineCall();
+		ic->nodeid = call->nodeid;
+		ic->opcode = call->opcode;
+		ic->proc = info.proc;
+		ic->sl = info.body;
+
+		for (const std::pair<std::string, std::string> &arg : info.proc->proto->arguments)
+			ic->args.push_back(call->args[arg.first]);
+
+		*slot = ic.get();
+		info.remaining--;
+	}
+
+	for (auto &p : procs)
+	{
+		ProcedureInfo &info = p.second;
+		if (info.body)
+			info.body->sl.assign(info.script->sl.begin() + 1, info.script->sl.end());
+	}
+
+	// remove procedures which are no longer called
+	std::vector<AutoRelease<StatementList>> kept;
+	kept.reserve(sll.size());
+
+	for (AutoRelease<StatementList> &sl : sll)
+	{
+		DefineProc *proc = sl->sl.empty() ? nullptr : sl->sl[0]->As<DefineProc>();
+		if (proc)
+		{
+			const ProcedureInfo &info = procs.at(proc->proto->proccode);
+			if (info.body && info.remaining == 0)
+				continue;
+		}
+
+		kept.push_back(std::move(sl));
+	}
+
+	sll = std::move(kept);
+}
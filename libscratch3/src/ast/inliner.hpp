@@ -0,0 +1,21 @@
+#pragma once
+
+#include "astdef.hpp"
+
+// procedures with more statements are never inlined
+#define INLINE_MAX_SIZE 12
+
+// maximum number of statements inlining a procedure may add to a
+// sprite, the size of the procedure times its call sites after the first
+#define INLINE_MAX_GROWTH 32
+
+//! \brief Substitute the bodies of small procedures for calls to them
+//!
+//! Replaces calls to procedures which are not recursive, are no larger
+//! than INLINE_MAX_SIZE statements and whose copies stay within
+//! INLINE_MAX_GROWTH with InlineCall nodes. Procedures which are no
+//! longer called are removed. The bodies are shared between call sites,
+//! so the sprite must already be optimized.
+//!
+//! \param sprite The sprite
+void InlineProcedures(SpriteDef *sprite);
@@ -0,0 +1,420 @@
+#include "licm.hpp"
+
+#include <unordered_set>
+
+#include "ast.hpp"
+
+//! \brief State the body of a loop may write
+struct LoopEffects
+{
+	std::unordered_set<std::string> variables; // ids of written variables
+	std::unordered_set<std::string> lists; // ids of written lists
+	bool motion = false; // position or direction
+	bool looks = false; // costume, backdrop or size
+	bool sound = false; // volume
+	bool all = false; // anything, the body yields or calls a procedure
+};
+
+//! \brief Collects the effects of the body of a loop
+//!
+//! Statements without a Visit method write nothing an invariant
+//! expression may read.
+class EffectVisitor : public Visitor
+{
+public:
+	virtual void Visit(StatementList *node) override
+	{
+		for (AutoRelease<Statement> &stmt : node->sl)
+		{
+			if (stmt)
+				stmt->Accept(this);
+		}
+	}
+
+	virtual void Visit(Repeat *node) override { VisitList(node->sl); }
+	virtual void Visit(Forever *node) override { VisitList(node->sl); }
+	virtual void Visit(If *node) override { VisitList(node->sl); }
+	virtual void Visit(RepeatUntil *node) override { VisitList(node->sl); }
+
+	virtual void Visit(IfElse *node) override
+	{
+		VisitList(node->sl1);
+		VisitList(node->sl2);
+	}
+
+	virtual void Visit(MoveSteps *node) override { effects.motion = true; }
+	virtual void Visit(TurnDegrees *node) override { effects.motion = true; }
+	virtual void Visit(TurnNegDegrees *node) override { effects.motion = true; }
+	virtual void Visit(Goto *node) override { effects.motion = true; }
+	virtual void Visit(GotoXY *node) override { effects.motion = true; }
+	virtual void Visit(PointDir *node) override { effects.motion = true; }
+	virtual void Visit(PointTowards *node) override { effects.motion = true; }
+	virtual void Visit(ChangeX *node) override { effects.motion = true; }
+	virtual void Visit(SetX *node) override { effects.motion = true; }
+	virtual void Visit(ChangeY *node) override { effects.motion = true; }
+	virtual void Visit(SetY *node) override { effects.motion = true; }
+	virtual void Visit(BounceIfOnEdge *node) override { effects.motion = true; }
+
+	virtual void Visit(SwitchCostume *node) override { effects.looks = true; }
+	virtual void Visit(NextCostume *node) override { effects.looks = true; }
+	virtual void Visit(SwitchBackdrop *node) override { effects.looks = true; }
+	virtual void Visit(NextBackdrop *node) override { effects.looks = true; }
+	virtual void Visit(ChangeSize *node) override { effects.looks = true; }
+	virtual void Visit(SetSize *node) override { effects.looks = true; }
+
+	virtual void Visit(ChangeVolume *node) override { effects.sound = true; }
+	virtual void Visit(SetVolume *node) override { effects.sound = true; }
+
+	virtual void Visit(SetVariable *node) override { effects.variables.insert(node->id); }
+	virtual void Visit(ChangeVariable *node) override { effects.variables.insert(node->id); }
+
+	virtual void Visit(AppendToList *node) override { effects.lists.insert(node->id); }
+	virtual void Visit(DeleteFromList *node) override { effects.lists.insert(node->id); }
+	virtual void Visit(DeleteAllList *node) override { effects.lists.insert(node->id); }
+	virtual void Visit(InsertInList *node) override { effects.lists.insert(node->id); }
+	virtual void Visit(ReplaceInList *node) override { effects.lists.insert(node->id); }
+
+	// statements which yield, other scripts may run in between
+	virtual void Visit(Glide *node) override { effects.all = true; }
+	virtual void Visit(GlideXY *node) override { effects.all = true; }
+	virtual void Visit(SayForSecs *node) override { effects.all = true; }
+	virtual void Visit(ThinkForSecs *node) override { effects.all = true; }
+	virtual void Visit(SwitchBackdropAndWait *node) override { effects.all = true; }
+	virtual void Visit(PlaySoundUntilDone *node) override { effects.all = true; }
+	virtual void Visit(BroadcastAndWait *node) override { effects.all = true; }
+	virtual void Visit(WaitSecs *node) override { effects.all = true; }
+	virtual void Visit(WaitUntil *node) override { effects.all = true; }
+	virtual void Visit(AskAndWait *node) override { effects.all = true; }
+
+	// the procedure may write anything or yield
+	virtual void Visit(Call *node) override { effects.all = true; }
+
+	LoopEffects effects;
+private:
+	inline void VisitList(AutoRelease<StatementList> &sl)
+	{
+		if (sl)
+			sl->Accept(this);
+	}
+};
+
+//! \brief Checks whether an expression is invariant in a loop
+class InvarianceVisitor : public Visitor
+{
+public:
+	virtual void Visit(Constexpr *node) override { invariant = true; }
+
+	virtual void Visit(XPos *node) override { invariant = Reads(effects.motion); }
+	virtual void Visit(YPos *node) override { invariant = Reads(effects.motion); }
+	virtual void Visit(Direction *node) override { invariant = Reads(effects.motion); }
+
+	virtual void Visit(CurrentCostume *node) override { invariant = Reads(effects.looks); }
+	virtual void Visit(CurrentBackdrop *node) override { invariant = Reads(effects.looks); }
+	virtual void Visit(Size *node) override { invariant = Reads(effects.looks); }
+
+	virtual void Visit(Volume *node) override { invariant = Reads(effects.sound); }
+
+	virtual void Visit(Add *node) override { invariant = Test(node->e1) && Test(node->e2); }
+	virtual void Visit(Sub *node) override { invariant = Test(node->e1) && Test(node->e2); }
+	virtual void Visit(Mul *node) override { invariant = Test(node->e1) && Test(node->e2); }
+	virtual void Visit(Div *node) override { invariant = Test(node->e1) && Test(node->e2); }
+	virtual void Visit(Neg *node) override { invariant = Test(node->e); }
+	virtual void Visit(Inc *node) override { invariant = Test(node->e); }
+	virtual void Visit(Dec *node) override { invariant = Test(node->e); }
+	virtual void Visit(Greater *node) override { invariant = Test(node->e1) && Test(node->e2); }
+	virtual void Visit(Less *node) override { invariant = Test(node->e1) && Test(node->e2); }
+	virtual void Visit(Equal *node) override { invariant = Test(node->e1) && Test(node->e2); }
+	virtual void Visit(LogicalAnd *node) override { invariant = Test(node->e1) && Test(node->e2); }
+	virtual void Visit(LogicalOr *node) override { invariant = Test(node->e1) && Test(node->e2); }
+	virtual void Visit(LogicalNot *node) override { invariant = Test(node->e); }
+	virtual void Visit(Concat *node) override { invariant = Test(node->e1) && Test(node->e2); }
+	virtual void Visit(CharAt *node) override { invariant = Test(node->e1) && Test(node->e2); }
+	virtual void Visit(StringLength *node) override { invariant = Test(node->e); }
+	virtual void Visit(StringContains *node) override { invariant = Test(node->e1) && Test(node->e2); }
+	virtual void Visit(Mod *node) override { invariant = Test(node->e1) && Test(node->e2); }
+	virtual void Visit(Round *node) override { invariant = Test(node->e); }
+	virtual void Visit(MathFunc *node) override { invariant = Test(node->e); }
+
+	virtual void Visit(VariableExpr *node) override { invariant = Reads(effects.variables.count(node->id) != 0); }
+	virtual void Visit(BroadcastExpr *node) override { invariant = true; }
+
+	virtual void Visit(ListExpr *node) override { invariant = Reads(effects.lists.count(node->id) != 0); }
+	virtual void Visit(ListLength *node) override { invariant = Reads(effects.lists.count(node->id) != 0); }
+	virtual void Visit(ListAccess *node) override { invariant = Reads(effects.lists.count(node->id) != 0) && Test(node->e); }
+	virtual void Visit(IndexOf *node) override { invariant = Reads(effects.lists.count(node->id) != 0) && Test(node->e); }
+	virtual void Visit(ListContains *node) override { invariant = Reads(effects.lists.count(node->id) != 0) && Test(node->e); }
+
+	//! \brief Check whether an expression is invariant
+	//!
+	//! Expressions without a Visit method, such as random numbers and
+	//! sensing, are never invariant.
+	//!
+	//! \param e The expression
+	//!
+	//! \return Whether e evaluates to the same value in every iteration
+	bool Test(Expression *e)
+	{
+		if (!e)
+			return false;
+
+		// menu values and procedure arguments never change
+		if (e->Is(Ast_Reporter))
+			return true;
+
+		invariant = false;
+		e->Accept(this);
+		return invariant;
+	}
+
+	inline bool Test(AutoRelease<Expression> &e) { return Test(e.get()); }
+
+	InvarianceVisitor(const LoopEffects &effects) : effects(effects) {}
+private:
+	const LoopEffects &effects;
+	bool invariant = false;
+
+	inline bool Reads(bool written) const
+	{
+		return !effects.all && !written;
+	}
+};
+
+//! \brief Replaces the invariant expressions in the body of a loop
+class HoistVisitor : public Visitor
+{
+public:
+	virtual void Visit(StatementList *node) override
+	{
+		for (AutoRelease<Statement> &stmt : node->sl)
+		{
+			if (stmt)
+				stmt->Accept(this);
+		}
+	}
+
+	virtual void Visit(Repeat *node) override
+	{
+		Hoist(node->e);
+		VisitList(node->sl);
+		VisitInvariants(node->invariants);
+	}
+
+	virtual void Visit(Forever *node) override
+	{
+		VisitList(node->sl);
+		VisitInvariants(node->invariants);
+	}
+
+	virtual void Visit(If *node) override
+	{
+		Hoist(node->e);
+		VisitList(node->sl);
+	}
+
+	virtual void Visit(IfElse *node) override
+	{
+		Hoist(node->e);
+		VisitList(node->sl1);
+		VisitList(node->sl2);
+	}
+
+	virtual void Visit(RepeatUntil *node) override
+	{
+		Hoist(node->e);
+		VisitList(node->sl);
+		VisitInvariants(node->invariants);
+	}
+
+	virtual void Visit(Call *node) override
+	{
+		for (std::pair<const std::string, AutoRelease<Expression>> &p : node->args)
+			Hoist(p.second);
+	}
+
+	virtual void Visit(MoveSteps *node) override { Hoist(node->e); }
+	virtual void Visit(TurnDegrees *node) override { Hoist(node->e); }
+	virtual void Visit(TurnNegDegrees *node) override { Hoist(node->e); }
+	virtual void Visit(Goto *node) override { Hoist(node->e); }
+	virtual void Visit(GotoXY *node) override { Hoist(node->e1); Hoist(node->e2); }
+	virtual void Visit(Glide *node) override { Hoist(node->e1); Hoist(node->e2); }
+	virtual void Visit(GlideXY *node) override { Hoist(node->e1); Hoist(node->e2); Hoist(node->e3); }
+	virtual void Visit(PointDir *node) override { Hoist(node->e); }
+	virtual void Visit(PointTowards *node) override { Hoist(node->e); }
+	virtual void Visit(ChangeX *node) override { Hoist(node->e); }
+	virtual void Visit(SetX *node) override { Hoist(node->e); }
+	virtual void Visit(ChangeY *node) override { Hoist(node->e); }
+	virtual void Visit(SetY *node) override { Hoist(node->e); }
+	virtual void Visit(SayForSecs *node) override { Hoist(node->e1); Hoist(node->e2); }
+	virtual void Visit(Say *node) override { Hoist(node->e); }
+	virtual void Visit(ThinkForSecs *node) override { Hoist(node->e1); Hoist(node->e2); }
+	virtual void Visit(Think *node) override { Hoist(node->e); }
+	virtual void Visit(SwitchCostume *node) override { Hoist(node->e); }
+	virtual void Visit(SwitchBackdrop *node) override { Hoist(node->e); }
+	virtual void Visit(SwitchBackdropAndWait *node) override { Hoist(node->e); }
+	virtual void Visit(ChangeSize *node) override { Hoist(node->e); }
+	virtual void Visit(SetSize *node) override { Hoist(node->e); }
+	virtual void Visit(ChangeGraphicEffect *node) override { Hoist(node->e); }
+	virtual void Visit(SetGraphicEffect *node) override { Hoist(node->e); }
+	virtual void Visit(MoveLayer *node) override { Hoist(node->e); }
+	virtual void Visit(PlaySoundUntilDone *node) override { Hoist(node->e); }
+	virtual void Visit(StartSound *node) override { Hoist(node->e); }
+	virtual void Visit(ChangeSoundEffect *node) override { Hoist(node->e); }
+	virtual void Visit(SetSoundEffect *node) override { Hoist(node->e); }
+	virtual void Visit(ChangeVolume *node) override { Hoist(node->e); }
+	virtual void Visit(SetVolume *node) override { Hoist(node->e); }
+	virtual void Visit(Broadcast *node) override { Hoist(node->e); }
+	virtual void Visit(BroadcastAndWait *node) override { Hoist(node->e); }
+	virtual void Visit(WaitSecs *node) override { Hoist(node->e); }
+	virtual void Visit(WaitUntil *node) override { Hoist(node->e); }
+	virtual void Visit(CreateClone *node) override { Hoist(node->e); }
+	virtual void Visit(AskAndWait *node) override { Hoist(node->e); }
+	virtual void Visit(SetVariable *node) override { Hoist(node->e); }
+	virtual void Visit(ChangeVariable *node) override { Hoist(node->e); }
+	virtual void Visit(AppendToList *node) override { Hoist(node->e); }
+	virtual void Visit(DeleteFromList *node) override { Hoist(node->e); }
+	virtual void Visit(InsertInList *node) override { Hoist(node->e1); Hoist(node->e2); }
+	virtual void Visit(ReplaceInList *node) override { Hoist(node->e1); Hoist(node->e2); }
+	virtual void Visit(SetPenColor *node) override { Hoist(node->e); }
+	virtual void Visit(ChangePenProperty *node) override { Hoist(node->e1); Hoist(node->e2); }
+	virtual void Visit(SetPenProperty *node) override { Hoist(node->e1); Hoist(node->e2); }
+	virtual void Visit(ChangePenSize *node) override { Hoist(node->e); }
+	virtual void Visit(SetPenSize *node) override { Hoist(node->e); }
+
+	virtual void Visit(Touching *node) override { Hoist(node->e); }
+	virtual void Visit(TouchingColor *node) override { Hoist(node->e); }
+	virtual void Visit(DistanceTo *node) override { Hoist(node->e); }
+	virtual void Visit(KeyPressed *node) override { Hoist(node->e); }
+	virtual void Visit(PropertyOf *node) override { Hoist(node->e); }
+	virtual void Visit(Add *node) override { Hoist(node->e1); Hoist(node->e2); }
+	virtual void Visit(Sub *node) override { Hoist(node->e1); Hoist(node->e2); }
+	virtual void Visit(Mul *node) override { Hoist(node->e1); Hoist(node->e2); }
+	virtual void Visit(Div *node) override { Hoist(node->e1); Hoist(node->e2); }
+	virtual void Visit(Neg *node) override { Hoist(node->e); }
+	virtual void Visit(Inc *node) override { Hoist(node->e); }
+	virtual void Visit(Dec *node) override { Hoist(node->e); }
+	virtual void Visit(Random *node) override { Hoist(node->e1); Hoist(node->e2); }
+	virtual void Visit(Greater *node) override { Hoist(node->e1); Hoist(node->e2); }
+	virtual void Visit(Less *node) override { Hoist(node->e1); Hoist(node->e2); }
+	virtual void Visit(Equal *node) override { Hoist(node->e1); Hoist(node->e2); }
+	virtual void Visit(LogicalAnd *node) override { Hoist(node->e1); Hoist(node->e2); }
+	virtual void Visit(LogicalOr *node) override { Hoist(node->e1); Hoist(node->e2); }
+	virtual void Visit(LogicalNot *node) override { Hoist(node->e); }
+	virtual void Visit(Concat *node) override { Hoist(node->e1); Hoist(node->e2); }
+	virtual void Visit(CharAt *node) override { Hoist(node->e1); Hoist(node->e2); }
+	virtual void Visit(StringLength *node) override { Hoist(node->e); }
+	virtual void Visit(StringContains *node) override { Hoist(node->e1); Hoist(node->e2); }
+	virtual void Visit(Mod *node) override { Hoist(node->e1); Hoist(node->e2); }
+	virtual void Visit(Round *node) override { Hoist(node->e); }
+	virtual void Visit(MathFunc *node) override { Hoist(node->e); }
+	virtual void Visit(ListAccess *node) override { Hoist(node->e); }
+	virtual void Visit(IndexOf *node) override { Hoist(node->e); }
+	virtual void Visit(ListContains *node) override { Hoist(node->e); }
+
+	//! \brief Hoist an expression, or the largest invariant expressions
+	//! in it
+	void Hoist(AutoRelease<Expression> &e)
+	{
+		if (!e)
+			return;
+
+		if (IsWorthHoisting(e.get()) && invariance.Test(e))
+		{
+			AutoRelease<InvariantExpr> inv = new InvariantExpr();
+			inv->e = e;
+			inv->eval = e->eval; // keeps the type, the value is not known
+			invariants.push_back(inv);
+
+			e = inv.get();
+			return;
+		}
+
+		e->Accept(this);
+	}
+
+	HoistVisitor(const LoopEffects &effects, std::vector<AutoRelease<InvariantExpr>> &invariants) :
+		invariants(invariants), invariance(effects) {}
+private:
+	std::vector<AutoRelease<InvariantExpr>> &invariants; // receives the hoisted values
+	InvarianceVisitor invariance;
+
+	inline void VisitList(AutoRelease<StatementList> &sl)
+	{
+		if (sl)
+			sl->Accept(this);
+	}
+
+	//! \brief Visit the values hoisted out of a nested loop, these are
+	//! evaluated in every iteration of the enclosing loop
+	inline void VisitInvariants(std::vector<AutoRelease<InvariantExpr>> &nested)
+	{
+		for (AutoRelease<InvariantExpr> &inv : nested)
+			Hoist(inv->e);
+	}
+
+	//! \brief Whether evaluating an expression costs more than reading
+	//! a hoisted value
+	static bool IsWorthHoisting(Expression *e)
+	{
+		if (e->Is(Ast_Consteval))
+			return !e->Is(Ast_Constexpr);
+
+		switch (e->GetType())
+		{
+		default:
+			return false;
+		case Ast_CurrentCostume:
+		case Ast_CurrentBackdrop:
+		case Ast_ListExpr:
+		case Ast_ListAccess:
+		case Ast_IndexOf:
+		case Ast_ListContains:
+			return true;
+		}
+	}
+};
+
+void HoistInvariants(Statement *loop, bool warp)
+{
+	AutoRelease<StatementList> *body;
+	AutoRelease<Expression> *condition = nullptr;
+	std::vector<AutoRelease<InvariantExpr>> *invariants;
+
+	switch (loop->GetType())
+	{
+	default:
+		return;
+	case Ast_Repeat: {
+		Repeat *repeat = static_cast<Repeat *>(loop);
+		body = &repeat->sl;
+		invariants = &repeat->invariants;
+		break;
+	}
+	case Ast_Forever: {
+		Forever *forever = static_cast<Forever *>(loop);
+		body = &forever->sl;
+		invariants = &forever->invariants;
+		break;
+	}
+	case Ast_RepeatUntil: {
+		RepeatUntil *repeatUntil = static_cast<RepeatUntil *>(loop);
+		body = &repeatUntil->sl;
+		condition = &repeatUntil->e;
+		invariants = &repeatUntil->invariants;
+		break;
+	}
+	}
+
+	if (!*body)
+		return;
+
+	EffectVisitor effects;
+	if (warp)
+		(*body)->Accept(&effects);
+	else
+		effects.effects.all = true; // the loop yields at the end of each iteration
+
+	HoistVisitor hoist(effects.effects, *invariants);
+	if (condition)
+		hoist.Hoist(*condition);
+	(*body)->Accept(&hoist);
+}
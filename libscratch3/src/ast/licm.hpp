@@ -0,0 +1,18 @@
+#pragma once
+
+#include "astdef.hpp"
+
+//! \brief Hoist loop-invariant expressions out of a loop
+//!
+//! Replaces the largest expressions in the body of the loop whose
+//! inputs the body never writes with InvariantExpr nodes, and adds
+//! them to the invariants of the loop, which are evaluated once before
+//! the first iteration. A loop which yields may observe writes from
+//! other scripts, so out of loops outside of warp procedures, or whose
+//! body waits or calls a procedure, only expressions built from
+//! constants and arguments are hoisted. Loops nested in the body must
+//! already have been hoisted.
+//!
+//! \param loop The loop, a Repeat, Forever or RepeatUntil
+//! \param warp Whether the loop is in a warp procedure
+void HoistInvariants(Statement *loop, bool warp);
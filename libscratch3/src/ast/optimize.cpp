@@ -6,6 +6,25 @@
 #include "../vm/memory.hpp"
 #include "../codegen/util.hpp"
 
+//! \brief Check whether a type is a number
+static inline bool IsNumberType(ValueType type)
+{
+	return type == ValueType_Integer || type == ValueType_Real;
+}
+
+//! \brief Get the type of a value which is either of two types
+//!
+//! \return The common type, ValueType_Real if both are numbers or
+//! ValueType_Undefined if there is none
+static ValueType JoinTypes(ValueType a, ValueType b)
+{
+	if (a == b)
+		return a;
+	if (IsNumberType(a) && IsNumberType(b))
+		return ValueType_Real;
+	return ValueType_Undefined;
+}
+
 class StaticEnvironment
 {
 public:
@@ -21,6 +40,14 @@ public:
 
 	void Merge(const StaticEnvironment &from)
 	{
+		// nothing is known about variables the other path dropped, for
+		// example because it yields
+		for (auto &p : _variables)
+		{
+			if (from._variables.find(p.first) == from._variables.end())
+				p.second.SetUndefined();
+		}
+
 		for (auto &p : from._variables)
 		{
 			OptionalValue &oldval = _variables[p.first];
@@ -29,17 +56,10 @@ public:
 			if (oldval.HasValue() && newval.HasValue())
 			{
 				if (!Equals(oldval.GetValue(), newval.GetValue()))
-				{
-					if (oldval.Type() == newval.Type())
-						oldval.SetType(newval.Type()); // Removes value, keeps type
-					else
-						oldval.SetUndefined();
-				}
+					oldval.SetType(JoinTypes(oldval.Type(), newval.Type())); // Removes value, keeps type
 			}
-			else if (oldval.Type() == newval.Type())
-				oldval.SetType(newval.Type()); // Removes value, keeps type
 			else
-				oldval.SetUndefined();
+				oldval.SetType(JoinTypes(oldval.Type(), newval.Type())); // Removes value, keeps type
 		}
 	}
 
@@ -85,6 +105,14 @@ private:
 	std::unordered_map<std::string, OptionalValue> _variables;
 };
 
+//! \brief Argument reporter in the body of a procedure
+struct ArgumentRef
+{
+	ProcProto *proto; // the procedure
+	Reporter *reporter; // the reporter
+	std::string name; // name of the argument
+};
+
 class OptimizeVisitor : public Visitor
 {
 public:
@@ -245,7 +273,7 @@ public:
 			node->eval.SetInteger();
 			break;
 		case PropertyTarget_BackdropName:
-			node->eval.SetInteger();
+			node->eval.SetString();
 			break;
 		case PropertyTarget_XPosition:
 			node->eval.SetReal();
@@ -260,7 +288,7 @@ public:
 			node->eval.SetInteger();
 			break;
 		case PropertyTarget_CostumeName:
-			node->eval.SetInteger();
+			node->eval.SetString();
 			break;
 		case PropertyTarget_Size:
 			node->eval.SetReal();
@@ -586,7 +614,17 @@ public:
 		output = node;
 
 		if (lhs.eval.HasValue() && rhs.eval.HasValue())
-			node->eval.SetBool(ToReal(lhs.eval.GetValue()) > ToReal(rhs.eval.GetValue()));
+		{
+			Value tmp;
+			InitializeValue(tmp);
+			Assign(tmp, lhs.eval.GetValue());
+
+			ValueGreater(tmp, rhs.eval.GetValue());
+
+			node->eval.SetValue(tmp);
+
+			ReleaseValue(tmp);
+		}
 
 		TryCollapse();
 	}
@@ -608,7 +646,17 @@ public:
 		output = node;
 
 		if (lhs.eval.HasValue() && rhs.eval.HasValue())
-			node->eval.SetBool(ToReal(lhs.eval.GetValue()) < ToReal(rhs.eval.GetValue()));
+		{
+			Value tmp;
+			InitializeValue(tmp);
+			Assign(tmp, lhs.eval.GetValue());
+
+			ValueLess(tmp, rhs.eval.GetValue());
+
+			node->eval.SetValue(tmp);
+
+			ReleaseValue(tmp);
+		}
 
 		TryCollapse();
 	}
@@ -855,11 +903,9 @@ public:
 
 		if (lhs.eval.HasValue() && rhs.eval.HasValue())
 		{
-			char c = ValueCharAt(lhs.eval.GetValue(), ToInteger(rhs.eval.GetValue()));
-			
 			Value tmp;
 			InitializeValue(tmp);
-			SetChar(tmp, c);
+			ValueCharAt(tmp, lhs.eval.GetValue(), ToInteger(rhs.eval.GetValue()));
 
 			node->eval.SetValue(tmp);
 
@@ -1176,6 +1222,31 @@ public:
 		output = node;
 	}
 
+	virtual void Visit(InvariantExpr *node) override
+	{
+		output = node;
+	}
+
+	virtual void Visit(ArgReporterStringNumber *node) override
+	{
+		if (BindConstant(node->value))
+			return;
+
+		if (proto)
+			arguments.push_back(ArgumentRef{ proto, node, node->value });
+		output = node;
+	}
+
+	virtual void Visit(ArgReporterBoolean *node) override
+	{
+		if (BindConstant(node->value))
+			return;
+
+		if (proto)
+			arguments.push_back(ArgumentRef{ proto, node, node->value });
+		output = node;
+	}
+
 	virtual void Visit(MoveSteps *node) override
 	{
 		output.set(node->e);
@@ -1709,6 +1780,11 @@ public:
 		node->sl->Accept(this);
 		node->sl = output.cast<StatementList>();
 
+		if (level >= 2)
+			HoistInvariants(node, warp);
+
+		GetEnv().Clear(); // Loop may run zero times, or yield before it exits
+
 		output = node;
 	}
 
@@ -1728,6 +1804,9 @@ public:
 		node->sl->Accept(this);
 		node->sl = output.cast<StatementList>();
 
+		if (level >= 2)
+			HoistInvariants(node, warp);
+
 		output = node;
 	}
 
@@ -1914,6 +1993,11 @@ public:
 		node->sl->Accept(this);
 		node->sl = output.cast<Expression>();
 
+		if (level >= 2)
+			HoistInvariants(node, warp);
+
+		GetEnv().Clear(); // Loop may run zero times, or yield before it exits
+
 		output = node;
 	}
 
@@ -2025,7 +2109,8 @@ public:
 				ce->eval.SetInteger(0);
 
 				sv->e = ce.get();
-				
+
+				value.SetReal();
 				break;
 			}
 			case ValueType_Integer:
@@ -2050,10 +2135,14 @@ public:
 
 			sv->e = node->e;
 
+			value.SetReal();
+
 			output.set(sv);
 
 			return;
 		}
+		else
+			value.SetReal(); // Result of the addition is always a number
 
 		output = node;
 	}
@@ -2282,6 +2371,10 @@ public:
 			p.second = output.cast<Expression>();
 		}
 
+		calls.push_back(node);
+
+		GetEnv().Clear(); // Procedure may write any variable or yield
+
 		output = node;
 	}
 
@@ -2344,8 +2437,15 @@ public:
 
 	virtual void Visit(StatementListList *node) override
 	{
+		calls.clear();
+		arguments.clear();
+
 		for (AutoRelease<StatementList> &sl : node->sll)
 		{
+			DefineProc *proc = sl->sl.empty() ? nullptr : sl->sl[0]->As<DefineProc>();
+			proto = proc ? proc->proto.get() : nullptr;
+			warp = proto && proto->warp;
+
 			PushEnv();
 
 			output = sl.get();
@@ -2355,6 +2455,11 @@ public:
 			PopEnv();
 		}
 
+		proto = nullptr;
+		warp = false;
+
+		InferArgumentTypes();
+
 		output = node;
 	}
 
@@ -2377,10 +2482,88 @@ public:
 	AutoRelease<ASTNode> output;
 	std::list<StaticEnvironment> envs;
 	int level;
+	bool warp = false; // whether the current script is a warp procedure
+	ProcProto *proto = nullptr; // prototype of the current script, if it is a procedure
+
+	std::vector<Call *> calls; // procedure calls in the sprite
+	std::vector<ArgumentRef> arguments; // argument reporters in procedures of the sprite
 
 	OptimizeVisitor(int level) : level(level) {}
 private:
 
+	//! \brief Replace an argument bound by specialization with its value
+	//!
+	//! \param name The name of the argument
+	//!
+	//! \return Whether output was set to the value
+	bool BindConstant(const std::string &name)
+	{
+		if (!proto)
+			return false;
+
+		auto it = proto->constants.find(name);
+		if (it == proto->constants.end())
+			return false;
+
+		Constexpr *ce = new Constexpr();
+		ce->eval = it->second->eval;
+		output = ce;
+		return true;
+	}
+
+	//! \brief Type the argument reporters by the values passed to the
+	//! procedure at every call site
+	//!
+	//! Runs once all scripts of the sprite are optimized, so the types
+	//! only reach the operators that read an argument directly.
+	void InferArgumentTypes()
+	{
+		// proccode -> argument id -> type
+		std::unordered_map<std::string, std::unordered_map<std::string, ValueType>> types;
+
+		for (Call *call : calls)
+		{
+			bool first = types.find(call->proccode) == types.end();
+			std::unordered_map<std::string, ValueType> &args = types[call->proccode];
+
+			// arguments missing from a call take their default value
+			for (std::pair<const std::string, ValueType> &p : args)
+			{
+				if (call->args.find(p.first) == call->args.end())
+					p.second = ValueType_Undefined;
+			}
+
+			for (std::pair<const std::string, AutoRelease<Expression>> &p : call->args)
+			{
+				ValueType type = p.second ? p.second->eval.Type() : ValueType_Undefined;
+
+				auto it = args.find(p.first);
+				if (it != args.end())
+					it->second = JoinTypes(it->second, type);
+				else
+					args[p.first] = first ? type : ValueType_Undefined;
+			}
+		}
+
+		for (ArgumentRef &ref : arguments)
+		{
+			auto procIt = types.find(ref.proto->proccode);
+			if (procIt == types.end())
+				continue; // never called
+
+			for (std::pair<std::string, std::string> &arg : ref.proto->arguments)
+			{
+				if (arg.second != ref.name)
+					continue;
+
+				auto it = procIt->second.find(arg.first);
+				if (it != procIt->second.end())
+					ref.reporter->eval.SetType(IsNumberType(it->second) ? ValueType_Real : it->second);
+				break;
+			}
+		}
+	}
+
 	inline StaticEnvironment &GetEnv()
 	{
 		return envs.front();
@@ -2432,8 +2615,11 @@ private:
 	}
 };
 
-void Optimize(Program *prog, int level)
+void OptimizeSprite(SpriteDef *sprite, int level)
 {
 	OptimizeVisitor visitor(level);
-	prog->Accept(&visitor);
+	sprite->Accept(&visitor);
+
+	if (level >= 2)
+		InlineProcedures(sprite);
 }
@@ -2,4 +2,4 @@
 
 #include "astdef.hpp"
 
-void Optimize(Program *prog, int level);
+void OptimizeSprite(SpriteDef *sprite, int level);
@@ -116,6 +116,8 @@ struct SpriteDef : public ASTNode
 	AST_ACCEPTOR;
 	
 	std::string name;
+	uint64_t hash = 0; // hash of the target's JSON, only computed when compiling with a cache
+	uint64_t pruned = 0; // hash of the scripts removed by EliminateDeadCode, 0 if none
 
 	AutoRelease<VariableDefList> variables;
 	AutoRelease<ListDefList> lists;
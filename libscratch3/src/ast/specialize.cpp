@@ -0,0 +1,252 @@
+#include "specialize.hpp"
+
+#include <algorithm>
+#include <unordered_map>
+
+#include "ast.hpp"
+#include "../vm/memory.hpp"
+
+//! \brief Counts the statements of a script and collects its calls
+class CallCollector : public Visitor
+{
+public:
+	virtual void Visit(StatementList *node) override
+	{
+		for (AutoRelease<Statement> &stmt : node->sl)
+		{
+			if (!stmt)
+				continue;
+
+			size++;
+			stmt->Accept(this);
+		}
+	}
+
+	virtual void Visit(Repeat *node) override { VisitList(node->sl); }
+	virtual void Visit(Forever *node) override { VisitList(node->sl); }
+	virtual void Visit(If *node) override { VisitList(node->sl); }
+	virtual void Visit(RepeatUntil *node) override { VisitList(node->sl); }
+
+	virtual void Visit(IfElse *node) override
+	{
+		VisitList(node->sl1);
+		VisitList(node->sl2);
+	}
+
+	virtual void Visit(Call *node) override
+	{
+		calls.push_back(node);
+	}
+
+	size_t size = 0; // number of statements, including nested ones
+	std::vector<Call *> calls; // calls in the script
+private:
+	inline void VisitList(AutoRelease<StatementList> &sl)
+	{
+		if (sl)
+			sl->Accept(this);
+	}
+};
+
+struct SpecializedProc
+{
+	StatementList *script; // the definition
+	ProcProto *proto;
+	size_t size; // number of statements in the body
+	bool duplicate = false; // whether the procedure is defined more than once
+};
+
+//! \brief Calls passing the same constant arguments to a procedure
+struct CallGroup
+{
+	const std::string *key; // proccode and constants, see SpecializeProcedures
+	SpecializedProc *proc;
+	std::vector<bool> constant; // per argument of the procedure
+	std::vector<Call *> calls;
+};
+
+//! \brief Get the constant passed as an argument, if any
+static Constexpr *GetConstant(Call *call, const std::string &id)
+{
+	auto it = call->args.find(id);
+	if (it == call->args.end() || !it->second)
+		return nullptr;
+
+	Constexpr *ce = it->second->As<Constexpr>();
+	return ce && ce->eval.HasValue() ? ce : nullptr;
+}
+
+//! \brief Append a value to a key identifying it exactly
+static void AppendKey(std::string &key, const Value &v)
+{
+	key += std::to_string(v.type);
+	key += ':';
+
+	switch (v.type)
+	{
+	default:
+		break;
+	case ValueType_Integer:
+		key += std::to_string(v.u.integer);
+		break;
+	case ValueType_Real:
+		key.append(reinterpret_cast<const char *>(&v.u.real), sizeof(v.u.real));
+		break;
+	case ValueType_Bool:
+		key += v.u.boolean ? '1' : '0';
+		break;
+	case ValueType_String:
+		key += std::to_string(v.u.string->len);
+		key += ':';
+		key.append(v.u.string->str, v.u.string->len);
+		break;
+	}
+
+	key += ';';
+}
+
+void SpecializeProcedures(SpriteDef *sprite, const std::function<StatementList *(StatementList *)> &clone)
+{
+	std::vector<AutoRelease<StatementList>> &sll = sprite->scripts->sll;
+
+	std::unordered_map<std::string, SpecializedProc> procs; // proccode -> info
+	std::vector<Call *> calls; // every call in the sprite
+
+	for (AutoRelease<StatementList> &sl : sll)
+	{
+		CallCollector collector;
+		sl->Accept(&collector);
+
+		DefineProc *proc = sl->sl.empty() ? nullptr : sl->sl[0]->As<DefineProc>();
+		if (proc && proc->proto)
+		{
+			auto r = procs.emplace(proc->proto->proccode, SpecializedProc{ sl.get(), proc->proto.get(), collector.size - 1 });
+			if (!r.second)
+				r.first->second.duplicate = true;
+		}
+
+		calls.insert(calls.end(), collector.calls.begin(), collector.calls.end());
+	}
+
+	if (procs.empty())
+		return;
+
+	// group the calls by procedure and constant arguments
+	std::unordered_map<std::string, CallGroup> groups;
+	for (Call *call : calls)
+	{
+		auto it = procs.find(call->proccode);
+		if (it == procs.end())
+			continue;
+
+		SpecializedProc &proc = it->second;
+		if (proc.duplicate || proc.size > SPECIALIZE_MAX_SIZE)
+			continue;
+
+		if (call->args.size() != proc.proto->arguments.size())
+			continue; // the compiler reports this
+
+		std::string key = call->proccode;
+		key += '\0';
+
+		std::vector<bool> constant;
+		bool any = false;
+		for (std::pair<std::string, std::string> &arg : proc.proto->arguments)
+		{
+			Constexpr *ce = GetConstant(call, arg.first);
+			constant.push_back(ce != nullptr);
+
+			if (ce)
+			{
+				AppendKey(key, ce->eval.GetValue());
+				any = true;
+			}
+			else
+				key += "*;";
+		}
+
+		if (!any)
+			continue;
+
+		CallGroup &group = groups[key];
+		group.proc = &proc;
+		group.constant = std::move(constant);
+		group.calls.push_back(call);
+	}
+
+	std::vector<CallGroup *> order;
+	for (auto &p : groups)
+	{
+		if (p.second.calls.size() >= SPECIALIZE_MIN_CALLS)
+		{
+			p.second.key = &p.first;
+			order.push_back(&p.second);
+		}
+	}
+
+	// most frequent first, ties broken by proccode and constants so the
+	// output does not depend on hashing
+	std::sort(order.begin(), order.end(), [](const CallGroup *a, const CallGroup *b)
+	{
+		if (a->calls.size() != b->calls.size())
+			return a->calls.size() > b->calls.size();
+		return *a->key < *b->key;
+	});
+
+	size_t growth = 0;
+	size_t copies = 0;
+	for (CallGroup *group : order)
+	{
+		SpecializedProc &proc = *group->proc;
+		if (growth + proc.size > SPECIALIZE_MAX_GROWTH)
+			continue;
+
+		AutoRelease<StatementList> sl = clone(proc.script);
+		DefineProc *def = (sl && !sl->sl.empty()) ? sl->sl[0]->As<DefineProc>() : nullptr;
+		if (!def || !def->proto)
+			continue;
+
+		ProcProto *proto = def->proto.get();
+
+		// pick a name no procedure uses
+		std::string proccode;
+		do
+			proccode = proto->proccode + " #" + std::to_string(++copies);
+		while (procs.find(proccode) != procs.end());
+
+		proto->proccode = proccode;
+
+		// bind the constant arguments
+		Call *first = group->calls[0];
+		std::vector<std::pair<std::string, std::string>> arguments;
+		for (size_t i = 0; i < proto->arguments.size(); i++)
+		{
+			std::pair<std::string, std::string> &arg = proto->arguments[i];
+			if (!group->constant[i])
+			{
+				arguments.push_back(std::move(arg));
+				continue;
+			}
+
+			Constexpr *ce = new Constexpr();
+			ce->eval = GetConstant(first, arg.first)->eval;
+			proto->constants[arg.second] = ce;
+		}
+
+		// redirect the calls
+		for (Call *call : group->calls)
+		{
+			call->proccode = proccode;
+			for (size_t i = 0; i < proto->arguments.size(); i++)
+			{
+				if (group->constant[i])
+					call->args.erase(proto->arguments[i].first);
+			}
+		}
+
+		proto->arguments = std::move(arguments);
+
+		sll.push_back(sl);
+		growth += proc.size;
+	}
+}
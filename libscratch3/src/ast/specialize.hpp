@@ -0,0 +1,30 @@
+#pragma once
+
+#include <functional>
+
+#include "astdef.hpp"
+
+// procedures with more statements are never specialized
+#define SPECIALIZE_MAX_SIZE 64
+
+// calls which must pass the same constant arguments for a copy of the
+// procedure to be made for them
+#define SPECIALIZE_MIN_CALLS 2
+
+// maximum number of statements the copies may add to a sprite
+#define SPECIALIZE_MAX_GROWTH 128
+
+//! \brief Copy procedures for constant arguments common to their calls
+//!
+//! Each combination of constant arguments passed by at least
+//! SPECIALIZE_MIN_CALLS calls to a procedure of at most
+//! SPECIALIZE_MAX_SIZE statements gets a copy of the procedure, which
+//! binds those arguments in ProcProto::constants and drops them from
+//! ProcProto::arguments. The calls are redirected to the copy. The most
+//! frequent combinations are copied first, until the copies would add
+//! more than SPECIALIZE_MAX_GROWTH statements. Must run before the
+//! sprite is optimized.
+//!
+//! \param sprite The sprite
+//! \param clone Returns a new copy of the script defining a procedure
+void SpecializeProcedures(SpriteDef *sprite, const std::function<StatementList *(StatementList *)> &clone);
@@ -1105,6 +1105,7 @@ struct Repeat : public Statement
 
 	AutoRelease<Expression> e;
 	AutoRelease<StatementList> sl;
+	std::vector<AutoRelease<InvariantExpr>> invariants; // evaluated before the loop
 };
 
 // [forever]
@@ -1133,6 +1134,7 @@ struct Forever : public Statement
 	}
 
 	AutoRelease<StatementList> sl;
+	std::vector<AutoRelease<InvariantExpr>> invariants; // evaluated before the loop
 };
 
 // [if $e]
@@ -1257,6 +1259,7 @@ struct RepeatUntil : public Statement
 
 	AutoRelease<Expression> e;
 	AutoRelease<StatementList> sl;
+	std::vector<AutoRelease<InvariantExpr>> invariants; // evaluated before the loop
 };
 
 // [stop ?mode]
@@ -1749,6 +1752,8 @@ struct ProcProto : public Statement
 
 	std::vector<std::pair<std::string, std::string>> arguments;
 
+	std::unordered_map<std::string, AutoRelease<Constexpr>> constants; // argument name -> value bound by specialization
+
 	bool warp = false;
 };
 
@@ -1816,6 +1821,17 @@ struct Call : public Statement
 	bool warp = false;
 };
 
+// body of a procedure substituted for a call to it, see inliner.hpp
+struct InlineCall : public Statement
+{
+	AST_IMPL(InlineCall, Statement);
+	AST_ACCEPTOR;
+
+	AutoRelease<DefineProc> proc; // the procedure
+	AutoRelease<StatementList> sl; // body of the procedure, shared by all call sites
+	std::vector<AutoRelease<Expression>> args; // arguments, in the order of proc->proto->arguments
+};
+
 // [erase all]
 struct PenClear : public Statement
 {
@@ -61,6 +61,7 @@ public:
 	inline virtual void Visit(ListLength *node) {}
 	inline virtual void Visit(ListContains *node) {}
 	inline virtual void Visit(PenMenuColorProperty *node) {}
+	inline virtual void Visit(InvariantExpr *node) {}
 
 	//
 	/////////////////////////////////////////////////////////////////
@@ -146,6 +147,7 @@ public:
 	inline virtual void Visit(ProcProto *node) {}
 	inline virtual void Visit(DefineProc *node) {}
 	inline virtual void Visit(Call *node) {}
+	inline virtual void Visit(InlineCall *node) {}
 	inline virtual void Visit(PenClear *node) {}
 	inline virtual void Visit(PenStamp *node) {}
 	inline virtual void Visit(PenDown *node) {}
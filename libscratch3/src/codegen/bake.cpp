@@ -0,0 +1,168 @@
+#include "bake.hpp"
+
+#include <cstdio>
+#include <cstring>
+
+#include "stb_image.h"
+
+#include "util.hpp"
+#include "../parallel.hpp"
+#include "../vm/costume.hpp"
+#include "../vm/sound.hpp"
+
+//! \brief Bake a PNG or JPEG, as Costume::Decode loads it
+static bool BakeBitmap(const uint8_t *data, size_t size, std::vector<uint8_t> &out)
+{
+	int width, height, channels;
+	unsigned char *pixels = stbi_load_from_memory(data, size, &width, &height, &channels, 0);
+	if (!pixels)
+		return false;
+
+	if (channels != 3 && channels != 4)
+	{
+		stbi_image_free(pixels);
+		return false;
+	}
+
+	size_t area = (size_t)width * height;
+	size_t bitmapSize = area * channels;
+	size_t maskSize = channels == 4 ? area : 0;
+
+	out.resize(sizeof(bc::BakedCostume) + bitmapSize + maskSize);
+
+	bc::BakedCostume *baked = (bc::BakedCostume *)out.data();
+	baked->width = width;
+	baked->height = height;
+	baked->components = channels;
+	baked->lodCount = 0;
+
+	memcpy(baked->data, pixels, bitmapSize);
+	if (maskSize)
+		GenerateMask(pixels, width, height, true, baked->data + bitmapSize);
+
+	stbi_image_free(pixels);
+	return true;
+}
+
+//! \brief Bake an SVG, as Costume::GenerateCollisionMask and
+//! Costume::RenderLod render it
+static bool BakeSvg(const uint8_t *data, size_t size, std::vector<uint8_t> &out)
+{
+	RsvgHandle *handle = rsvg_handle_new_from_data(data, size, NULL);
+	if (!handle)
+		return false;
+
+	RsvgDimensionData dim;
+	rsvg_handle_get_dimensions(handle, &dim);
+
+	size_t area = (size_t)dim.width * dim.height;
+	if (area == 0)
+	{
+		g_object_unref(handle);
+		return false;
+	}
+
+	out.resize(sizeof(bc::BakedCostume) + area);
+
+	cairo_surface_t *surface = RenderSvg(handle, dim.width, dim.height, 1.0, false);
+	if (!surface)
+	{
+		g_object_unref(handle);
+		return false;
+	}
+
+	GenerateMask(cairo_image_surface_get_data(surface), dim.width, dim.height, false,
+		out.data() + sizeof(bc::BakedCostume));
+	cairo_surface_destroy(surface);
+
+	for (int i = 0; i < BAKED_LOD_COUNT; i++)
+	{
+		surface = RenderSvg(handle, dim.width, dim.height, static_cast<double>(1 << i), true);
+		if (!surface)
+		{
+			g_object_unref(handle);
+			return false;
+		}
+
+		size_t off = out.size();
+		size_t lodSize = (area << (2 * i)) * 4;
+
+		out.resize(off + lodSize);
+		memcpy(out.data() + off, cairo_image_surface_get_data(surface), lodSize);
+		cairo_surface_destroy(surface);
+	}
+
+	g_object_unref(handle);
+
+	// out was resized, write the header last
+	bc::BakedCostume *baked = (bc::BakedCostume *)out.data();
+	baked->width = dim.width;
+	baked->height = dim.height;
+	baked->components = 0;
+	baked->lodCount = BAKED_LOD_COUNT;
+
+	return true;
+}
+
+//! \brief Bake a sound, as AbstractSound::Decode loads it
+static bool BakeSound(const uint8_t *data, size_t size, std::vector<uint8_t> &out)
+{
+	int channels, sampleRate;
+	unsigned long frameCount;
+	float *samples = DecodeSound(data, size, &channels, &sampleRate, &frameCount);
+	if (!samples)
+		return false;
+
+	size_t samplesSize = (size_t)frameCount * channels * sizeof(float);
+
+	out.resize(sizeof(bc::BakedSound) + samplesSize);
+
+	bc::BakedSound *baked = (bc::BakedSound *)out.data();
+	baked->frameCount = frameCount;
+	baked->channels = channels;
+	baked->sampleRate = sampleRate;
+
+	memcpy(baked->samples, samples, samplesSize);
+
+	delete[] samples;
+	return true;
+}
+
+static bool BakeAsset(const std::string &name, const uint8_t *data, size_t size, std::vector<uint8_t> &out)
+{
+	size_t dot = name.rfind('.');
+	if (dot == std::string::npos)
+		return false;
+
+	const char *ext = name.c_str() + dot + 1;
+	if (!strcmp(ext, "png") || !strcmp(ext, "jpg") || !strcmp(ext, "jpeg"))
+		return BakeBitmap(data, size, out);
+	if (!strcmp(ext, "svg"))
+		return BakeSvg(data, size, out);
+	if (!strcmp(ext, "wav") || !strcmp(ext, "mp3"))
+		return BakeSound(data, size, out);
+
+	return false;
+}
+
+void BakeAssets(const std::vector<std::string> &names, Loader &loader, int jobs, std::vector<std::vector<uint8_t>> &out)
+{
+	out.clear();
+	out.resize(names.size());
+
+	// the flag is global, set it before any thread decodes
+	stbi_set_flip_vertically_on_load(true);
+
+	ParallelFor(names.size(), jobs, [&](size_t i)
+	{
+		Resource *rsrc = loader.Find(names[i]);
+		if (!rsrc || rsrc->Size() == 0)
+			return;
+
+		if (!BakeAsset(names[i], rsrc->Data(), rsrc->Size(), out[i]))
+		{
+			printf("Warning: Could not bake %s\n", names[i].c_str());
+			out[i].clear();
+		}
+	});
+}
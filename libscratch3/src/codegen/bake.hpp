@@ -0,0 +1,22 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "../resource.hpp"
+
+// number of SVG LODs rendered ahead of time, at scales 1, 2, 4, ...
+#define BAKED_LOD_COUNT 2
+
+//! \brief Decode assets into the form the VM uses
+//!
+//! Bitmaps and SVGs are baked into a bc::BakedCostume and sounds into
+//! a bc::BakedSound, chosen by the extension of the asset name.
+//!
+//! \param names The names of the assets
+//! \param loader The loader to read the assets from
+//! \param jobs The maximum number of threads to use, 0 = one per core
+//! \param out Receives the baked form of each asset, empty if the
+//! asset cannot be baked
+void BakeAssets(const std::vector<std::string> &names, Loader &loader, int jobs, std::vector<std::vector<uint8_t>> &out);
@@ -0,0 +1,106 @@
+#include "cache.hpp"
+
+#include <cstdio>
+#include <cinttypes>
+
+#include <lysys/lysys.hpp>
+
+#include "compiler.hpp"
+
+struct CacheHeader
+{
+	uint32_t magic; // CACHE_MAGIC
+	uint32_t version; // CACHE_VERSION
+	uint64_t key; // key of the entry
+	uint64_t checksum; // HashBytes of the payload
+	uint64_t size; // size of the payload
+};
+
+uint64_t HashBytes(uint64_t h, const void *data, size_t size)
+{
+	const uint8_t *bytes = (const uint8_t *)data;
+	for (size_t i = 0; i < size; i++)
+	{
+		h ^= bytes[i];
+		h *= 0x100000001b3ull;
+	}
+	return h;
+}
+
+bool CompileCache::Load(uint64_t key, CompiledProgram *unit) const
+{
+	std::string path = GetPath(key);
+
+	struct ls_stat st;
+	if (ls_stat(path.c_str(), &st) == -1)
+		return false; // not cached
+
+	if (st.size < sizeof(CacheHeader))
+		return false;
+
+	ls_handle fh = ls_open(path.c_str(), LS_FILE_READ, 0, LS_OPEN_EXISTING);
+	if (!fh)
+		return false;
+
+	Segment data(st.size);
+	size_t len = ls_read(fh, data.data(), data.size());
+	ls_close(fh);
+
+	if (len != data.size())
+		return false;
+
+	const CacheHeader *header = (const CacheHeader *)data.data();
+	const uint8_t *payload = data.data() + sizeof(CacheHeader);
+
+	if (header->magic != CACHE_MAGIC || header->version != CACHE_VERSION || header->key != key)
+		return false;
+
+	if (header->size != data.size() - sizeof(CacheHeader))
+		return false;
+
+	if (header->checksum != HashBytes(HASH_SEED, payload, header->size))
+		return false;
+
+	return unit->Deserialize(payload, header->size);
+}
+
+void CompileCache::Store(uint64_t key, const CompiledProgram &unit) const
+{
+	Segment data(sizeof(CacheHeader));
+	unit.Serialize(data);
+
+	CacheHeader *header = (CacheHeader *)data.data();
+	header->magic = CACHE_MAGIC;
+	header->version = CACHE_VERSION;
+	header->key = key;
+	header->size = data.size() - sizeof(CacheHeader);
+	header->checksum = HashBytes(HASH_SEED, data.data() + sizeof(CacheHeader), header->size);
+
+	std::string path = GetPath(key);
+	std::string temp = path + ".tmp";
+
+	ls_handle fh = ls_open(temp.c_str(), LS_FILE_WRITE, 0, LS_CREATE_ALWAYS);
+	if (!fh)
+		return;
+
+	size_t len = ls_write(fh, data.data(), data.size());
+	ls_close(fh);
+
+	if (len != data.size())
+	{
+		remove(temp.c_str());
+		return;
+	}
+
+	// rename does not replace existing files on all platforms
+	remove(path.c_str());
+	if (rename(temp.c_str(), path.c_str()) != 0)
+		remove(temp.c_str());
+}
+
+std::string CompileCache::GetPath(uint64_t key) const
+{
+	char name[32];
+	snprintf(name, sizeof(name), "%016" PRIx64 ".bin", key);
+	return _dir + "/" + name;
+}
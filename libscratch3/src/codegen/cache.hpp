@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// "CCH3" in ASCII
+#define CACHE_MAGIC 0x33484343
+
+// bump when code generation changes, invalidates existing cache entries
+#define CACHE_VERSION 11
+
+// initial value for HashBytes
+#define HASH_SEED 0xcbf29ce484222325ull
+
+class CompiledProgram;
+
+//! \brief Hash a block of bytes
+//!
+//! Uses 64-bit FNV-1a, hashes can be chained by passing the result of
+//! a previous call as h.
+//!
+//! \param h The hash to continue from, or HASH_SEED
+//! \param data The bytes to hash
+//! \param size The number of bytes
+//!
+//! \return The hash
+uint64_t HashBytes(uint64_t h, const void *data, size_t size);
+
+//! \brief On-disk cache of compiled sprites
+//!
+//! Each entry holds the unit a single sprite compiled to, before it
+//! is merged into the program (see CompiledProgram::Merge). Entries
+//! are stored in their own file, named after their key. They are
+//! written to a temporary file first and renamed into place, and carry
+//! a checksum, so a partially written entry is never loaded.
+class CompileCache final
+{
+public:
+	//! \brief Load an entry
+	//!
+	//! \param key The key of the entry
+	//! \param unit Receives the entry, must be empty
+	//!
+	//! \return true if the entry was found and is valid
+	bool Load(uint64_t key, CompiledProgram *unit) const;
+
+	//! \brief Store an entry, replacing any existing entry
+	//!
+	//! Failure to write the entry is not an error, the sprite is
+	//! compiled again next time.
+	//!
+	//! \param key The key of the entry
+	//! \param unit The unit to store
+	void Store(uint64_t key, const CompiledProgram &unit) const;
+
+	//! \param dir The directory to store entries in, must exist
+	CompileCache(const char *dir) : _dir(dir) {}
+private:
+	std::string _dir;
+
+	std::string GetPath(uint64_t key) const;
+};
@@ -2,14 +2,37 @@
 
 #include <cstdio>
 #include <cassert>
+#include <memory>
 
 #include <lysys/lysys.hpp>
 
 #include "opcode.hpp"
 #include "util.hpp"
+#include "cache.hpp"
+#include "bake.hpp"
+#include "../parallel.hpp"
 
 #include <SDL.h>
 
+//! \brief Check whether an asset is worth compressing
+//!
+//! Only formats which are not already compressed shrink, the
+//! decision depends on the name alone so that every reference to an
+//! asset agrees on it.
+//!
+//! \param md5ext The name of the asset
+//!
+//! \return true if the asset should be compressed
+static bool IsCompressibleAsset(const std::string &md5ext)
+{
+	size_t dot = md5ext.rfind('.');
+	if (dot == std::string::npos)
+		return false;
+
+	const char *ext = md5ext.c_str() + dot + 1;
+	return !strcmp(ext, "svg") || !strcmp(ext, "wav");
+}
+
 struct ProcInfo
 {
 	ProcProto *proto;
@@ -31,6 +54,15 @@ struct ProcInfo
 	}
 };
 
+//! \brief Procedure whose body is written in place of a call to it
+struct InlineFrame
+{
+	const ProcProto *proto;
+	std::vector<int16_t> slots; // stack slot of each argument
+	int16_t depth; // stack depth at the start of the body
+	std::vector<size_t> exits; // references of the jumps to the end of the body
+};
+
 class Compiler : public Visitor
 {
 public:
@@ -167,28 +199,28 @@ public:
 	{
 		node->e1->Accept(this);
 		node->e2->Accept(this);
-		cp.WriteOpcode(Op_add);
+		cp.WriteOpcode(IsNumberOperation(node->e1.get(), node->e2.get()) ? Op_addnum : Op_add);
 	}
 
 	virtual void Visit(Sub *node)
 	{
 		node->e1->Accept(this);
 		node->e2->Accept(this);
-		cp.WriteOpcode(Op_sub);
+		cp.WriteOpcode(IsNumberOperation(node->e1.get(), node->e2.get()) ? Op_subnum : Op_sub);
 	}
 
 	virtual void Visit(Mul *node)
 	{
 		node->e1->Accept(this);
 		node->e2->Accept(this);
-		cp.WriteOpcode(Op_mul);
+		cp.WriteOpcode(IsNumberOperation(node->e1.get(), node->e2.get()) ? Op_mulnum : Op_mul);
 	}
 
 	virtual void Visit(Div *node)
 	{
 		node->e1->Accept(this);
 		node->e2->Accept(this);
-		cp.WriteOpcode(Op_div);
+		cp.WriteOpcode(IsNumberOperation(node->e1.get(), node->e2.get()) ? Op_divnum : Op_div);
 	}
 
 	virtual void Visit(Neg *node) override
@@ -220,21 +252,21 @@ public:
 	{
 		node->e1->Accept(this);
 		node->e2->Accept(this);
-		cp.WriteOpcode(Op_gt);
+		cp.WriteOpcode(IsNumberOperation(node->e1.get(), node->e2.get()) ? Op_gtnum : Op_gt);
 	}
 
 	virtual void Visit(Less *node)
 	{
 		node->e1->Accept(this);
 		node->e2->Accept(this);
-		cp.WriteOpcode(Op_lt);
+		cp.WriteOpcode(IsNumberOperation(node->e1.get(), node->e2.get()) ? Op_ltnum : Op_lt);
 	}
 
 	virtual void Visit(Equal *node)
 	{
 		node->e1->Accept(this);
 		node->e2->Accept(this);
-		cp.WriteOpcode(Op_eq);
+		cp.WriteOpcode(IsNumberOperation(node->e1.get(), node->e2.get()) ? Op_eqnum : Op_eq);
 	}
 
 	virtual void Visit(LogicalAnd *node)
@@ -459,6 +491,16 @@ public:
 		cp.PushString(node->type);
 	}
 
+	virtual void Visit(InvariantExpr *node) override
+	{
+		auto it = invariantSlots.find(node);
+		assert(it != invariantSlots.end());
+
+		// push hoisted value
+		cp.WriteOpcode(Op_push);
+		cp.WriteText<int16_t>(it->second);
+	}
+
 	virtual void Visit(StatementList *node)
 	{
 		bool oldTopLevel = topLevel;
@@ -467,7 +509,7 @@ public:
 		for (AutoRelease<Statement> &stmt : node->sl)
 		{
 			if (stmt)
-				stmt->Accept(this);
+				WriteStatement(stmt.get());
 		}
 
 		topLevel = oldTopLevel;
@@ -494,6 +536,8 @@ public:
 			if (writestop)
 				cp.WriteOpcode(Op_stopself);
 
+			SetSourceBlock(nullptr);
+
 			cp.WriteOpcode(Op_int);
 			cp.AlignText();
 		}
@@ -910,12 +954,16 @@ public:
 		InitializeValue(zero);
 		SetInteger(zero, 0);
 
+		PushInvariants(node->invariants);
+
 		// push counter
 		node->e->Accept(this);
 
 		if (node->e->eval.Type() != ValueType_Integer && node->e->eval.Type() != ValueType_Bool)
 			cp.WriteOpcode(Op_round);
 
+		stackDepth++;
+
 		uint64_t top = cp._text.size();
 
 		// check counter
@@ -944,11 +992,17 @@ public:
 		// pop counter
 		cp.WriteOpcode(Op_pop);
 
+		stackDepth--;
+
+		PopInvariants(node->invariants);
+
 		ReleaseValue(zero);
 	}
 
 	virtual void Visit(Forever *node)
 	{
+		PushInvariants(node->invariants);
+
 		int64_t start = cp._text.size();
 
 		if (node->sl)
@@ -960,6 +1014,8 @@ public:
 			printf("Warning: Forever loop in warp mode\n");
 
 		cp.WriteAbsoluteJump(Op_jmp, start);
+
+		PopInvariants(node->invariants); // unreachable, keeps the depth balanced
 	}
 
 	virtual void Visit(If *node)
@@ -1085,6 +1141,8 @@ public:
 	{
 		int64_t top;
 
+		PushInvariants(node->invariants);
+
 		top = cp._text.size();
 
 		LogicalNot *lnot = reinterpret_cast<LogicalNot *>(node->e.get());
@@ -1111,6 +1169,8 @@ public:
 
 		// set jump destination for condition
 		cp.SetReference(jnz, Segment_text, cp._text.size());
+
+		PopInvariants(node->invariants);
 	}
 
 	virtual void Visit(Stop *node)
@@ -1122,7 +1182,18 @@ public:
 			cp.WriteOpcode(Op_stopall);
 			break;
 		case StopMode_ThisScript: {
-			if (currentProc)
+			if (!inlineFrames.empty())
+			{
+				// leave the inlined body, dropping the values its loops
+				// keep on the stack
+				InlineFrame &frame = inlineFrames.back();
+				for (int16_t i = frame.depth; i < stackDepth; i++)
+					cp.WriteOpcode(Op_pop);
+
+				cp.WriteOpcode(Op_jmp);
+				frame.exits.push_back(cp.WriteReference(Segment_text, Segment_text));
+			}
+			else if (currentProc)
 			{
 				cp.WriteOpcode(Op_leave);
 				cp.WriteOpcode(Op_ret);
@@ -1179,6 +1250,20 @@ public:
 			abort();
 		}
 
+		if (node->e->Is(Ast_Concat))
+		{
+			Concat *concat = (Concat *)node->e.get();
+			if (concat->e1->Is(Ast_VariableExpr) && ((VariableExpr *)concat->e1.get())->id == node->id)
+			{
+				// set x to (join x ...), append in place
+				concat->e2->Accept(this);
+
+				cp.WriteOpcode(isField ? Op_catfield : Op_catstatic);
+				cp.WriteText<bc::VarId>(id);
+				return;
+			}
+		}
+
 		node->e->Accept(this);
 
 		cp.WriteOpcode(isField ? Op_setfield : Op_setstatic);
@@ -1374,6 +1459,49 @@ public:
 		cp.WriteText<bc::uint64>(0);
 	}
 
+	virtual void Visit(InlineCall *node)
+	{
+		InlineFrame frame;
+		frame.proto = node->proc->proto.get();
+
+		// arguments stay on the stack while the body runs, values which
+		// are already in a slot are read from there
+		int16_t pushed = 0;
+		for (AutoRelease<Expression> &arg : node->args)
+		{
+			int16_t slot;
+			if (!FindSlot(arg.get(), &slot))
+			{
+				arg->Accept(this);
+				slot = GetStackBase() + stackDepth;
+				stackDepth++;
+				pushed++;
+			}
+
+			frame.slots.push_back(slot);
+		}
+
+		frame.depth = stackDepth;
+
+		// the body is attributed to the procedure in the source map
+		FlushSourceBlock();
+		const std::string *oldScriptId = currentScriptId;
+		currentScriptId = &node->proc->nodeid;
+		inlineFrames.push_back(std::move(frame));
+
+		node->sl->Accept(this);
+
+		FlushSourceBlock();
+		for (size_t exit : inlineFrames.back().exits)
+			cp.SetReference(exit, Segment_text, cp._text.size());
+		inlineFrames.pop_back();
+		currentScriptId = oldScriptId;
+
+		for (int16_t i = 0; i < pushed; i++)
+			cp.WriteOpcode(Op_pop);
+		stackDepth -= pushed;
+	}
+
 	virtual void Visit(PenClear *node) override
 	{
 		cp.WriteOpcode(Op_ext);
@@ -1516,7 +1644,7 @@ public:
 
 	virtual void Visit(ArgReporterStringNumber *node)
 	{
-		if (currentProc == nullptr)
+		if (GetCodeProto() == nullptr)
 		{
 			// not in a procedure, push null
 			Value v;
@@ -1526,8 +1654,11 @@ public:
 			return;
 		}
 
+		if (PushConstant(node->value))
+			return;
+
 		int16_t arg;
-		if (!currentProc->FindArgument(node->value, &arg))
+		if (!FindArgument(node->value, &arg))
 		{
 			printf("Error: Undefined argument %s\n", node->value.c_str());
 			abort();
@@ -1540,7 +1671,7 @@ public:
 
 	virtual void Visit(ArgReporterBoolean *node)
 	{
-		if (currentProc == nullptr)
+		if (GetCodeProto() == nullptr)
 		{
 			// not in a procedure, push null
 			Value v;
@@ -1550,8 +1681,11 @@ public:
 			return;
 		}
 
+		if (PushConstant(node->value))
+			return;
+
 		int16_t arg;
-		if (!currentProc->FindArgument(node->value, &arg))
+		if (!FindArgument(node->value, &arg))
 		{
 			printf("Error: Undefined argument %s\n", node->value.c_str());
 			abort();
@@ -1562,67 +1696,6 @@ public:
 		cp.WriteText<int16_t>(arg);
 	}
 
-	virtual void Visit(VariableDef *node)
-	{
-		bool isField, found;
-		bc::VarId id = FindVariable(node->id, &isField, &found);
-		if (!found)
-		{
-			printf("Error: Undefined variable %s\n", node->id.c_str());
-			abort();
-		}
-
-		assert(node->value->eval.HasValue());
-
-		cp.PushValue(node->value->eval.GetValue());
-
-		cp.WriteOpcode(isField ? Op_setfield : Op_setstatic);
-		cp.WriteText<bc::VarId>(id);
-	}
-
-	virtual void Visit(VariableDefList *node)
-	{
-		uint64_t count = node->variables.size();
-		cp._text.reserve(cp._text.capacity() + count * 16); // ~16 bytes per initializer instruction 
-
-		for (AutoRelease<VariableDef> &vd : node->variables)
-			vd->Accept(this);
-	}
-
-	virtual void Visit(ListDef *node)
-	{
-		bool isField, found;
-		bc::VarId id = FindVariable(node->id, &isField, &found);
-		if (!found)
-		{
-			printf("Error: Undefined list %s\n", node->id.c_str());
-			abort();
-		}
-
-		int64_t size = static_cast<int64_t>(node->value.size());
-
-		for (int64_t i = size - 1; i >= 0; --i)
-		{
-			assert(node->value[i]->eval.HasValue());
-			cp.PushValue(node->value[i]->eval.GetValue());
-		}
-		
-		cp.WriteOpcode(Op_listcreate);
-		cp.WriteText<int64_t>(size);
-
-		cp.WriteOpcode(Op_setstatic);
-		cp.WriteText<bc::VarId>(id);
-	}
-
-	virtual void Visit(ListDefList *node)
-	{
-		uint64_t count = node->lists.size();
-		cp._text.reserve(cp._text.capacity() + count * 64); // ~64 bytes per initializer instruction
-
-		for (AutoRelease<ListDef> &ld : node->lists)
-			ld->Accept(this);
-	}
-
 	virtual void Visit(StatementListList *node)
 	{
 		uint64_t count = node->sll.size();
@@ -1661,18 +1734,23 @@ public:
 
 				currentProc = &procedureTable[proccode];
 
+				currentScriptId = &proc->nodeid;
+				SetSourceBlock(proc);
+
 				cp.WriteOpcode(Op_enter);
 
 				auto &statements = sl->sl;
 				for (size_t i = 1; i < statements.size(); i++)
 				{
 					if (statements[i] != nullptr)
-						statements[i]->Accept(this);
+						WriteStatement(statements[i].get());
 				}
 
 				cp.WriteOpcode(Op_leave);
 				cp.WriteOpcode(Op_ret);
 
+				SetSourceBlock(nullptr);
+
 				cp.WriteOpcode(Op_int);
 				cp.AlignText();
 
@@ -1701,6 +1779,9 @@ public:
 				bc::Script *script = (bc::Script *)cp.AllocRdata(sizeof(bc::Script));
 				cp.CreateReference(&script->offset, Segment_text);
 
+				currentScriptId = &sl->sl[0]->nodeid;
+				SetSourceBlock(sl->sl[0].get());
+
 				sl->Accept(this);
 			}
 		}
@@ -1723,31 +1804,10 @@ public:
 
 		cp.CreateReference(&currentSprite->costumes, Segment_rdata);
 
-		uint64_t arrayStart = cp._rdata.size();
-
-		// Write array of costume definitions
-		for (AutoRelease<CostumeDef> &cd : node->costumes)
-		{
-			bc::Costume *costume = (bc::Costume *)cp.AllocRdata(sizeof(bc::Costume));
-			cp.CreateString(&costume->name, cd->name);
-			cp.CreateString(&costume->format, cd->dataFormat);
-			costume->bitmapResolution = cd->bitmapResolution;
-			costume->reserved = 0;
-			costume->rotationCenterX = cd->rotationCenterX;
-			costume->rotationCenterY = cd->rotationCenterY;
-
-			// Filled below
-			costume->dataSize = 0;
-			costume->data = 0;
-		}
-
-		// Write costume data
-		uint64_t i = 0;
+		// Write array of costume definitions, data is written once per
+		// asset when the asset pool is flushed
 		for (AutoRelease<CostumeDef> &cd : node->costumes)
 		{
-			// do this every time, as the array might have been reallocated
-			bc::Costume *costumes = (bc::Costume *)(cp._rdata.data() + arrayStart);
-
 			Resource *rsrc = loader.Find(cd->md5ext);
 			if (!rsrc)
 			{
@@ -1755,16 +1815,20 @@ public:
 				abort();
 			}
 
-			const uint8_t *data = rsrc->Data();
-			size_t size = rsrc->Size();
-
-			// Write data and store reference in definition
-			bc::Costume &costume = costumes[i];
-			costume.dataSize = size;
-			cp.CreateReference(&costume.data, Segment_rdata);
-			cp.WriteRdata(data, size);
+			bc::Costume *costume = (bc::Costume *)cp.AllocRdata(sizeof(bc::Costume));
+			cp.CreateString(&costume->name, cd->name);
+			cp.CreateString(&costume->format, cd->dataFormat);
+			costume->bitmapResolution = cd->bitmapResolution;
+			costume->flags = options.compressAssets && IsCompressibleAsset(cd->md5ext) ? ASSET_COMPRESSED : 0;
+			costume->rotationCenterX = cd->rotationCenterX;
+			costume->rotationCenterY = cd->rotationCenterY;
+			costume->dataSize = rsrc->Size();
+			cp.CreateAsset(&costume->data, cd->md5ext);
 
-			i++;
+			if (options.bakeAssets)
+				cp.CreateBakedAsset(&costume->baked, cd->md5ext);
+			else
+				costume->baked = 0;
 		}
 	}
 
@@ -1782,29 +1846,10 @@ public:
 
 		cp.CreateReference(&currentSprite->sounds, Segment_rdata);
 
-		uint64_t arrayStart = cp._rdata.size();
-
-		// Write array of sound definitions
+		// Write array of sound definitions, data is written once per
+		// asset when the asset pool is flushed
 		for (AutoRelease<SoundDef> &sd : node->sounds)
 		{
-			bc::Sound *sound = (bc::Sound *)cp.AllocRdata(sizeof(bc::Sound));
-			cp.CreateString(&sound->name, sd->name);
-			cp.CreateString(&sound->format, sd->dataFormat);
-			sound->rate = sd->rate;
-			sound->sampleCount = sd->sampleCount;
-
-			// Filled below
-			sound->dataSize = 0;
-			sound->data = 0;
-		}
-
-		// Write sound data
-		uint64_t i = 0;
-		for (AutoRelease<SoundDef> &sd : node->sounds)
-		{
-			// do this every time, as the array might have been reallocated
-			bc::Sound *sounds = (bc::Sound *)(cp._rdata.data() + arrayStart);
-
 			Resource *rsrc = loader.Find(sd->md5ext);
 			if (!rsrc)
 			{
@@ -1812,16 +1857,20 @@ public:
 				abort();
 			}
 
-			const uint8_t *data = rsrc->Data();
-			size_t size = rsrc->Size();
-
-			// Write data and store reference in definition
-			bc::Sound &sound = sounds[i];
-			sound.dataSize = size;
-			cp.CreateReference(&sound.data, Segment_rdata);
-			cp.WriteRdata(data, size);
+			bc::Sound *sound = (bc::Sound *)cp.AllocRdata(sizeof(bc::Sound));
+			cp.CreateString(&sound->name, sd->name);
+			cp.CreateString(&sound->format, sd->dataFormat);
+			sound->rate = sd->rate;
+			sound->sampleCount = sd->sampleCount;
+			sound->dataSize = rsrc->Size();
+			cp.CreateAsset(&sound->data, sd->md5ext);
+			sound->flags = options.compressAssets && IsCompressibleAsset(sd->md5ext) ? ASSET_COMPRESSED : 0;
+			sound->reserved = 0;
 
-			i++;
+			if (options.bakeAssets)
+				cp.CreateBakedAsset(&sound->baked, sd->md5ext);
+			else
+				sound->baked = 0;
 		}
 	}
 
@@ -1846,25 +1895,16 @@ public:
 		sprite->draggable = node->draggable;
 		sprite->rotationStyle = node->rotationStyle;
 
-		if (node->variables->variables.size() + node->lists->lists.size() > 0)
-		{
-			// Reference to initializer
-			cp.CreateReference(&sprite->initializer.offset, Segment_text);
+		// Stage variables are stored statically, not as fields
+		sprite->numFields = node->isStage ? 0 : node->variables->variables.size() + node->lists->lists.size();
 
-			// Write initializer to text segment
-			node->variables->Accept(this);
-			node->lists->Accept(this);
-			cp.WriteOpcode(Op_stopself);
-			cp.AlignText();
-		}
-		else
+		if (sprite->numFields > 0)
 		{
-			// No initializer needed
-			sprite->initializer.offset = 0;
+			uint64_t fields = WriteInitialValues(node->variables.get(), node->lists.get());
+			cp.CreateReference(&sprite->fields, Segment_rdata, fields);
 		}
-		
-		// Stage variables are stored statically, not as fields
-		sprite->numFields = node->isStage ? 0 : node->variables->variables.size();
+		else
+			sprite->fields = 0;
 
 		// Write scripts
 		node->scripts->Accept(this);
@@ -1884,8 +1924,39 @@ public:
 		cp._stable.reserve(cp._stable.capacity() + count * 512); // ~512 bytes per sprite table entry
 
 		cp.WriteStable<uint64_t>(count);
-		for (AutoRelease<SpriteDef> &sd : node->sprites)
-			sd->Accept(this);
+
+		// Each sprite is optimized and compiled into its own unit, the units
+		// are merged in order afterwards so the output does not depend on
+		// scheduling
+		std::vector<CompiledProgram> units(count);
+		ParallelFor(count, options.jobs, [&](size_t i)
+		{
+			SpriteDef *sd = node->sprites[i].get();
+
+			uint64_t key = 0;
+			if (cache)
+			{
+				key = GetCacheKey(sd);
+				if (cache->Load(key, &units[i]))
+					return;
+			}
+
+			if (options.optimization > 0)
+				OptimizeSprite(sd, options.optimization);
+
+			Compiler compiler(&units[i], &loader, &options, nullptr);
+			compiler.staticVariables = staticVariables;
+			sd->Accept(&compiler);
+
+			if (options.optimization > 0)
+				units[i].Peephole();
+
+			if (cache)
+				cache->Store(key, units[i]);
+		});
+
+		for (const CompiledProgram &unit : units)
+			cp.Merge(unit);
 	}
 
 	virtual void Visit(StageDef *node)
@@ -1911,7 +1982,11 @@ public:
 		}
 
 		if (!stage)
+		{
+			// the VM always reads the count of static initial values
+			cp.WriteRdata<bc::uint64>(0);
 			return;
+		}
 
 		currentSpriteName = &stage->name;
 
@@ -1927,6 +2002,8 @@ public:
 		size_t id = 0;
 		for (AutoRelease<VariableDef> &vd : vars)
 		{
+			staticLayout = HashBytes(staticLayout, vd->id.c_str(), vd->id.size() + 1);
+
 #if LS_DEBUG
 			printf("%s -> %zu\n", vd->id.c_str(), id);
 #endif // LS_DEBUG
@@ -1942,6 +2019,7 @@ public:
 
 		for (AutoRelease<ListDef> &ld : lists)
 		{
+			staticLayout = HashBytes(staticLayout, ld->id.c_str(), ld->id.size() + 1);
 #if LS_DEBUG
 			printf("%s -> %zu\n", ld->id.c_str(), id);
 #endif // LS_DEBUG
@@ -1955,22 +2033,363 @@ public:
 			ReleaseValue(v);
 		}
 
+		// the VM sets the variables to these before any script runs
+		WriteInitialValues(stage->variables.get(), stage->lists.get());
+
 		currentSpriteName = nullptr;
 	}
 
 	virtual void Visit(Program *node)
 	{
+		// must run before the cache keys are computed
+		if (options.optimization > 0)
+			EliminateDeadCode(node);
+
 		MapStaticVariables(node);
 
+		// the units only hold the entries of the source map
+		if (options.debug)
+			cp.AllocDebug(sizeof(bc::DebugInfo));
+
 		node->sprites->Accept(this);
 
+		// the source map needs a copy of the code for each sprite
+		if (options.optimization >= 2 && !options.debug)
+			cp.FoldIdenticalCode();
+
+		if (options.debug)
+		{
+			bc::DebugInfo *info = (bc::DebugInfo *)cp._debug.data();
+			info->count = (cp._debug.size() - sizeof(bc::DebugInfo)) / sizeof(bc::SourceMapEntry);
+		}
+
 		cp.FlushStringPool();
+		cp.FlushAssetPool(loader, options.compressAssets != 0);
+		cp.FlushBakedAssetPool(loader, options.jobs);
 		cp.Link();
 	}
 
+	//! \brief Write the initial values of variables and lists to .rdata
+	//!
+	//! \param vdl The variables
+	//! \param ldl The lists
+	//!
+	//! \return Offset of the bc::InitialValue array, variables first
+	uint64_t WriteInitialValues(VariableDefList *vdl, ListDefList *ldl)
+	{
+		auto &vars = vdl->variables;
+		auto &lists = ldl->lists;
+
+		cp._rdata.resize((cp._rdata.size() + 7) & ~7);
+
+		uint64_t table = cp._rdata.size();
+		cp.AllocRdata((vars.size() + lists.size()) * sizeof(bc::InitialValue));
+
+		uint64_t off = table;
+		for (AutoRelease<VariableDef> &vd : vars)
+		{
+			assert(vd->value->eval.HasValue());
+			SetInitialValue(off, vd->value->eval.GetValue());
+			off += sizeof(bc::InitialValue);
+		}
+
+		for (AutoRelease<ListDef> &ld : lists)
+		{
+			uint64_t list = WriteInitialList(ld.get());
+
+			bc::InitialValue *iv = (bc::InitialValue *)(cp._rdata.data() + off);
+			iv->type = ValueType_List;
+			cp.CreateReference(&iv->u.ref, Segment_rdata, list);
+			off += sizeof(bc::InitialValue);
+		}
+
+		return table;
+	}
+
+	//! \brief Write the elements of a list to .rdata
+	//!
+	//! \param ld The list
+	//!
+	//! \return Offset of the bc::InitialList
+	uint64_t WriteInitialList(ListDef *ld)
+	{
+		// numbers are packed, like the VM does when they are appended
+		bool packed = true;
+		double d;
+		for (AutoRelease<Constexpr> &item : ld->value)
+		{
+			assert(item->eval.HasValue());
+
+			if (!IsPackable(item->eval.GetValue(), &d))
+			{
+				packed = false;
+				break;
+			}
+		}
+
+		uint64_t count = ld->value.size();
+		size_t elemSize = packed ? sizeof(bc::float64) : sizeof(bc::InitialValue);
+
+		uint64_t off = cp._rdata.size();
+		bc::InitialList *list = (bc::InitialList *)cp.AllocRdata(sizeof(bc::InitialList) + count * elemSize);
+		list->count = count;
+		list->packed = packed;
+
+		uint64_t elements = off + sizeof(bc::InitialList);
+		for (uint64_t i = 0; i < count; i++)
+		{
+			const Value &v = ld->value[i]->eval.GetValue();
+			if (packed)
+			{
+				bc::float64 *number = (bc::float64 *)(cp._rdata.data() + elements + i * elemSize);
+				IsPackable(v, number); // checked above
+			}
+			else
+				SetInitialValue(elements + i * elemSize, v);
+		}
+
+		return off;
+	}
+
+	//! \brief Fill in an initial value in .rdata
+	//!
+	//! \param off Offset of the bc::InitialValue
+	//! \param value The value, must not be a list
+	void SetInitialValue(uint64_t off, const Value &value)
+	{
+		bc::InitialValue *iv = (bc::InitialValue *)(cp._rdata.data() + off);
+
+		switch (value.type)
+		{
+		default:
+			iv->type = ValueType_None;
+			break;
+		case ValueType_Integer:
+			iv->type = ValueType_Integer;
+			iv->u.integer = value.u.integer;
+			break;
+		case ValueType_Real:
+			iv->type = ValueType_Real;
+			iv->u.real = value.u.real;
+			break;
+		case ValueType_Bool:
+			iv->type = ValueType_Bool;
+			iv->u.boolean = value.u.boolean;
+			break;
+		case ValueType_String:
+			iv->type = ValueType_String;
+			cp.CreateStaticString(&iv->u.ref, std::string(value.u.string->str, value.u.string->len));
+			break;
+		}
+	}
+
+	//! \brief Get the procedure whose code is being written
+	//!
+	//! \return The innermost inlined procedure, otherwise the current
+	//! procedure, nullptr at top level
+	inline const ProcProto *GetCodeProto() const
+	{
+		if (!inlineFrames.empty())
+			return inlineFrames.back().proto;
+		return currentProc ? currentProc->proto : nullptr;
+	}
+
+	//! \brief Whether the code being written runs without screen
+	//! refresh, inlined bodies keep the mode of their procedure
 	inline bool InWarpMode() const
 	{
-		return currentProc && currentProc->proto->warp;
+		const ProcProto *proto = GetCodeProto();
+		return proto && proto->warp;
+	}
+
+	//! \brief Get the stack slot of the first value pushed in the frame
+	//! after the arguments
+	inline int16_t GetStackBase() const
+	{
+		return currentProc ? static_cast<int16_t>(currentProc->proto->arguments.size()) : 0;
+	}
+
+	//! \brief Find the stack slot of an argument of the procedure whose
+	//! code is being written
+	//!
+	//! \param name The name of the argument
+	//! \param slot Receives the slot
+	//!
+	//! \return true if the argument exists
+	bool FindArgument(const std::string &name, int16_t *slot) const
+	{
+		if (inlineFrames.empty())
+			return currentProc && currentProc->FindArgument(name, slot);
+
+		const InlineFrame &frame = inlineFrames.back();
+		for (size_t i = 0; i < frame.proto->arguments.size(); i++)
+		{
+			if (frame.proto->arguments[i].second == name)
+			{
+				*slot = frame.slots[i];
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	//! \brief Push the value of an argument bound by specialization
+	//!
+	//! \param name The name of the argument
+	//!
+	//! \return Whether the argument is bound
+	bool PushConstant(const std::string &name)
+	{
+		const ProcProto *proto = GetCodeProto();
+		if (!proto)
+			return false;
+
+		auto it = proto->constants.find(name);
+		if (it == proto->constants.end())
+			return false;
+
+		it->second->Accept(this);
+		return true;
+	}
+
+	//! \brief Find the stack slot already holding the value of an
+	//! expression
+	//!
+	//! \param e The expression
+	//! \param slot Receives the slot
+	//!
+	//! \return true if e is an argument or a hoisted value
+	bool FindSlot(Expression *e, int16_t *slot) const
+	{
+		InvariantExpr *inv = e->As<InvariantExpr>();
+		if (inv)
+		{
+			auto it = invariantSlots.find(inv);
+			if (it == invariantSlots.end())
+				return false;
+
+			*slot = it->second;
+			return true;
+		}
+
+		ArgReporterStringNumber *arsn = e->As<ArgReporterStringNumber>();
+		if (arsn)
+			return FindArgument(arsn->value, slot);
+
+		ArgReporterBoolean *arb = e->As<ArgReporterBoolean>();
+		if (arb)
+			return FindArgument(arb->value, slot);
+
+		return false;
+	}
+
+	//! \brief Check whether both operands of a binary operator are
+	//! inferred to be numbers, in which case the typed opcode is used
+	static inline bool IsNumberOperation(const Expression *lhs, const Expression *rhs)
+	{
+		ValueType lt = lhs->eval.Type();
+		ValueType rt = rhs->eval.Type();
+		return (lt == ValueType_Integer || lt == ValueType_Real) &&
+			(rt == ValueType_Integer || rt == ValueType_Real);
+	}
+
+	//! \brief Write the code of a statement
+	//!
+	//! The code is attributed to the statement's block in the source
+	//! map, unless the statement was not parsed from a block.
+	void WriteStatement(Statement *stmt)
+	{
+		const Statement *parent = currentBlock;
+
+		if (!stmt->nodeid.empty())
+			SetSourceBlock(stmt);
+
+		stmt->Accept(this);
+
+		SetSourceBlock(parent);
+	}
+
+	//! \brief Attribute the code written from here on to a block
+	//!
+	//! Writes the source map entry of the previous block, if it has any
+	//! code. Does nothing unless compiling with debug information.
+	//!
+	//! \param block The block, nullptr if the code belongs to none
+	void SetSourceBlock(const Statement *block)
+	{
+		if (!options.debug || block == currentBlock)
+			return;
+
+		FlushSourceBlock();
+
+		currentBlock = block;
+	}
+
+	//! \brief Write the source map entry of the code written for the
+	//! current block so far
+	void FlushSourceBlock()
+	{
+		if (!options.debug)
+			return;
+
+		uint64_t pc = cp._text.size();
+		if (currentBlock && pc > blockStart)
+		{
+			bc::SourceMapEntry *entry = (bc::SourceMapEntry *)cp.AllocDebug(sizeof(bc::SourceMapEntry));
+			cp.CreateReference(&entry->start, Segment_text, blockStart);
+			cp.CreateReference(&entry->end, Segment_text, pc);
+			cp.CreateString(&entry->sprite, *currentSpriteName);
+			cp.CreateString(&entry->script, *currentScriptId);
+			cp.CreateString(&entry->block, currentBlock->nodeid);
+			cp.CreateString(&entry->opcode, currentBlock->opcode);
+
+			const ProcProto *proto = GetCodeProto();
+			if (proto)
+				cp.CreateString(&entry->proc, proto->proccode);
+			else
+				entry->proc = 0;
+		}
+
+		blockStart = pc;
+	}
+
+	//! \brief Evaluate the values hoisted out of a loop onto the stack
+	//!
+	//! Values which are already hoisted out of an enclosing loop are
+	//! read from the slot of that loop instead.
+	void PushInvariants(const std::vector<AutoRelease<InvariantExpr>> &invariants)
+	{
+		// arguments occupy the first slots of a procedure frame
+		int16_t base = GetStackBase();
+
+		for (const AutoRelease<InvariantExpr> &inv : invariants)
+		{
+			InvariantExpr *outer = inv->e->As<InvariantExpr>();
+			if (outer)
+			{
+				invariantSlots[inv.get()] = invariantSlots[outer];
+				continue;
+			}
+
+			inv->e->Accept(this);
+			invariantSlots[inv.get()] = base + stackDepth;
+			stackDepth++;
+		}
+	}
+
+	//! \brief Release the values pushed by PushInvariants
+	void PopInvariants(const std::vector<AutoRelease<InvariantExpr>> &invariants)
+	{
+		for (const AutoRelease<InvariantExpr> &inv : invariants)
+		{
+			invariantSlots.erase(inv.get());
+			if (!inv->e->Is(Ast_InvariantExpr))
+			{
+				cp.WriteOpcode(Op_pop);
+				stackDepth--;
+			}
+		}
 	}
 
 	CompiledProgram &cp;
@@ -1983,12 +2402,40 @@ public:
 	ProcInfo *currentProc = nullptr;
 	SpriteDef *currentSpriteDef = nullptr;
 
+	const std::string *currentScriptId = nullptr; // id of the top block of the current script
+	const Statement *currentBlock = nullptr; // block the code being written belongs to
+	uint64_t blockStart = 0; // offset of the first instruction of currentBlock
+
+	int16_t stackDepth = 0; // values the enclosing loops and inlined calls keep on the stack
+	std::unordered_map<const InvariantExpr *, int16_t> invariantSlots; // hoisted value -> stack slot
+	std::vector<InlineFrame> inlineFrames; // procedures inlined at the code being written, innermost last
+
 	std::unordered_map<std::string, bc::VarId> staticVariables; // name -> VarId
+	uint64_t staticLayout = HASH_SEED; // hash of the names of the static variables, in VarId order
 
 	std::unordered_map<std::string, ProcInfo> procedureTable; // name -> ProcInfo
 
-	Compiler(CompiledProgram *cp, Loader *loader, const Scratch3CompilerOptions *options) :
-		cp(*cp), loader(*loader), options(*options) {}
+	CompileCache *cache; // may be null
+
+	Compiler(CompiledProgram *cp, Loader *loader, const Scratch3CompilerOptions *options, CompileCache *cache) :
+		cp(*cp), loader(*loader), options(*options), cache(cache) {}
+
+	//! \brief Compute the cache key of a sprite
+	//!
+	//! Covers everything the unit of a sprite depends on: the sprite
+	//! itself, the scripts removed from it by dead code elimination,
+	//! the layout of the static variables and the compiler.
+	uint64_t GetCacheKey(const SpriteDef *sd) const
+	{
+		uint32_t version[2] = { PROGRAM_VERSION, CACHE_VERSION };
+		int32_t flags[4] = { options.debug, options.optimization, options.compressAssets, options.bakeAssets };
+
+		uint64_t key = HashBytes(HASH_SEED, &sd->hash, sizeof(sd->hash));
+		key = HashBytes(key, &sd->pruned, sizeof(sd->pruned));
+		key = HashBytes(key, &staticLayout, sizeof(staticLayout));
+		key = HashBytes(key, version, sizeof(version));
+		return HashBytes(key, flags, sizeof(flags));
+	}
 
 	std::string GetQualifiedProcName(const std::string &proccode) const
 	{
@@ -2129,6 +2576,230 @@ uint8_t *CompiledProgram::Export(size_t *outSize) const
 	return data;
 }
 
+//! \brief Append a value to a serialized program
+template <typename T>
+static void Put(Segment &out, const T &value)
+{
+	const uint8_t *bytes = (const uint8_t *)&value;
+	out.insert(out.end(), bytes, bytes + sizeof(T));
+}
+
+//! \brief Append a length-prefixed block of bytes to a serialized program
+static void PutBytes(Segment &out, const void *data, size_t size)
+{
+	Put<uint64_t>(out, size);
+	out.insert(out.end(), (const uint8_t *)data, (const uint8_t *)data + size);
+}
+
+//! \brief Append a reference to a serialized program, field by field
+//! so padding never reaches the output
+static void PutReference(Segment &out, const DataReference &ref)
+{
+	Put<uint8_t>(out, static_cast<uint8_t>(ref.seg));
+	Put<uint64_t>(out, ref.off);
+}
+
+static void PutPool(Segment &out, const StringPool &pool)
+{
+	Put<uint64_t>(out, pool.end() - pool.begin());
+	for (auto &p : pool)
+	{
+		PutBytes(out, p.first.data(), p.first.size());
+		Put<uint64_t>(out, p.second.size());
+		for (const DataReference &ref : p.second)
+			PutReference(out, ref);
+	}
+}
+
+//! \brief Bounds-checked reader for serialized programs
+struct SerialReader
+{
+	const uint8_t *ptr;
+	const uint8_t *end;
+
+	template <typename T>
+	bool Get(T *value)
+	{
+		if (static_cast<size_t>(end - ptr) < sizeof(T))
+			return false;
+		memcpy(value, ptr, sizeof(T));
+		ptr += sizeof(T);
+		return true;
+	}
+
+	bool GetBytes(const uint8_t **data, uint64_t *size)
+	{
+		if (!Get(size) || static_cast<uint64_t>(end - ptr) < *size)
+			return false;
+		*data = ptr;
+		ptr += *size;
+		return true;
+	}
+
+	bool GetSegment(Segment *seg)
+	{
+		const uint8_t *data;
+		uint64_t size;
+		if (!GetBytes(&data, &size))
+			return false;
+		seg->assign(data, data + size);
+		return true;
+	}
+
+	bool GetString(std::string *str)
+	{
+		const uint8_t *data;
+		uint64_t size;
+		if (!GetBytes(&data, &size))
+			return false;
+		str->assign((const char *)data, size);
+		return true;
+	}
+
+	bool GetReference(DataReference *ref)
+	{
+		uint8_t seg;
+		if (!Get(&seg) || seg > Segment_debug || !Get(&ref->off))
+			return false;
+		ref->seg = static_cast<SegmentType>(seg);
+		return true;
+	}
+
+	bool GetPool(StringPool *pool)
+	{
+		uint64_t count;
+		if (!Get(&count))
+			return false;
+
+		for (uint64_t i = 0; i < count; i++)
+		{
+			std::string str;
+			uint64_t numRefs;
+			if (!GetString(&str) || !Get(&numRefs))
+				return false;
+
+			auto &refs = (*pool)[str];
+			for (uint64_t j = 0; j < numRefs; j++)
+			{
+				DataReference ref;
+				if (!GetReference(&ref))
+					return false;
+				refs.push_back(ref);
+			}
+		}
+
+		return true;
+	}
+};
+
+void CompiledProgram::Serialize(Segment &out) const
+{
+	PutBytes(out, _text.data(), _text.size());
+	PutBytes(out, _stable.data(), _stable.size());
+	PutBytes(out, _data.data(), _data.size());
+	PutBytes(out, _rdata.data(), _rdata.size());
+	PutBytes(out, _debug.data(), _debug.size());
+
+	PutPool(out, _managedStrings);
+	PutPool(out, _plainStrings);
+	PutPool(out, _assets);
+	PutPool(out, _bakedAssets);
+
+	Put<uint64_t>(out, _importSymbols.size());
+	for (auto &p : _importSymbols)
+	{
+		Put<uint64_t>(out, p.first);
+		PutBytes(out, p.second.data(), p.second.size());
+	}
+
+	Put<uint64_t>(out, _exportSymbols.size());
+	for (auto &p : _exportSymbols)
+	{
+		PutBytes(out, p.first.data(), p.first.size());
+		Put<uint64_t>(out, p.second);
+	}
+
+	Put<uint64_t>(out, _references.size());
+	for (auto &p : _references)
+	{
+		PutReference(out, p.first);
+		PutReference(out, p.second);
+	}
+}
+
+bool CompiledProgram::Deserialize(const uint8_t *data, size_t size)
+{
+	SerialReader r{ data, data + size };
+
+	Segment text, stable, rdata, sdata, debug;
+	StringPool managedStrings, plainStrings, assets, bakedAssets;
+	std::vector<std::pair<uint64_t, std::string>> importSymbols;
+	std::unordered_map<std::string, uint64_t> exportSymbols;
+	std::vector<std::pair<DataReference, DataReference>> references;
+
+	if (!r.GetSegment(&text) || !r.GetSegment(&stable) || !r.GetSegment(&sdata) ||
+		!r.GetSegment(&rdata) || !r.GetSegment(&debug))
+		return false;
+
+	if (!r.GetPool(&managedStrings) || !r.GetPool(&plainStrings) ||
+		!r.GetPool(&assets) || !r.GetPool(&bakedAssets))
+		return false;
+
+	uint64_t count;
+	if (!r.Get(&count))
+		return false;
+
+	for (uint64_t i = 0; i < count; i++)
+	{
+		uint64_t off;
+		std::string name;
+		if (!r.Get(&off) || !r.GetString(&name))
+			return false;
+		importSymbols.emplace_back(off, name);
+	}
+
+	if (!r.Get(&count))
+		return false;
+
+	for (uint64_t i = 0; i < count; i++)
+	{
+		std::string name;
+		uint64_t off;
+		if (!r.GetString(&name) || !r.Get(&off))
+			return false;
+		exportSymbols[name] = off;
+	}
+
+	if (!r.Get(&count))
+		return false;
+
+	for (uint64_t i = 0; i < count; i++)
+	{
+		DataReference from, to;
+		if (!r.GetReference(&from) || !r.GetReference(&to))
+			return false;
+		references.emplace_back(from, to);
+	}
+
+	if (r.ptr != r.end)
+		return false;
+
+	_text = std::move(text);
+	_stable = std::move(stable);
+	_data = std::move(sdata);
+	_rdata = std::move(rdata);
+	_debug = std::move(debug);
+	_managedStrings = std::move(managedStrings);
+	_plainStrings = std::move(plainStrings);
+	_assets = std::move(assets);
+	_bakedAssets = std::move(bakedAssets);
+	_importSymbols = std::move(importSymbols);
+	_exportSymbols = std::move(exportSymbols);
+	_references = std::move(references);
+
+	return true;
+}
+
 void CompiledProgram::Write(SegmentType seg, const void *data, size_t size)
 {
 	switch (seg)
@@ -2207,6 +2878,110 @@ void CompiledProgram::CreateString(void *dst, const std::string &str)
 	_plainStrings[str].push_back(DataReference{ seg, off });
 }
 
+void CompiledProgram::CreateStaticString(void *dst, const std::string &str)
+{
+	SegmentType seg;
+	uint64_t off;
+
+	ResolvePointer(dst, &seg, &off);
+
+	// fill with garbage
+	memset(dst, 0xbb, sizeof(bc::ptr<String>));
+
+	_managedStrings[str].push_back(DataReference{ seg, off });
+}
+
+void CompiledProgram::CreateAsset(void *dst, const std::string &md5ext)
+{
+	SegmentType seg;
+	uint64_t off;
+
+	ResolvePointer(dst, &seg, &off);
+
+	// fill with garbage
+	memset(dst, 0xcc, sizeof(bc::ptr<bc::byte>));
+
+	_assets[md5ext].push_back(DataReference{ seg, off });
+}
+
+void CompiledProgram::FlushAssetPool(Loader &loader, bool compress)
+{
+	Segment compressed;
+
+	for (auto &p : _assets)
+	{
+		const std::string &md5ext = p.first;
+		const auto &refs = p.second;
+
+		Resource *rsrc = loader.Find(md5ext);
+		if (!rsrc)
+		{
+			printf("Error: Missing resource %s\n", md5ext.c_str());
+			abort();
+		}
+
+		DataReference to{ Segment_rdata, _rdata.size() };
+
+		// write the data once, shared by all references, the costumes
+		// and sounds were flagged with the same decision
+		if (compress && IsCompressibleAsset(md5ext))
+		{
+			compressed.clear();
+			CompressAsset(rsrc->Data(), rsrc->Size(), compressed);
+			WriteRdata(compressed.data(), compressed.size());
+		}
+		else
+			WriteRdata(rsrc->Data(), rsrc->Size());
+
+		for (const DataReference &ref : refs)
+			_references.emplace_back(ref, to);
+	}
+	_assets.clear();
+}
+
+void CompiledProgram::CreateBakedAsset(void *dst, const std::string &md5ext)
+{
+	SegmentType seg;
+	uint64_t off;
+
+	ResolvePointer(dst, &seg, &off);
+
+	// stays null if the asset cannot be baked
+	memset(dst, 0, sizeof(bc::ptr<bc::byte>));
+
+	_bakedAssets[md5ext].push_back(DataReference{ seg, off });
+}
+
+void CompiledProgram::FlushBakedAssetPool(Loader &loader, int jobs)
+{
+	std::vector<std::string> names;
+	for (auto &p : _bakedAssets)
+		names.push_back(p.first);
+
+	// decoding is slow, do it in parallel
+	std::vector<Segment> baked;
+	BakeAssets(names, loader, jobs, baked);
+
+	size_t i = 0;
+	for (auto &p : _bakedAssets)
+	{
+		const Segment &data = baked[i++];
+		if (data.empty())
+			continue;
+
+		// the VM reads samples in place, keep them aligned
+		_rdata.resize((_rdata.size() + 7) & ~7);
+
+		DataReference to{ Segment_rdata, _rdata.size() };
+
+		WriteRdata(data.data(), data.size());
+
+		for (const DataReference &ref : p.second)
+			_references.emplace_back(ref, to);
+	}
+	_bakedAssets.clear();
+}
+
 void CompiledProgram::FlushStringPool()
 {
 	for (auto &p : _managedStrings)
@@ -2225,9 +3000,14 @@ void CompiledProgram::FlushStringPool()
 		s->ref.count = 1;
 		s->ref.flags = VALUE_STATIC;
 		s->len = str.size();
+		s->capacity = str.size();
 		s->hash = HashString(str.c_str());
 		memcpy(s->str, str.c_str(), str.size() + 1);
 
+		// rdata may be read-only, so the caches must be populated now
+		CacheStringNumber(s);
+		CacheStringAscii(s);
+
 		// create references
 		for (const DataReference &ref : refs)
 			_references.emplace_back(ref, to);
@@ -2477,6 +3257,73 @@ void CompiledProgram::ResolvePointer(void *dst, SegmentType *seg, uint64_t *off)
 	}
 }
 
+void CompiledProgram::Merge(const CompiledProgram &unit)
+{
+	// offsets of the unit's segments in this program, by SegmentType
+	uint64_t base[5];
+	base[Segment_text] = _text.size();
+	base[Segment_stable] = _stable.size();
+	base[Segment_data] = _data.size();
+	base[Segment_rdata] = _rdata.size();
+	base[Segment_debug] = _debug.size();
+
+	auto rebase = [&base](const DataReference &ref)
+	{
+		return DataReference{ ref.seg, ref.off + base[ref.seg] };
+	};
+
+	_text.insert(_text.end(), unit._text.begin(), unit._text.end());
+	_stable.insert(_stable.end(), unit._stable.begin(), unit._stable.end());
+	_data.insert(_data.end(), unit._data.begin(), unit._data.end());
+	_rdata.insert(_rdata.end(), unit._rdata.begin(), unit._rdata.end());
+	_debug.insert(_debug.end(), unit._debug.begin(), unit._debug.end());
+
+	for (auto &p : unit._managedStrings)
+	{
+		auto &refs = _managedStrings[p.first];
+		for (const DataReference &ref : p.second)
+			refs.push_back(rebase(ref));
+	}
+
+	for (auto &p : unit._plainStrings)
+	{
+		auto &refs = _plainStrings[p.first];
+		for (const DataReference &ref : p.second)
+			refs.push_back(rebase(ref));
+	}
+
+	for (auto &p : unit._assets)
+	{
+		auto &refs = _assets[p.first];
+		for (const DataReference &ref : p.second)
+			refs.push_back(rebase(ref));
+	}
+
+	for (auto &p : unit._bakedAssets)
+	{
+		auto &refs = _bakedAssets[p.first];
+		for (const DataReference &ref : p.second)
+			refs.push_back(rebase(ref));
+	}
+
+	for (auto &p : unit._importSymbols)
+		_importSymbols.emplace_back(p.first + base[Segment_text], p.second);
+
+	for (auto &p : unit._exportSymbols)
+	{
+		if (_exportSymbols.find(p.first) != _exportSymbols.end())
+		{
+			printf("Error: Duplicate procedure definition\n");
+			abort();
+		}
+
+		_exportSymbols[p.first] = p.second + base[Segment_text];
+	}
+
+	for (auto &p : unit._references)
+		_references.emplace_back(rebase(p.first), rebase(p.second));
+}
+
 void CompiledProgram::Link()
 {
 	for (auto &p : _importSymbols)
@@ -2499,7 +3346,12 @@ void CompiledProgram::Link()
 CompiledProgram *CompileProgram(Program *p, Loader *loader, const Scratch3CompilerOptions *options)
 {
 	CompiledProgram *cp = new CompiledProgram();
-	Compiler compiler(cp, loader, options);
+
+	std::unique_ptr<CompileCache> cache;
+	if (options->cacheDir)
+		cache.reset(new CompileCache(options->cacheDir));
+
+	Compiler compiler(cp, loader, options, cache.get());
 	p->Accept(&compiler);
 	return cp;
 }
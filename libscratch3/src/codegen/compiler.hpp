@@ -15,7 +15,7 @@
 // "CSB3" in ASCII
 #define PROGRAM_MAGIC 0x33425343
 
-#define PROGRAM_VERSION 1
+#define PROGRAM_VERSION 9
 
 using Segment = std::vector<uint8_t>;
 
@@ -34,11 +34,59 @@ struct DataReference
 	uint64_t off;
 };
 
+//! \brief Pool of strings and the locations that reference them
+//!
+//! Strings are kept in order of first use, so flushing the pool is
+//! deterministic.
+class StringPool final
+{
+public:
+	using Entry = std::pair<std::string, std::vector<DataReference>>; // (string, references)
+
+	inline std::vector<DataReference> &operator[](const std::string &str)
+	{
+		auto it = _index.find(str);
+		if (it != _index.end())
+			return _entries[it->second].second;
+
+		_index.emplace(str, _entries.size());
+		_entries.emplace_back(str, std::vector<DataReference>());
+		return _entries.back().second;
+	}
+
+	inline void clear()
+	{
+		_index.clear();
+		_entries.clear();
+	}
+
+	inline std::vector<Entry>::const_iterator begin() const { return _entries.begin(); }
+	inline std::vector<Entry>::const_iterator end() const { return _entries.end(); }
+private:
+	std::unordered_map<std::string, size_t> _index; // string -> index in _entries
+	std::vector<Entry> _entries;
+};
+
 class CompiledProgram final
 {
 public:
 	uint8_t *Export(size_t *outSize) const;
 
+	//! \brief Append an unlinked program to a buffer
+	//!
+	//! \param out The buffer to append to
+	void Serialize(Segment &out) const;
+
+	//! \brief Read a program written by Serialize
+	//!
+	//! The program is left unchanged if the data is malformed.
+	//!
+	//! \param data The serialized program
+	//! \param size The size of data
+	//!
+	//! \return true if the program was read
+	bool Deserialize(const uint8_t *data, size_t size);
+
 	CompiledProgram &operator=(const CompiledProgram &) = delete;
 	CompiledProgram &operator=(CompiledProgram &&) = delete;
 
@@ -52,8 +100,10 @@ private:
 	Segment _data;
 	Segment _debug;
 
-	std::unordered_map<std::string, std::vector<DataReference>> _managedStrings; // managed string pool (string -> references)
-	std::unordered_map<std::string, std::vector<DataReference>> _plainStrings; // plain string pool (string -> references)
+	StringPool _managedStrings; // managed string pool (string -> references)
+	StringPool _plainStrings; // plain string pool (string -> references)
+	StringPool _assets; // asset pool (md5ext -> references)
+	StringPool _bakedAssets; // baked asset pool (md5ext -> references)
 
 	std::vector<std::pair<uint64_t, std::string>> _importSymbols; // import procedure symbols (offset, name)
 	std::unordered_map<std::string, uint64_t> _exportSymbols; // export procedure symbols (name -> offset)
@@ -70,8 +120,15 @@ private:
 
 	void WriteString(SegmentType seg, const std::string &str);
 	void CreateString(void *dst, const std::string &str);
+	void CreateStaticString(void *dst, const std::string &str);
 	void FlushStringPool();
 
+	void CreateAsset(void *dst, const std::string &md5ext);
+	void FlushAssetPool(Loader &loader, bool compress);
+
+	void CreateBakedAsset(void *dst, const std::string &md5ext);
+	void FlushBakedAssetPool(Loader &loader, int jobs);
+
 	void WriteAbsoluteJump(uint8_t opcode, uint64_t off);
 	void WriteRelativeJump(uint8_t opcode, int64_t off);
 
@@ -106,6 +163,25 @@ private:
 
 	void ResolvePointer(void *dst, SegmentType *seg, uint64_t *off);
 
+	//! \brief Run the peephole optimizer over the text segment
+	//!
+	//! Threads jumps, removes instructions which have no effect and
+	//! forwards stores to the loads that follow them. Must run on an
+	//! unlinked unit, before its pools are flushed.
+	void Peephole();
+	bool PeepholePass();
+
+	//! \brief Keep a single copy of identical procedures and scripts
+	//!
+	//! Splits the text segment at entry points and compares the pieces
+	//! with their operands resolved to what they refer to, so copies of
+	//! the same code in different sprites are found. Copies are removed
+	//! and everything referring to them is pointed at the kept one. Must
+	//! run on a merged program without a source map, before its pools
+	//! are flushed and it is linked.
+	void FoldIdenticalCode();
+
+	void Merge(const CompiledProgram &unit);
 	void Link();
 
 	friend class Compiler;
@@ -0,0 +1,324 @@
+#include "compiler.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <unordered_map>
+
+#include "util.hpp"
+
+// maximum number of times the ranges are compared, folding a procedure
+// can make its callers identical
+#define FOLD_MAX_PASSES 4
+
+enum OperandKind
+{
+	Operand_Reference, // reference, target is a DataReference
+	Operand_Import, // import symbol, name is the symbol
+	Operand_String, // managed string, name is the string
+	Operand_PlainString, // plain string, name is the string
+	Operand_Asset, // asset, name is the md5ext
+	Operand_BakedAsset // baked asset, name is the md5ext
+};
+
+//! \brief Operand of an instruction which is filled in when linking
+struct Operand
+{
+	uint64_t off; // offset in the text segment
+	OperandKind kind;
+	DataReference target; // Operand_Reference
+	const std::string *name; // everything else
+};
+
+//! \brief Code between two entry points
+struct CodeRange
+{
+	uint64_t start; // offset of the first byte
+	uint64_t end; // offset past the last byte
+	size_t canonical; // range holding the code which is kept, itself if kept
+	std::vector<Operand> operands; // sorted by offset
+};
+
+//! \brief Append an integer to a signature
+static inline void AppendInt(std::string &sig, uint64_t v)
+{
+	sig.append(reinterpret_cast<const char *>(&v), sizeof(v));
+}
+
+void CompiledProgram::FoldIdenticalCode()
+{
+	if (_text.empty())
+		return;
+
+	// procedures and scripts start at entry points, everything from one
+	// entry point to the next belongs to the same range
+	std::vector<uint64_t> entries{ 0 };
+	for (auto &p : _exportSymbols)
+		entries.push_back(p.second);
+
+	for (auto &p : _references)
+	{
+		if (p.second.seg == Segment_text && p.first.seg != Segment_text)
+			entries.push_back(p.second.off);
+	}
+
+	std::sort(entries.begin(), entries.end());
+	entries.erase(std::unique(entries.begin(), entries.end()), entries.end());
+	while (!entries.empty() && entries.back() >= _text.size())
+		entries.pop_back();
+
+	size_t n = entries.size();
+	std::vector<CodeRange> ranges(n);
+	for (size_t i = 0; i < n; i++)
+	{
+		ranges[i].start = entries[i];
+		ranges[i].end = i + 1 < n ? entries[i + 1] : _text.size();
+		ranges[i].canonical = i;
+	}
+
+	// index of the range containing an offset
+	auto rangeOf = [&entries](uint64_t off) -> size_t
+	{
+		return (std::upper_bound(entries.begin(), entries.end(), off) - entries.begin()) - 1;
+	};
+
+	for (auto &p : _references)
+	{
+		if (p.first.seg == Segment_text)
+			ranges[rangeOf(p.first.off)].operands.push_back(Operand{ p.first.off, Operand_Reference, p.second, nullptr });
+	}
+
+	for (auto &p : _importSymbols)
+		ranges[rangeOf(p.first)].operands.push_back(Operand{ p.first, Operand_Import, {}, &p.second });
+
+	auto addPool = [&](const StringPool &pool, OperandKind kind)
+	{
+		for (auto &p : pool)
+		{
+			for (const DataReference &ref : p.second)
+			{
+				if (ref.seg == Segment_text)
+					ranges[rangeOf(ref.off)].operands.push_back(Operand{ ref.off, kind, {}, &p.first });
+			}
+		}
+	};
+
+	addPool(_managedStrings, Operand_String);
+	addPool(_plainStrings, Operand_PlainString);
+	addPool(_assets, Operand_Asset);
+	addPool(_bakedAssets, Operand_BakedAsset);
+
+	for (CodeRange &range : ranges)
+	{
+		std::sort(range.operands.begin(), range.operands.end(),
+			[](const Operand &a, const Operand &b) { return a.off < b.off; });
+	}
+
+	auto resolve = [&ranges](size_t i) -> size_t
+	{
+		while (ranges[i].canonical != i)
+			i = ranges[i].canonical;
+		return i;
+	};
+
+	// position independent description of a range, the bytes with the
+	// operands cleared followed by what the operands refer to. Field
+	// accesses are already relative to the running sprite, so copies in
+	// different sprites compare equal.
+	auto signature = [&](size_t i, std::string &sig)
+	{
+		const CodeRange &range = ranges[i];
+		size_t self = resolve(i);
+
+		sig.assign(reinterpret_cast<const char *>(_text.data() + range.start), range.end - range.start);
+
+		for (const Operand &op : range.operands)
+		{
+			uint64_t rel = op.off - range.start;
+			if (rel + sizeof(uint64_t) > sig.size())
+				return false;
+
+			memset(&sig[rel], 0, sizeof(uint64_t));
+		}
+
+		for (const Operand &op : range.operands)
+		{
+			AppendInt(sig, op.off - range.start);
+			AppendInt(sig, op.kind);
+
+			switch (op.kind)
+			{
+			case Operand_Reference:
+				AppendInt(sig, op.target.seg);
+				if (op.target.seg == Segment_text && op.target.off < _text.size())
+				{
+					// code in the same or another range, by its kept copy
+					size_t r = rangeOf(op.target.off);
+					size_t target = resolve(r);
+					AppendInt(sig, target == self ? -1 : target);
+					AppendInt(sig, op.target.off - ranges[r].start);
+				}
+				else
+					AppendInt(sig, op.target.off);
+				break;
+			case Operand_Import: {
+				auto it = _exportSymbols.find(*op.name);
+				if (it == _exportSymbols.end() || it->second >= _text.size())
+				{
+					sig += *op.name; // reported by Link
+					sig += '\0';
+					break;
+				}
+
+				// calls the kept copy of the procedure, or itself
+				size_t target = resolve(rangeOf(it->second));
+				AppendInt(sig, target == self ? -1 : target);
+				break;
+			}
+			default:
+				AppendInt(sig, op.name->size());
+				sig += *op.name;
+				break;
+			}
+		}
+
+		return true;
+	};
+
+	// ranges are removed whole, so only aligned ranges keep the entry
+	// points after them aligned
+	auto foldable = [&ranges](size_t i)
+	{
+		return (ranges[i].start & 7) == 0 && (ranges[i].end & 7) == 0;
+	};
+
+	bool folded = false;
+	std::string sig;
+	for (int pass = 0; pass < FOLD_MAX_PASSES; pass++)
+	{
+		std::unordered_map<std::string, size_t> seen; // signature -> first range
+		bool changed = false;
+
+		for (size_t i = 0; i < n; i++)
+		{
+			if (ranges[i].canonical != i || !foldable(i) || !signature(i, sig))
+				continue;
+
+			auto r = seen.emplace(sig, i);
+			if (!r.second)
+			{
+				ranges[i].canonical = r.first->second;
+				changed = true;
+			}
+		}
+
+		if (!changed)
+			break;
+		folded = true;
+	}
+
+	if (!folded)
+		return;
+
+	for (size_t i = 0; i < n; i++)
+		ranges[i].canonical = resolve(i);
+
+	// bytes removed before each range
+	std::vector<uint64_t> removed(n + 1, 0);
+	for (size_t i = 0; i < n; i++)
+	{
+		uint64_t size = ranges[i].end - ranges[i].start;
+		removed[i + 1] = removed[i] + (ranges[i].canonical != i ? size : 0);
+	}
+
+	// whether an offset is in code which is removed
+	auto isDead = [&](uint64_t off)
+	{
+		return off < _text.size() && ranges[rangeOf(off)].canonical != rangeOf(off);
+	};
+
+	// new offset of a location, locations in removed code move to the
+	// same location in the kept copy
+	auto mapText = [&](uint64_t off) -> uint64_t
+	{
+		if (off >= _text.size())
+			return off - removed[n];
+
+		size_t r = rangeOf(off);
+		size_t c = ranges[r].canonical;
+		off = ranges[c].start + (off - ranges[r].start);
+		return off - removed[c];
+	};
+
+	Segment text;
+	text.reserve(_text.size() - removed[n]);
+	for (size_t i = 0; i < n; i++)
+	{
+		if (ranges[i].canonical == i)
+			text.insert(text.end(), _text.begin() + ranges[i].start, _text.begin() + ranges[i].end);
+	}
+
+	std::vector<std::pair<DataReference, DataReference>> references;
+	references.reserve(_references.size());
+	for (auto &p : _references)
+	{
+		DataReference from = p.first;
+		DataReference to = p.second;
+
+		if (from.seg == Segment_text)
+		{
+			if (isDead(from.off))
+				continue;
+			from.off = mapText(from.off);
+		}
+
+		if (to.seg == Segment_text)
+			to.off = mapText(to.off);
+
+		references.emplace_back(from, to);
+	}
+
+	std::vector<std::pair<uint64_t, std::string>> importSymbols;
+	importSymbols.reserve(_importSymbols.size());
+	for (auto &p : _importSymbols)
+	{
+		if (!isDead(p.first))
+			importSymbols.emplace_back(mapText(p.first), p.second);
+	}
+
+	// removed procedures resolve to their kept copy
+	for (auto &p : _exportSymbols)
+		p.second = mapText(p.second);
+
+	auto remapPool = [&](StringPool &pool)
+	{
+		StringPool result;
+		for (auto &p : pool)
+		{
+			std::vector<DataReference> refs;
+			for (DataReference ref : p.second)
+			{
+				if (ref.seg == Segment_text)
+				{
+					if (isDead(ref.off))
+						continue;
+					ref.off = mapText(ref.off);
+				}
+
+				refs.push_back(ref);
+			}
+
+			if (!refs.empty())
+				result[p.first] = std::move(refs);
+		}
+		pool = std::move(result);
+	};
+
+	remapPool(_managedStrings);
+	remapPool(_plainStrings);
+	remapPool(_assets);
+	remapPool(_bakedAssets);
+
+	_text = std::move(text);
+	_references = std::move(references);
+	_importSymbols = std::move(importSymbols);
+}
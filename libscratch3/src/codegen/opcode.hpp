@@ -178,6 +178,18 @@ enum Opcode : uint8_t
 	Op_listlen,
 	Op_listcontains,
 
+	Op_catstatic, // Append to static variable
+	Op_catfield, // Append to field
+
+	// Typed operators, emitted when both operands are known to be numbers
+	Op_addnum,
+	Op_subnum,
+	Op_mulnum,
+	Op_divnum,
+	Op_eqnum,
+	Op_gtnum,
+	Op_ltnum,
+
 	Op_ext = 0xff // Extension operation, check next 2 bytes (extension id, extension opcode)
 };
 
@@ -0,0 +1,463 @@
+#include "compiler.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+#include "opcode.hpp"
+#include "util.hpp"
+
+// maximum number of times the pass runs over a unit, a rewrite can
+// expose new patterns to its neighbours
+#define PEEPHOLE_MAX_PASSES 4
+
+// marks an instruction index which is not set
+#define NO_INSN ((size_t)-1)
+
+struct Insn
+{
+	uint64_t off; // offset in the text segment
+	uint32_t len; // length, including the opcode
+	uint8_t op; // opcode, may differ from the text segment
+	bool live; // false if the instruction is removed
+	uint8_t code[4]; // replacement encoding, has no references
+	uint32_t codeLen; // length of code, 0 if the instruction is kept
+};
+
+//! \brief Get the length of an instruction
+//!
+//! \param ptr The instruction
+//!
+//! \return The length of the instruction including operands, or 0
+//! if the opcode is unknown
+static uint32_t GetInstructionLength(const uint8_t *ptr)
+{
+	switch (*ptr)
+	{
+	case Op_setstatic:
+	case Op_getstatic:
+	case Op_addstatic:
+	case Op_setfield:
+	case Op_getfield:
+	case Op_addfield:
+	case Op_catstatic:
+	case Op_catfield:
+		return 1 + sizeof(bc::VarId);
+	case Op_listcreate:
+	case Op_jmp:
+	case Op_jz:
+	case Op_jnz:
+	case Op_pushint:
+	case Op_pushreal:
+	case Op_pushstring:
+	case Op_onbackdropswitch:
+	case Op_onevent:
+		return 1 + sizeof(bc::uint64);
+	case Op_call:
+		return 1 + sizeof(bc::_bool) + sizeof(bc::uint16) + sizeof(bc::uint64);
+	case Op_push:
+		return 1 + sizeof(bc::int16);
+	case Op_onkey:
+		return 1 + sizeof(bc::uint16);
+	case Op_setrotationstyle:
+	case Op_addgraphiceffect:
+	case Op_setgraphiceffect:
+	case Op_gotolayer:
+	case Op_movelayer:
+	case Op_addsoundeffect:
+	case Op_setsoundeffect:
+	case Op_setdragmode:
+	case Op_propertyof:
+	case Op_gettime:
+		return 1 + sizeof(bc::uint8);
+	case Op_ext:
+		return 3; // extension id, extension opcode
+	default:
+		return *ptr <= Op_ltnum ? 1 : 0;
+	}
+}
+
+static inline bool IsJump(uint8_t op)
+{
+	return op == Op_jmp || op == Op_jz || op == Op_jnz;
+}
+
+//! \brief Whether execution never continues past an instruction
+static inline bool IsTerminator(uint8_t op)
+{
+	return op == Op_jmp || op == Op_ret || op == Op_stopself || op == Op_stopall;
+}
+
+//! \brief Whether an instruction only pushes a value
+static inline bool IsPush(uint8_t op)
+{
+	switch (op)
+	{
+	case Op_pushnone:
+	case Op_pushint:
+	case Op_pushreal:
+	case Op_pushtrue:
+	case Op_pushfalse:
+	case Op_pushstring:
+	case Op_push:
+	case Op_getstatic:
+	case Op_getfield:
+		return true;
+	default:
+		return false;
+	}
+}
+
+void CompiledProgram::Peephole()
+{
+	for (int i = 0; i < PEEPHOLE_MAX_PASSES; i++)
+	{
+		if (!PeepholePass())
+			break;
+	}
+}
+
+bool CompiledProgram::PeepholePass()
+{
+	// decode the text segment
+	std::vector<Insn> insns;
+	for (uint64_t off = 0; off < _text.size();)
+	{
+		uint32_t len = GetInstructionLength(_text.data() + off);
+		if (len == 0 || off + len > _text.size())
+			return false; // unknown encoding, leave the unit alone
+
+		Insn insn{};
+		insn.off = off;
+		insn.len = len;
+		insn.op = _text[off];
+		insn.live = true;
+		insns.push_back(insn);
+
+		off += len;
+	}
+
+	size_t n = insns.size();
+	if (n == 0)
+		return false;
+
+	// index of the instruction containing an offset
+	auto find = [&insns](uint64_t off) -> size_t
+	{
+		auto it = std::upper_bound(insns.begin(), insns.end(), off,
+			[](uint64_t off, const Insn &insn) { return off < insn.off; });
+		return (it - insns.begin()) - 1;
+	};
+
+	// index of the instruction starting at an offset, n for the end of
+	// the segment
+	auto indexOf = [&](uint64_t off) -> size_t
+	{
+		if (off == _text.size())
+			return n;
+		if (off > _text.size())
+			return NO_INSN;
+
+		size_t i = find(off);
+		return insns[i].off == off ? i : NO_INSN;
+	};
+
+	std::vector<size_t> jumpRef(n, NO_INSN); // instruction -> reference of its operand
+	std::vector<size_t> jumpTarget(n, NO_INSN); // instruction -> target instruction
+	std::vector<bool> target(n + 1, false); // whether control may enter at an instruction
+	std::vector<bool> entry(n + 1, false); // whether an instruction is referenced from outside the segment
+
+	for (size_t r = 0; r < _references.size(); r++)
+	{
+		const DataReference &from = _references[r].first;
+		const DataReference &to = _references[r].second;
+		if (to.seg != Segment_text)
+			continue;
+
+		size_t t = indexOf(to.off);
+		if (t == NO_INSN)
+			return false; // not an instruction boundary
+
+		if (from.seg == Segment_text)
+		{
+			size_t i = find(from.off);
+			if (IsJump(insns[i].op) && from.off == insns[i].off + 1)
+			{
+				jumpRef[i] = r;
+				jumpTarget[i] = t;
+				continue;
+			}
+
+			target[t] = true;
+		}
+		else if (from.seg != Segment_debug)
+			entry[t] = true; // source map entries are not entry points
+	}
+
+	for (auto &p : _exportSymbols)
+	{
+		size_t t = indexOf(p.second);
+		if (t == NO_INSN)
+			return false;
+		entry[t] = true;
+	}
+
+	for (size_t i = 0; i < n; i++)
+	{
+		if (IsJump(insns[i].op) && jumpRef[i] == NO_INSN)
+			return false; // jump without a destination
+	}
+
+	// jump threading, a jump to an unconditional jump goes to its
+	// destination directly, enter and leave are skipped as they are
+	// removed below
+	for (size_t i = 0; i < n; i++)
+	{
+		if (!IsJump(insns[i].op))
+			continue;
+
+		size_t j = jumpTarget[i];
+		for (size_t hops = 0; hops < n; hops++)
+		{
+			while (j < n && (insns[j].op == Op_enter || insns[j].op == Op_leave))
+				j++;
+
+			if (j == n || j == i || insns[j].op != Op_jmp)
+				break;
+			j = jumpTarget[j];
+		}
+
+		jumpTarget[i] = j;
+
+		size_t k = i + 1;
+		while (k < n && (insns[k].op == Op_enter || insns[k].op == Op_leave))
+			k++;
+
+		// jump to a return, return directly unless it is next, the jump
+		// is removed below then
+		if (insns[i].op == Op_jmp && j < n && j != k && (insns[j].op == Op_ret || insns[j].op == Op_stopself))
+		{
+			insns[i].code[0] = insns[j].op;
+			insns[i].codeLen = 1;
+		}
+	}
+
+	for (size_t i = 0; i < n; i++)
+	{
+		if (entry[i])
+			target[i] = true;
+		else if (IsJump(insns[i].op) && insns[i].codeLen == 0)
+			target[jumpTarget[i]] = true;
+	}
+
+	for (size_t i = 0; i + 1 < n; i++)
+	{
+		Insn &a = insns[i];
+		Insn &b = insns[i + 1];
+		if (!a.live || a.codeLen || !b.live || b.codeLen || target[i + 1])
+			continue;
+
+		if ((a.op == Op_jz || a.op == Op_jnz) && b.op == Op_jmp && jumpTarget[i] == i + 2)
+		{
+			// jz A; jmp B; A: -> jnz B
+			a.op = a.op == Op_jz ? Op_jnz : Op_jz;
+			jumpTarget[i] = jumpTarget[i + 1];
+			b.live = false;
+		}
+		else if (IsPush(a.op) && b.op == Op_pop)
+		{
+			// push; pop -> nothing
+			a.live = false;
+			b.live = false;
+		}
+		else if ((a.op == Op_setstatic && b.op == Op_getstatic) || (a.op == Op_setfield && b.op == Op_getfield))
+		{
+			// set x; get x -> push -1; set x, the value is still on the stack
+			const uint8_t *aid = _text.data() + a.off + 1;
+			const uint8_t *bid = _text.data() + b.off + 1;
+			if (memcmp(aid, bid, sizeof(bc::VarId)) != 0)
+				continue;
+
+			int16_t top = -1;
+			a.code[0] = Op_push;
+			memcpy(a.code + 1, &top, sizeof(top));
+			a.codeLen = 1 + sizeof(top);
+
+			b.code[0] = a.op;
+			memcpy(b.code + 1, aid, sizeof(bc::VarId));
+			b.codeLen = 1 + sizeof(bc::VarId);
+		}
+	}
+
+	// enter and leave do nothing, code after a terminator is dead until
+	// the next place control can enter
+	bool reachable = true;
+	for (size_t i = 0; i < n; i++)
+	{
+		Insn &insn = insns[i];
+		if (target[i])
+			reachable = true;
+
+		if (!reachable || insn.op == Op_enter || insn.op == Op_leave)
+			insn.live = false;
+		else if (insn.live && IsTerminator(insn.codeLen ? insn.code[0] : insn.op))
+			reachable = false;
+	}
+
+	// jumps to the next instruction, backwards so chains of them are
+	// all removed
+	size_t next = n; // next live instruction
+	for (size_t i = n; i-- > 0;)
+	{
+		Insn &insn = insns[i];
+		if (insn.live && insn.codeLen == 0 && IsJump(insn.op))
+		{
+			size_t j = jumpTarget[i];
+			while (j < n && !insns[j].live)
+				j++;
+
+			if (j == next)
+			{
+				if (insn.op == Op_jmp)
+					insn.live = false;
+				else
+				{
+					// the condition must still be popped
+					insn.code[0] = Op_pop;
+					insn.codeLen = 1;
+				}
+			}
+		}
+
+		if (insn.live)
+			next = i;
+	}
+
+	// write the new text segment, entry points stay aligned
+	Segment text;
+	text.reserve(_text.size());
+
+	std::vector<uint64_t> newOff(n + 1);
+	uint8_t last = Op_noop; // last opcode written
+
+	auto align = [&]()
+	{
+		if (text.empty())
+			return;
+
+		if (last != Op_int)
+			text.push_back(Op_int);
+		while (text.size() & 7)
+			text.push_back(Op_int);
+		last = Op_int;
+	};
+
+	for (size_t i = 0; i < n; i++)
+	{
+		const Insn &insn = insns[i];
+		if (entry[i])
+			align();
+
+		newOff[i] = text.size();
+		if (!insn.live)
+			continue;
+
+		if (insn.codeLen)
+		{
+			text.insert(text.end(), insn.code, insn.code + insn.codeLen);
+			last = insn.code[0];
+		}
+		else
+		{
+			text.push_back(insn.op);
+			text.insert(text.end(), _text.begin() + insn.off + 1, _text.begin() + insn.off + insn.len);
+			last = insn.op;
+		}
+	}
+
+	align();
+	newOff[n] = text.size();
+
+	// move an offset into the operands of an instruction, false if the
+	// operands are gone
+	auto mapFrom = [&](uint64_t &off) -> bool
+	{
+		size_t i = find(off);
+		const Insn &insn = insns[i];
+		if (!insn.live || insn.codeLen)
+			return false;
+
+		off = newOff[i] + (off - insn.off);
+		return true;
+	};
+
+	std::vector<std::pair<DataReference, DataReference>> references;
+	references.reserve(_references.size());
+	for (auto &p : _references)
+	{
+		DataReference from = p.first;
+		DataReference to = p.second;
+
+		if (from.seg == Segment_text)
+		{
+			size_t i = find(from.off);
+			if (!mapFrom(from.off))
+				continue;
+
+			if (jumpRef[i] != NO_INSN && p.first.off == insns[i].off + 1)
+			{
+				references.emplace_back(from, DataReference{ Segment_text, newOff[jumpTarget[i]] });
+				continue;
+			}
+		}
+
+		if (to.seg == Segment_text)
+			to.off = newOff[indexOf(to.off)];
+
+		references.emplace_back(from, to);
+	}
+
+	std::vector<std::pair<uint64_t, std::string>> importSymbols;
+	importSymbols.reserve(_importSymbols.size());
+	for (auto &p : _importSymbols)
+	{
+		uint64_t off = p.first;
+		if (mapFrom(off))
+			importSymbols.emplace_back(off, p.second);
+	}
+
+	for (auto &p : _exportSymbols)
+		p.second = newOff[indexOf(p.second)];
+
+	// pooled references from removed instructions are dropped, with the
+	// entries nothing else uses
+	auto remapPool = [&](StringPool &pool)
+	{
+		StringPool result;
+		for (auto &p : pool)
+		{
+			std::vector<DataReference> refs;
+			for (DataReference ref : p.second)
+			{
+				if (ref.seg != Segment_text || mapFrom(ref.off))
+					refs.push_back(ref);
+			}
+
+			if (!refs.empty())
+				result[p.first] = std::move(refs);
+		}
+		pool = std::move(result);
+	};
+
+	remapPool(_managedStrings);
+	remapPool(_plainStrings);
+	remapPool(_assets);
+	remapPool(_bakedAssets);
+
+	bool shrunk = text.size() < _text.size();
+
+	_text = std::move(text);
+	_references = std::move(references);
+	_importSymbols = std::move(importSymbols);
+
+	return shrunk;
+}
@@ -5,6 +5,9 @@
 #define DEG2RAD (0.017453292519943295769236907684886)
 #define RAD2DEG (57.295779513082320876798154814105)
 
+// Asset flags, see bc::Costume::flags and bc::Sound::flags
+#define ASSET_COMPRESSED 0x01 // data is a bc::CompressedData
+
 // See BYTECODE.md
 namespace bc
 {
@@ -37,16 +40,58 @@ namespace bc
 		uint64 offset;
 	};
 
+	// Initial value of a variable, strings point to a static String and
+	// lists to an InitialList
+	struct InitialValue
+	{
+		uint16 type; // ValueType
+		uint16 __padding[3];
+
+		union
+		{
+			int64 integer; // ValueType_Integer
+			float64 real; // ValueType_Real
+			_bool boolean; // ValueType_Bool
+			ptr<byte> ref; // ValueType_String, ValueType_List
+		} u;
+	};
+
+	// Initial elements of a list, followed by count float64 if packed,
+	// otherwise count InitialValue
+	struct InitialList
+	{
+		uint64 count; // number of elements
+		uint64 packed; // whether all elements are numbers
+	};
+
+	struct BakedCostume
+	{
+		uint32 width; // width of the costume, in pixels
+		uint32 height; // height of the costume, in pixels
+		uint32 components; // bytes per pixel of the bitmap, 0 for SVGs
+		uint32 lodCount; // number of rendered LODs, SVGs only
+		byte data[]; // bitmap, collision mask, then LODs
+	};
+
+	struct BakedSound
+	{
+		uint64 frameCount; // number of frames
+		uint32 channels; // number of channels, 1 or 2
+		uint32 sampleRate; // sample rate
+		float32 samples[]; // interleaved samples
+	};
+
 	struct Costume
 	{
 		ptr<string> name;
 		ptr<string> format;
 		uint32 bitmapResolution;
-		uint32 reserved;
+		uint32 flags; // ASSET_* flags
 		float64 rotationCenterX;
 		float64 rotationCenterY;
 		uint64 dataSize;
 		ptr<byte> data;
+		ptr<BakedCostume> baked; // null if not baked
 	};
 
 	struct Sound
@@ -57,6 +102,15 @@ namespace bc
 		uint64 sampleCount;
 		uint64 dataSize;
 		ptr<byte> data;
+		uint32 flags; // ASSET_* flags
+		uint32 reserved;
+		ptr<BakedSound> baked; // null if not baked
+	};
+
+	struct CompressedData
+	{
+		uint64 size; // size of the compressed data
+		byte data[]; // zlib stream, inflates to the dataSize of the asset
 	};
 
 	struct Sprite
@@ -72,7 +126,7 @@ namespace bc
 		_bool isStage;
 		_bool draggable;
 		uint8 rotationStyle;
-		Script initializer;
+		ptr<InitialValue> fields; // initial values of the fields, numFields entries
 		uint64 numFields;
 		uint64 numScripts;
 		ptr<Script> scripts;
@@ -121,4 +175,59 @@ namespace bc
 		ptr<byte> debug;
 		uint64 debug_size;
 	};
+
+	// Debug information
+
+	struct SourceMapEntry
+	{
+		ptr<byte> start; // first instruction of the block
+		ptr<byte> end; // end of the code of the block
+		ptr<string> sprite; // name of the sprite
+		ptr<string> script; // id of the top block of the script
+		ptr<string> block; // id of the block
+		ptr<string> opcode; // opcode of the block
+		ptr<string> proc; // proccode of the enclosing procedure, null at top level
+	};
+
+	struct DebugInfo
+	{
+		uint64 count; // number of entries
+		SourceMapEntry entries[]; // sorted by start, ranges do not overlap
+	};
+
+	//! \brief Find the block an instruction was compiled from
+	//!
+	//! \param bytecode The program
+	//! \param off The offset of the instruction in the program
+	//!
+	//! \return The source map entry covering the instruction, or nullptr
+	//! if there is none or the program has no source map
+	inline const SourceMapEntry *FindSourceMapEntry(const uint8 *bytecode, uint64 off)
+	{
+		const Header *header = (const Header *)bytecode;
+		if (header->debug_size < sizeof(DebugInfo))
+			return nullptr;
+
+		const DebugInfo *info = (const DebugInfo *)(bytecode + header->debug);
+		if (info->count > (header->debug_size - sizeof(DebugInfo)) / sizeof(SourceMapEntry))
+			return nullptr;
+
+		// last entry starting at or before off, blocks whose code was
+		// removed are left as empty entries and never match
+		uint64 lo = 0, hi = info->count;
+		while (lo < hi)
+		{
+			uint64 mid = lo + (hi - lo) / 2;
+			if (info->entries[mid].start <= off)
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+
+		if (lo == 0)
+			return nullptr;
+
+		const SourceMapEntry *entry = info->entries + lo - 1;
+		return off < entry->end ? entry : nullptr;
+	}
 }
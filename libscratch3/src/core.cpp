@@ -1,10 +1,13 @@
 #include "core.hpp"
 
+#include <new>
+
 #include <lysys/lysys.hpp>
 #include <glib.h>
 #include <librsvg/rsvg.h>
 
 #include "resource.hpp"
+#include "filemap.hpp"
 #include "ast/ast.hpp"
 #include "vm/vm.hpp"
 #include "codegen/compiler.hpp"
@@ -64,6 +67,8 @@ SCRATCH3_EXTERN_C SCRATCH3_EXPORT const char *Scratch3GetErrorString(int error)
 		return "VM already running";
 	case SCRATCH3_ERROR_TIMEOUT:
 		return "Timeout";
+	case SCRATCH3_ERROR_NOT_FOUND:
+		return "Not found";
 	}
 }
 
@@ -82,12 +87,16 @@ SCRATCH3_EXTERN_C SCRATCH3_EXPORT void Scratch3Destroy(Scratch3 *S)
 	if (S->vm)
 		delete S->vm;
 
-	if (S->bytecode)
+	if (S->bytecode && S->bytecode != S->mapping)
 		delete[] S->bytecode;
 
 	if (S->loader)
 		delete S->loader;
 
+	// the loader may read from the mapping
+	if (S->mapping)
+		UnmapFile(S->mapping, S->mappingSize);
+
 	delete S;
 }
 
@@ -128,23 +137,42 @@ SCRATCH3_EXTERN_C SCRATCH3_EXPORT void Scratch3Logf(Scratch3 *S, int severity, c
 	va_end(args);
 }
 
-SCRATCH3_EXTERN_C SCRATCH3_EXPORT int Scratch3Load(Scratch3 *S, const char *name, const void *data, size_t size)
+//! \brief Load a program from memory
+//!
+//! \param S The instance
+//! \param name The name of the program
+//! \param data The program, archives must outlive the instance
+//! \param size The size of the program
+//! \param copy Whether to copy compiled bytecode, otherwise it is
+//! used in place and must outlive the instance
+//!
+//! \return A SCRATCH3_ERROR_* code
+static int LoadProgram(Scratch3 *S, const char *name, const void *data, size_t size, bool copy)
 {
 	if (size < 4)
 		return SCRATCH3_ERROR_INVALID_PROGRAM;
 
-	if (S->bytecode)
+	if (S->bytecode || S->loader)
 		return SCRATCH3_ERROR_ALREADY_LOADED;
 
 	const bc::Header *header = (const bc::Header *)data;
 	if (header->magic == PROGRAM_MAGIC)
 	{
 		// Program is compiled bytecode
-		S->bytecode = (uint8_t *)malloc(size);
-		if (!S->bytecode)
-			return SCRATCH3_ERROR_OUT_OF_MEMORY;
+		if (size < sizeof(bc::Header) || header->version != PROGRAM_VERSION)
+			return SCRATCH3_ERROR_INVALID_PROGRAM;
+
+		if (copy)
+		{
+			S->bytecode = new (std::nothrow) uint8_t[size];
+			if (!S->bytecode)
+				return SCRATCH3_ERROR_OUT_OF_MEMORY;
+
+			memcpy(S->bytecode, data, size);
+		}
+		else
+			S->bytecode = (uint8_t *)data;
 
-		memcpy(S->bytecode, data, size);
 		S->bytecodeSize = size;
 	}
 	else
@@ -161,6 +189,36 @@ SCRATCH3_EXTERN_C SCRATCH3_EXPORT int Scratch3Load(Scratch3 *S, const char *name
 	return SCRATCH3_ERROR_SUCCESS;
 }
 
+SCRATCH3_EXTERN_C SCRATCH3_EXPORT int Scratch3Load(Scratch3 *S, const char *name, const void *data, size_t size)
+{
+	return LoadProgram(S, name, data, size, true);
+}
+
+SCRATCH3_EXTERN_C SCRATCH3_EXPORT int Scratch3LoadFile(Scratch3 *S, const char *name, const char *path)
+{
+	if (S->bytecode || S->loader)
+		return SCRATCH3_ERROR_ALREADY_LOADED;
+
+	size_t size;
+	void *data = MapFile(path, &size);
+	if (!data)
+		return SCRATCH3_ERROR_IO;
+
+	// compiled programs run directly from the mapping, only the pages
+	// written to (the static variables) are copied
+	int rc = LoadProgram(S, name, data, size, false);
+	if (rc != SCRATCH3_ERROR_SUCCESS)
+	{
+		UnmapFile(data, size);
+		return rc;
+	}
+
+	S->mapping = data;
+	S->mappingSize = size;
+
+	return SCRATCH3_ERROR_SUCCESS;
+}
+
 SCRATCH3_EXTERN_C SCRATCH3_EXPORT int Scratch3Compile(Scratch3 *S, const Scratch3CompilerOptions *options)
 {
 	if (!S->loader)
@@ -180,9 +238,6 @@ SCRATCH3_EXTERN_C SCRATCH3_EXPORT int Scratch3Compile(Scratch3 *S, const Scratch
 		return SCRATCH3_ERROR_COMPILATION_FAILED;
 	Retain(prog);
 
-	if (options->optimization > 0)
-		Optimize(prog, options->optimization);
-
 	CompiledProgram *cprog = CompileProgram(prog, S->loader, options);
 	if (!cprog)
 	{
@@ -214,9 +269,38 @@ SCRATCH3_EXTERN_C SCRATCH3_EXPORT const void *Scratch3GetProgram(Scratch3 *S, si
 	return S->bytecode;
 }
 
+SCRATCH3_EXTERN_C SCRATCH3_EXPORT int Scratch3FindSourceLocation(Scratch3 *S, size_t offset, Scratch3SourceLocation *loc)
+{
+	if (!S->bytecode)
+		return SCRATCH3_ERROR_NOT_COMPILED;
+
+	const bc::Header *header = (const bc::Header *)S->bytecode;
+	if (header->debug > S->bytecodeSize || header->debug_size > S->bytecodeSize - header->debug)
+		return SCRATCH3_ERROR_INVALID_PROGRAM;
+
+	if (offset >= S->bytecodeSize)
+		return SCRATCH3_ERROR_NOT_FOUND;
+
+	const bc::SourceMapEntry *entry = bc::FindSourceMapEntry(S->bytecode, offset);
+	if (!entry)
+		return SCRATCH3_ERROR_NOT_FOUND;
+
+	const char *base = (const char *)S->bytecode;
+	loc->start = static_cast<size_t>(entry->start);
+	loc->end = static_cast<size_t>(entry->end);
+	loc->sprite = base + entry->sprite;
+	loc->script = base + entry->script;
+	loc->block = base + entry->block;
+	loc->opcode = base + entry->opcode;
+	loc->proc = entry->proc ? base + entry->proc : nullptr;
+
+	return SCRATCH3_ERROR_SUCCESS;
+}
+
 SCRATCH3_EXTERN_C SCRATCH3_EXPORT int Scratch3VMInit(Scratch3 *S, const Scratch3VMOptions *options)
 {
-	if (!S->loader)
+	// compiled programs are loaded without a loader
+	if (!S->loader && !S->bytecode)
 		return SCRATCH3_ERROR_NO_PROGRAM;
 
 	if (!S->bytecode)
@@ -256,3 +340,17 @@ SCRATCH3_EXTERN_C SCRATCH3_EXPORT int Scratch3VMTerminate(Scratch3 *S)
 	S->vm->VMTerminate();
 	return SCRATCH3_ERROR_SUCCESS;
 }
+
+SCRATCH3_EXTERN_C SCRATCH3_EXPORT int Scratch3VMGetHeapStats(Scratch3 *S, Scratch3HeapStats *stats)
+{
+	if (!S->vm)
+		return SCRATCH3_ERROR_NO_VM;
+
+	const HeapStats &heap = S->vm->GetHeap();
+	stats->used = static_cast<size_t>(heap.used);
+	stats->peak = static_cast<size_t>(heap.peak);
+	stats->limit = static_cast<size_t>(heap.limit);
+	stats->failures = static_cast<size_t>(heap.failures);
+
+	return SCRATCH3_ERROR_SUCCESS;
+}
@@ -16,8 +16,11 @@ struct _Scratch3
 	char programName[256];
 	Loader *loader;
 
-	uint8_t *bytecode;
+	uint8_t *bytecode; // points into mapping if loaded with Scratch3LoadFile
 	size_t bytecodeSize;
 
+	void *mapping; // program file, null if not loaded with Scratch3LoadFile
+	size_t mappingSize;
+
 	VirtualMachine *vm;
 };
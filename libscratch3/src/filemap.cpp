@@ -0,0 +1,77 @@
+#include "filemap.hpp"
+
+#if _WIN32
+#include <Windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif // _WIN32
+
+#if _WIN32
+
+void *MapFile(const char *path, size_t *size)
+{
+	HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == INVALID_HANDLE_VALUE)
+		return nullptr;
+
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0)
+	{
+		CloseHandle(file);
+		return nullptr;
+	}
+
+	HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_WRITECOPY, 0, 0, NULL);
+	CloseHandle(file);
+	if (!mapping)
+		return nullptr;
+
+	// the view keeps the mapping alive
+	void *data = MapViewOfFile(mapping, FILE_MAP_COPY, 0, 0, 0);
+	CloseHandle(mapping);
+	if (!data)
+		return nullptr;
+
+	*size = static_cast<size_t>(fileSize.QuadPart);
+	return data;
+}
+
+void UnmapFile(void *data, size_t size)
+{
+	UnmapViewOfFile(data);
+}
+
+#else
+
+void *MapFile(const char *path, size_t *size)
+{
+	int fd = open(path, O_RDONLY);
+	if (fd == -1)
+		return nullptr;
+
+	struct stat st;
+	if (fstat(fd, &st) == -1 || st.st_size == 0)
+	{
+		close(fd);
+		return nullptr;
+	}
+
+	// the mapping holds its own reference to the file
+	void *data = mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED)
+		return nullptr;
+
+	*size = static_cast<size_t>(st.st_size);
+	return data;
+}
+
+void UnmapFile(void *data, size_t size)
+{
+	munmap(data, size);
+}
+
+#endif // _WIN32
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <cstddef>
+
+//! \brief Map a file into memory.
+//!
+//! The mapping is private and copy-on-write: pages are shared with the
+//! page cache, and other processes mapping the same file, until they
+//! are written to. Pages are read in on first access.
+//!
+//! \param path The path to the file.
+//! \param size Receives the size of the file.
+//!
+//! \return A pointer to the mapping, or nullptr if the file could not
+//! be mapped. Empty files cannot be mapped.
+void *MapFile(const char *path, size_t *size);
+
+//! \brief Unmap a file mapped with MapFile.
+//!
+//! \param data The pointer returned by MapFile.
+//! \param size The size of the file.
+void UnmapFile(void *data, size_t size);
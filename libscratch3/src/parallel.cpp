@@ -0,0 +1,37 @@
+#include "parallel.hpp"
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+void ParallelFor(size_t count, int jobs, const std::function<void(size_t)> &fn)
+{
+	size_t threads = jobs > 0 ? static_cast<size_t>(jobs) : std::thread::hardware_concurrency();
+	if (threads > count)
+		threads = count;
+
+	if (threads <= 1)
+	{
+		for (size_t i = 0; i < count; i++)
+			fn(i);
+		return;
+	}
+
+	std::atomic<size_t> next(0);
+	auto worker = [&]()
+	{
+		size_t i;
+		while ((i = next.fetch_add(1)) < count)
+			fn(i);
+	};
+
+	std::vector<std::thread> pool;
+	pool.reserve(threads - 1);
+	for (size_t i = 1; i < threads; i++)
+		pool.emplace_back(worker);
+
+	worker();
+
+	for (std::thread &t : pool)
+		t.join();
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+
+//! \brief Run a function for each index in [0, count) on a pool of
+//! worker threads.
+//!
+//! Indices are handed out one at a time in increasing order, so a few
+//! long jobs do not hold up the rest. The calling thread takes part in
+//! the work. The function must not depend on the order in which indices
+//! are processed.
+//!
+//! \param count The number of indices.
+//! \param jobs The maximum number of threads to use, or 0 to use one
+//! per hardware thread.
+//! \param fn The function to call with each index.
+void ParallelFor(size_t count, int jobs, const std::function<void(size_t)> &fn);
@@ -1,10 +1,18 @@
 #include "resource.hpp"
 
+#include <cstdio>
+#include <cstring>
+
 #include <zip.h>
+#include <zlib.h>
 #include <lysys/lysys.hpp>
 
+#include "codegen/util.hpp"
+
 Resource *Loader::Find(const std::string &name)
 {
+	std::lock_guard<std::mutex> lock(_lock);
+
 	auto it = _cache.find(name);
 	if (it != _cache.end())
 		return it->second;
@@ -99,3 +107,45 @@ Loader *CreateArchiveLoader(const void *data, size_t size)
 	// source is managed by the archive
 	return new ArchiveLoader(archive);
 }
+
+void CompressAsset(const uint8_t *data, size_t size, std::vector<uint8_t> &out)
+{
+	uLongf bound = compressBound(size);
+
+	size_t start = out.size();
+	out.resize(start + sizeof(bc::CompressedData) + bound);
+
+	uint8_t *dst = out.data() + start;
+	if (compress2(dst + sizeof(bc::CompressedData), &bound, data, size, Z_BEST_COMPRESSION) != Z_OK)
+	{
+		printf("Error: Failed to compress asset\n");
+		abort();
+	}
+
+	// the header may be unaligned
+	bc::CompressedData header;
+	header.size = bound;
+	memcpy(dst, &header, sizeof(header));
+
+	out.resize(start + sizeof(bc::CompressedData) + bound);
+}
+
+uint8_t *DecompressAsset(const uint8_t *blob, size_t size)
+{
+	bc::CompressedData header;
+	memcpy(&header, blob, sizeof(header));
+
+	uint8_t *data = (uint8_t *)malloc(size);
+	if (!data)
+		return nullptr;
+
+	uLongf len = size;
+	int rc = uncompress(data, &len, blob + sizeof(header), header.size);
+	if (rc != Z_OK || len != size)
+	{
+		free(data);
+		return nullptr;
+	}
+
+	return data;
+}
@@ -1,7 +1,10 @@
 #pragma once
 
+#include <cstdint>
 #include <string>
+#include <vector>
 #include <unordered_map>
+#include <mutex>
 
 //! \brief An abstract resource.
 class Resource
@@ -28,6 +31,8 @@ class Loader
 public:
     //! \brief Locate a resource by name.
     //!
+    //! Safe to call from multiple threads.
+    //!
     //! \param name The name of the resource.
     //!
     //! \return A pointer to the resource, or nullptr if the resource could not be found.
@@ -39,6 +44,7 @@ protected:
     virtual Resource *Load(const std::string &name) = 0;
 private:
     std::unordered_map<std::string, Resource *> _cache;
+    std::mutex _lock; // guards _cache and Load
 };
 
 //! \brief Create a loader for a compressed archive.
@@ -48,3 +54,19 @@ private:
 //!
 //! \return A pointer to the loader, or nullptr if the loader could not be created.
 Loader *CreateArchiveLoader(const void *data, size_t size);
+
+//! \brief Compress asset data.
+//!
+//! \param data A pointer to the asset data.
+//! \param size The size of the asset data.
+//! \param out Buffer to append the compressed data to, as a bc::CompressedData.
+void CompressAsset(const uint8_t *data, size_t size, std::vector<uint8_t> &out);
+
+//! \brief Decompress asset data written by CompressAsset.
+//!
+//! \param blob A pointer to the bc::CompressedData.
+//! \param size The size of the uncompressed asset.
+//!
+//! \return A pointer to the asset data, which must be freed with free, or nullptr if
+//! the data could not be decompressed.
+uint8_t *DecompressAsset(const uint8_t *blob, size_t size);
@@ -9,6 +9,8 @@
 
 #include "stb_image.h"
 
+#include "../resource.hpp"
+
 bool Costume::Init(uint8_t *bytecode, uint64_t bytecodeSize, const bc::Costume *info, bool streamed)
 {
 	Cleanup();
@@ -20,6 +22,8 @@ bool Costume::Init(uint8_t *bytecode, uint64_t bytecodeSize, const bc::Costume *
 	_center.y = info->rotationCenterY;
 	_data = bytecode + info->data;
 	_dataSize = info->dataSize;
+	_compressed = (info->flags & ASSET_COMPRESSED) != 0;
+	_baked = info->baked ? (const bc::BakedCostume *)(bytecode + info->baked) : nullptr;
 
 	_streamed = streamed;
 
@@ -27,6 +31,73 @@ bool Costume::Init(uint8_t *bytecode, uint64_t bytecodeSize, const bc::Costume *
 }
 
 void Costume::Load()
+{
+	if (_loaded)
+		return;
+	_loaded = true;
+
+	if (_source)
+	{
+		// decoded by the source, only the layout of this costume differs
+		_source->Load();
+
+		_size = _source->_size;
+		_nComponents = _source->_nComponents;
+
+		if (_source->IsBitmap())
+		{
+			_logicalSize = Vector2(_size) / static_cast<float>(_bitmapResolution);
+			_logicalCenter = Vector2(_center) / static_cast<float>(_bitmapResolution);
+		}
+		else
+		{
+			_logicalSize = Vector2(_size);
+			_logicalCenter = Vector2(_center);
+		}
+
+		return;
+	}
+
+	if (_baked && _baked->components != 0)
+	{
+		// decoded by the compiler, use the bitmap in the program
+		uint8_t *pixels = const_cast<uint8_t *>(_baked->data);
+		if (_baked->components == 4)
+			_collisionMask = pixels + (size_t)_baked->width * _baked->height * 4;
+
+		SetBitmap(pixels, _baked->width, _baked->height, _baked->components);
+		return;
+	}
+
+	uint8_t *data = nullptr;
+	if (_compressed)
+	{
+		// only needed while decoding
+		data = DecompressAsset(_data, _dataSize);
+		if (!data)
+		{
+			printf("Costume::Load: Failed to decompress %s\n", GetNameString());
+			return;
+		}
+	}
+
+	Decode(data ? data : _data);
+	free(data);
+
+	if (!_baked)
+		return;
+
+	// rendered by the compiler, unless its librsvg disagrees on the size
+	if (!_handle || _baked->width != (uint32_t)_svgWidth || _baked->height != (uint32_t)_svgHeight)
+	{
+		_baked = nullptr;
+		return;
+	}
+
+	_collisionMask = const_cast<uint8_t *>(_baked->data);
+}
+
+void Costume::Decode(const uint8_t *data)
 {
 	if (_dataFormat == "png" || _dataFormat == "jpg" || _dataFormat == "jpeg")
 	{
@@ -34,47 +105,29 @@ void Costume::Load()
 
 		// load image
 		int width, height, channels;
-		_bitmapData = stbi_load_from_memory(_data, _dataSize,
+		unsigned char *pixels = stbi_load_from_memory(data, _dataSize,
 			&width, &height, &channels, 0);
-		if (!_bitmapData)
+		if (!pixels)
 		{
-			printf("Costume::Load: Failed to load image %s\n", GetNameString());
+			printf("Costume::Decode: Failed to load image %s\n", GetNameString());
 			return;
 		}
 
 		if (channels != 3 && channels != 4)
 		{
-			printf("Costume::Load: Invalid number of channels %d\n", channels);
-			stbi_image_free(_bitmapData), _bitmapData = nullptr;
-			return;
-		}
-
-		_textures = (GLuint *)calloc(1, sizeof(GLuint));
-		if (!_textures)
-		{
-			printf("Costume::Load: Failed to allocate memory for texture\n");
+			printf("Costume::Decode: Invalid number of channels %d\n", channels);
+			stbi_image_free(pixels);
 			return;
 		}
 
-		_lodCount = 1;
-
-		_texWidth = width;
-		_texHeight = height;
-		_nComponents = channels;
-
-		_size = IntVector2(_texWidth, _texHeight);
-		_logicalSize = Vector2(_size) / static_cast<float>(_bitmapResolution);
-		_logicalCenter = Vector2(_center) / static_cast<float>(_bitmapResolution);
-
-		if (!_streamed)
-			Upload();
+		SetBitmap(pixels, width, height, channels);
 	}
 	else if (_dataFormat == "svg")
 	{
-		_handle = rsvg_handle_new_from_data(_data, _dataSize, NULL);
+		_handle = rsvg_handle_new_from_data(data, _dataSize, NULL);
 		if (!_handle)
 		{
-			printf("Costume::Load: Failed to load SVG %s\n", GetNameString());
+			printf("Costume::Decode: Failed to load SVG %s\n", GetNameString());
 			return;
 		}
 		
@@ -92,12 +145,48 @@ void Costume::Load()
 	}
 
 #if LS_DEBUG
-	printf("Costume::Load: Loaded %s\n", GetNameString());
+	printf("Costume::Decode: Loaded %s\n", GetNameString());
 #endif // LS_DEBUG
 }
 
+void Costume::SetBitmap(uint8_t *pixels, int width, int height, int channels)
+{
+	_bitmapData = pixels;
+
+	_textures = (GLuint *)calloc(1, sizeof(GLuint));
+	if (!_textures)
+	{
+		printf("Costume::SetBitmap: Failed to allocate memory for texture\n");
+		return;
+	}
+
+	_lodCount = 1;
+
+	_texWidth = width;
+	_texHeight = height;
+	_nComponents = channels;
+
+	_size = IntVector2(_texWidth, _texHeight);
+	_logicalSize = Vector2(_size) / static_cast<float>(_bitmapResolution);
+	_logicalCenter = Vector2(_center) / static_cast<float>(_bitmapResolution);
+
+	if (!_streamed)
+		Upload();
+}
+
+void Costume::SetSource(Costume *source)
+{
+	assert(!_loaded);
+	assert(source != this && source->_data == _data);
+
+	_source = source;
+}
+
 GLuint Costume::GetTexture(const Vector2 &scale)
 {
+	if (_source)
+		return _source->GetTexture(scale);
+
 	if (!_handle)
 	{
 		Upload();
@@ -144,6 +233,9 @@ bool Costume::CheckCollision(int32_t x, int32_t y)
 	if (x < 0 || y < 0 || x >= _size.x || y >= _size.y)
 		return false;
 
+	if (_source)
+		return _source->CheckCollision(x, y);
+
 	if (_nComponents != 4)
 		return true; // no alpha channel, assume all pixels are collidable
 
@@ -155,10 +247,12 @@ bool Costume::CheckCollision(int32_t x, int32_t y)
 
 Costume::Costume() :
 	_textures(nullptr), _lodCount(0),
-	_streamed(false), _uploaded(false), _uploadError(false),
+	_source(nullptr),
+	_streamed(false), _loaded(false), _uploaded(false), _uploadError(false),
 	_texWidth(0), _texHeight(0),
 	_bitmapResolution(0),
-	_data(nullptr), _dataSize(0),
+	_data(nullptr), _dataSize(0), _compressed(false),
+	_baked(nullptr),
 	_nComponents(0),
 	_collisionMask(nullptr)
 {
@@ -217,7 +311,7 @@ void Costume::Upload()
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
 
-	if (_collisionMask)
+	if (_collisionMask && !_baked)
 		stbi_image_free(_bitmapData), _bitmapData = nullptr; // no longer needed
 
 	_uploaded = true;
@@ -240,82 +334,91 @@ void Costume::Cleanup()
 	if (_handle)
 		g_object_unref(_handle), _handle = nullptr;
 
-	if (_bitmapData)
-		stbi_image_free(_bitmapData), _bitmapData = nullptr;
+	// baked data belongs to the program
+	if (_bitmapData && !_baked)
+		stbi_image_free(_bitmapData);
+	_bitmapData = nullptr;
+
+	if (_collisionMask && !_baked)
+		free(_collisionMask);
+	_collisionMask = nullptr;
 
-	if (_collisionMask)
-		free(_collisionMask), _collisionMask = nullptr;
+	_baked = nullptr;
 
 	_texWidth = _texHeight = 0;
 	_svgWidth = _svgHeight = 0;
 
+	_source = nullptr;
+
 	_streamed = false;
+	_loaded = false;
 	_uploaded = false;
 	_uploadError = false;
 
 	ReleaseValue(_name);
 }
 
+//! \brief Create a texture for an SVG LOD
+//!
+//! \param pixels The pixels, in premultiplied BGRA
+//! \param width The width of the LOD
+//! \param height The height of the LOD
+//!
+//! \return The texture
+static GLuint CreateLodTexture(const uint8_t *pixels, uint32_t width, uint32_t height)
+{
+	GLuint texture;
+	glGenTextures(1, &texture);
+	glBindTexture(GL_TEXTURE_2D, texture);
+
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_BGRA, GL_UNSIGNED_BYTE, pixels);
+
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+	return texture;
+}
+
 GLuint Costume::RenderLod(double scale)
 {
 	if (!_handle)
 		return 0; // not an SVG
 
-#if LS_DEBUG
-	printf("Costume::RenderLod: Rendering %s at scale %.2f\n", GetNameString(), scale);
-#endif // LS_DEBUG
-
 	uint32_t width = static_cast<uint32_t>(_svgWidth * scale);
 	uint32_t height = static_cast<uint32_t>(_svgHeight * scale);
 
-	// setup cairo surface
-	cairo_surface_t *surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, width, height);
-	if (cairo_surface_status(surface) != CAIRO_STATUS_SUCCESS)
+	if (_baked)
 	{
-		printf("Costume::RenderLod: Failed to create cairo surface\n");
-		return 0;
-	}
+		// LODs rendered by the compiler follow the collision mask
+		const uint8_t *pixels = _baked->data + (size_t)_svgWidth * _svgHeight;
+		for (uint32_t i = 0; i < _baked->lodCount; i++)
+		{
+			uint32_t lodWidth = _svgWidth << i;
+			uint32_t lodHeight = _svgHeight << i;
+			if (lodWidth == width && lodHeight == height)
+				return CreateLodTexture(pixels, width, height);
 
-	// create cairo context
-	cairo_t *cr = cairo_create(surface);
-	if (cairo_status(cr) != CAIRO_STATUS_SUCCESS)
-	{
-		printf("Costume::RenderLod: Failed to create cairo context\n");
-		cairo_surface_destroy(surface);
-		return 0;
+			pixels += (size_t)lodWidth * lodHeight * 4;
+		}
 	}
 
-	double scaleX = static_cast<double>(width) / _svgWidth;
-	double scaleY = static_cast<double>(height) / _svgHeight;
-	cairo_scale(cr, scaleX, -scaleY);
-	cairo_translate(cr, 0, -_svgHeight);
+#if LS_DEBUG
+	printf("Costume::RenderLod: Rendering %s at scale %.2f\n", GetNameString(), scale);
+#endif // LS_DEBUG
 
-	// render to cairo surface
-	if (!rsvg_handle_render_cairo(_handle, cr))
+	cairo_surface_t *surface = RenderSvg(_handle, _svgWidth, _svgHeight, scale, true);
+	if (!surface)
 	{
 		printf("Costume::RenderLod: Failed to render SVG %s\n", GetNameString());
-		cairo_destroy(cr);
-		cairo_surface_destroy(surface);
 		return 0;
 	}
 
-	unsigned char *data = cairo_image_surface_get_data(surface);
-
-	GLuint texture;
-	glGenTextures(1, &texture);
-	glBindTexture(GL_TEXTURE_2D, texture);
-
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_BGRA, GL_UNSIGNED_BYTE, data);
-
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	GLuint texture = CreateLodTexture(cairo_image_surface_get_data(surface), width, height);
 
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-	// cleanup surface and context
 	cairo_surface_destroy(surface);
-	cairo_destroy(cr);
 
 	return texture;
 }
@@ -335,53 +438,24 @@ bool Costume::GenerateCollisionMask()
 
 	if (_handle)
 	{
-		// setup cairo surface
-		cairo_surface_t *surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, _svgWidth, _svgHeight);
-		if (cairo_surface_status(surface) != CAIRO_STATUS_SUCCESS)
-		{
-			printf("Costume::GenerateSVGCollisionMask: Failed to create cairo surface\n");
-			return false;
-		}
-
-		// create cairo context
-		cairo_t *cr = cairo_create(surface);
-		if (cairo_status(cr) != CAIRO_STATUS_SUCCESS)
-		{
-			printf("Costume::GenerateSVGCollisionMask: Failed to create cairo context\n");
-			cairo_surface_destroy(surface);
-			return false;
-		}
-
-		// render to cairo surface
-		if (!rsvg_handle_render_cairo(_handle, cr))
+		cairo_surface_t *surface = RenderSvg(_handle, _svgWidth, _svgHeight, 1.0, false);
+		if (!surface)
 		{
 			printf("Costume::GenerateSVGCollisionMask: Failed to render SVG %s\n", GetNameString());
-			cairo_destroy(cr);
-			cairo_surface_destroy(surface);
 			return false;
 		}
 
-		unsigned char *data = cairo_image_surface_get_data(surface);
-
 		_collisionMask = (uint8_t *)malloc(size);
 		if (!_collisionMask)
 		{
 			printf("Costume::GenerateSVGCollisionMask: Failed to allocate memory for collision mask\n");
 			cairo_surface_destroy(surface);
-			cairo_destroy(cr);
 			return false;
 		}
 
-		// generate collision mask
-		for (size_t i = 0; i < size; i++)
-		{
-			unsigned char *pixel = data + i * 4;
-			_collisionMask[i] = pixel[3] >= MASK_THRESHOLD;
-		}
+		GenerateMask(cairo_image_surface_get_data(surface), _size.x, _size.y, false, _collisionMask);
 
-		// cleanup surface and context
 		cairo_surface_destroy(surface);
-		cairo_destroy(cr);
 	}
 	else
 	{
@@ -398,17 +472,7 @@ bool Costume::GenerateCollisionMask()
 			return false;
 		}
 
-		// generate collision mask
-		for (size_t y = 0; y < _size.y; y++)
-		{
-			size_t srcOff = y * _size.x;
-			size_t dstOff = (_size.y - y - 1) * _size.x; // flip y
-			for (size_t x = 0; x < _size.x; x++)
-			{
-				unsigned char *pixel = _bitmapData + (srcOff + x) * 4;
-				_collisionMask[dstOff + x] = pixel[3] >= MASK_THRESHOLD;
-			}
-		}
+		GenerateMask(_bitmapData, _size.x, _size.y, true, _collisionMask);
 
 		if (_uploaded)
 			stbi_image_free(_bitmapData), _bitmapData = nullptr; // no longer needed
@@ -416,3 +480,65 @@ bool Costume::GenerateCollisionMask()
 
 	return true;
 }
+
+cairo_surface_t *RenderSvg(RsvgHandle *handle, int width, int height, double scale, bool flip)
+{
+	int scaledWidth = static_cast<int>(width * scale);
+	int scaledHeight = static_cast<int>(height * scale);
+
+	// setup cairo surface
+	cairo_surface_t *surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, scaledWidth, scaledHeight);
+	if (cairo_surface_status(surface) != CAIRO_STATUS_SUCCESS)
+	{
+		printf("RenderSvg: Failed to create cairo surface\n");
+		cairo_surface_destroy(surface);
+		return nullptr;
+	}
+
+	// create cairo context
+	cairo_t *cr = cairo_create(surface);
+	if (cairo_status(cr) != CAIRO_STATUS_SUCCESS)
+	{
+		printf("RenderSvg: Failed to create cairo context\n");
+		cairo_destroy(cr);
+		cairo_surface_destroy(surface);
+		return nullptr;
+	}
+
+	double scaleX = static_cast<double>(scaledWidth) / width;
+	double scaleY = static_cast<double>(scaledHeight) / height;
+	if (flip)
+	{
+		cairo_scale(cr, scaleX, -scaleY);
+		cairo_translate(cr, 0, -height);
+	}
+	else
+		cairo_scale(cr, scaleX, scaleY);
+
+	// render to cairo surface
+	if (!rsvg_handle_render_cairo(handle, cr))
+	{
+		cairo_destroy(cr);
+		cairo_surface_destroy(surface);
+		return nullptr;
+	}
+
+	cairo_destroy(cr);
+	cairo_surface_flush(surface);
+
+	return surface;
+}
+
+void GenerateMask(const uint8_t *pixels, size_t width, size_t height, bool flip, uint8_t *mask)
+{
+	for (size_t y = 0; y < height; y++)
+	{
+		size_t srcOff = y * width;
+		size_t dstOff = (flip ? height - y - 1 : y) * width;
+		for (size_t x = 0; x < width; x++)
+		{
+			const uint8_t *pixel = pixels + (srcOff + x) * 4;
+			mask[dstOff + x] = pixel[3] >= MASK_THRESHOLD;
+		}
+	}
+}
@@ -4,6 +4,7 @@
 #include <cstdint>
 
 #include <glad/glad.h>
+#include <cairo/cairo.h>
 #include <librsvg/rsvg.h>
 #include <mutil/mutil.h>
 
@@ -15,6 +16,27 @@
 
 using namespace mutil;
 
+//! \brief Render an SVG
+//!
+//! \param handle The SVG
+//! \param width The width of the SVG, in pixels
+//! \param height The height of the SVG, in pixels
+//! \param scale The scale to render at
+//! \param flip Whether to flip the image vertically, as textures are
+//!
+//! \return A premultiplied ARGB32 surface of the scaled size, or
+//! nullptr if the SVG could not be rendered
+cairo_surface_t *RenderSvg(RsvgHandle *handle, int width, int height, double scale, bool flip);
+
+//! \brief Generate a collision mask
+//!
+//! \param pixels The pixels, 4 components each with alpha last
+//! \param width The width of the image
+//! \param height The height of the image
+//! \param flip Whether the rows of pixels are stored bottom-up
+//! \param mask Receives width * height mask values, top row first
+void GenerateMask(const uint8_t *pixels, size_t width, size_t height, bool flip, uint8_t *mask);
+
 //! \brief A costume (skin) for a sprite
 class Costume
 {
@@ -74,9 +96,22 @@ public:
 	//! \brief Load the costumes
 	//!
 	//! Loads any necessary data for the costume, such as the texture or SVG data.
+	//! Does nothing if the costume is already loaded.
 	void Load();
 
-	constexpr bool IsBitmap() const { return _handle == nullptr; }
+	//! \brief Share the decoded data of another costume
+	//!
+	//! Costumes with the same data share a single copy of the texture,
+	//! SVG and collision mask. Must be called after Init and before Load.
+	//!
+	//! \param source A costume with the same data, which must outlive
+	//! this costume
+	void SetSource(Costume *source);
+
+	constexpr const uint8_t *GetData() const { return _data; }
+	constexpr uint64_t GetDataSize() const { return _dataSize; }
+
+	constexpr bool IsBitmap() const { return _source ? _source->IsBitmap() : _handle == nullptr; }
 
 	Costume &operator=(const Costume &) = delete;
 	Costume &operator=(Costume &&) = delete;
@@ -91,7 +126,10 @@ private:
 	GLuint *_textures; // texture ids for each LOD, bitmaps have only one LOD
 	GLsizei _lodCount; // number of LODs
 
+	Costume *_source; // costume holding the decoded data, null if this costume holds it
+
 	bool _streamed; // whether the costume is streamed
+	bool _loaded; // whether the costume is loaded
 	bool _uploaded; // whether the costume is uploaded
 	bool _uploadError; // whether the costume failed to upload
 
@@ -116,12 +154,27 @@ private:
 	// data
 	std::string _dataFormat; // "svg", "png", etc.
 	uint8_t *_data;
-	uint64_t _dataSize;
+	uint64_t _dataSize; // size of the uncompressed data
+	bool _compressed; // whether _data is a bc::CompressedData
+	const bc::BakedCostume *_baked; // decoded data in the program, null if not baked
 
 	int _nComponents; // number of components in the bitmap data
 
 	uint8_t *_collisionMask; // collision mask for the costume
 
+	//! \brief Decode the costume data
+	//!
+	//! \param data The uncompressed costume data, only used during the call
+	void Decode(const uint8_t *data);
+
+	//! \brief Use a decoded bitmap
+	//!
+	//! \param pixels The pixels, owned by the costume unless baked
+	//! \param width The width of the bitmap
+	//! \param height The height of the bitmap
+	//! \param channels The number of components per pixel
+	void SetBitmap(uint8_t *pixels, int width, int height, int channels);
+
 	void Upload();
 
 	void Cleanup();
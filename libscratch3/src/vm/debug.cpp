@@ -177,6 +177,18 @@ void Debugger::Render()
 				ImGui::LabelText("Running", "%d", VM->_activeScripts);
 				ImGui::LabelText("Waiting", "%d", VM->_waitingScripts);
 
+				constexpr double kBytesToKiB = 1.0 / 1024;
+
+				const HeapStats &heap = VM->GetHeap();
+				ImGui::SeparatorText("Heap");
+				ImGui::LabelText("Used", "%.1f KiB", heap.used * kBytesToKiB);
+				ImGui::LabelText("Peak", "%.1f KiB", heap.peak * kBytesToKiB);
+				if (heap.limit)
+					ImGui::LabelText("Limit", "%.1f KiB", heap.limit * kBytesToKiB);
+				else
+					ImGui::LabelText("Limit", "None");
+				ImGui::LabelText("Denied", "%lld", heap.failures);
+
 				ImGui::SeparatorText("Global Variables");
 				uint8_t *bytecode = VM->GetBytecode();
 				bc::Header *header = (bc::Header *)bytecode;
@@ -211,7 +223,8 @@ void Debugger::Render()
 						ImGui::LabelText(name, "\"%s\"", v.u.string->str);
 						break;
 					case ValueType_List:
-						ImGui::LabelText(name, "<list> (length: %lld)", v.u.list->len);
+						ImGui::LabelText(name, "<list> (length: %lld%s)", v.u.list->len,
+							(v.u.list->ref.flags & LIST_PACKED) ? ", packed" : "");
 						break;
 					case ValueType_IntPtr:
 						ImGui::LabelText(name, "<intptr>: 0x%X", v.u.intptr);
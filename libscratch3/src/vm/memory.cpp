@@ -1,4 +1,5 @@
 #include "memory.hpp"
+#include "strkernel.hpp"
 
 #include <cmath>
 #include <cassert>
@@ -11,54 +12,344 @@
 #define TRUE_SIZE (sizeof(TRUE_STRING) - 1)
 #define FALSE_SIZE (sizeof(FALSE_STRING) - 1)
 
-bool StringEqualsRaw(const char *lstr, const char *rstr)
+// size of the allocation of a string with the given capacity
+#define STRING_SIZE(capacity) (offsetof(String, str) + (capacity) + 1)
+
+//! \brief Check that an allocation fits within the heap limit
+//!
+//! Raises OutOfMemory in the running script if it does not. Nothing
+//! is accounted until HeapAdd is called.
+//!
+//! \param heap Heap the allocation is accounted against, may be null
+//! \param size Size of the allocation in bytes
+//!
+//! \return true if the allocation may proceed
+static inline bool HeapReserve(HeapStats *heap, int64_t size)
+{
+	if (!heap || !heap->limit || heap->used + size <= heap->limit)
+		return true;
+
+	heap->failures++;
+	HeapLimitExceeded(heap, size);
+	return false;
+}
+
+//! \brief Check that an optional allocation fits within the heap limit
+//!
+//! Unlike HeapReserve, never raises an exception.
+static inline bool HeapFits(HeapStats *heap, int64_t size)
 {
-	while (*lstr && *rstr)
+	return !heap || !heap->limit || heap->used + size <= heap->limit;
+}
+
+//! \brief Account for allocated memory
+static inline void HeapAdd(HeapStats *heap, int64_t size)
+{
+	if (heap)
 	{
-		if (tolower(*lstr) != tolower(*rstr))
-			return false;
+		heap->used += size;
+		if (heap->used > heap->peak)
+			heap->peak = heap->used;
+	}
+}
 
-		lstr++;
-		rstr++;
+//! \brief Account for freed memory
+static inline void HeapSub(HeapStats *heap, int64_t size)
+{
+	if (heap)
+		heap->used -= size;
+}
+
+//! \brief Store a packed number into a value
+//!
+//! Only integers and reals that are not whole numbers are packed, see
+//! IsPackable, so the value has the type it was stored with.
+static inline Value &UnpackNumber(Value &v, double d)
+{
+	if (IsPackedInteger(d))
+		return SetInteger(v, static_cast<int64_t>(d));
+	return SetReal(v, d);
+}
+
+//! \brief Header of the storage array of a list
+//!
+//! Storage is shared between lists by ValueDeepCopy and is copied when
+//! one of the lists sharing it is modified.
+struct ListStorage
+{
+	int64_t count; // number of lists sharing the storage
+	int64_t size; // size of the allocation in bytes
+	HeapStats *heap; // heap the storage is accounted against (may be null)
+};
+
+//! \brief Allocate storage for a list
+//!
+//! \param capacity The number of elements
+//! \param elemSize The size of an element
+//!
+//! \return The element array, or nullptr if allocation failed
+static void *ListStorageAlloc(int64_t capacity, size_t elemSize)
+{
+	HeapStats *heap = GetCurrentHeap();
+	int64_t size = sizeof(ListStorage) + capacity * elemSize;
+	if (!HeapReserve(heap, size))
+		return nullptr;
+
+	ListStorage *storage = (ListStorage *)calloc(1, size);
+	if (!storage)
+		return nullptr;
+
+	HeapAdd(heap, size);
+
+	storage->count = 1;
+	storage->size = size;
+	storage->heap = heap;
+	return storage + 1;
+}
+
+//! \brief Get the storage header of an element array
+static inline ListStorage *ListStorageOf(void *elements)
+{
+	return (ListStorage *)elements - 1;
+}
+
+//! \brief Free an element array allocated with ListStorageAlloc
+static inline void ListStorageFree(void *elements)
+{
+	ListStorage *storage = ListStorageOf(elements);
+	HeapSub(storage->heap, storage->size);
+	free(storage);
+}
+
+//! \brief Check whether a list shares its storage with another list
+static inline bool ListShared(const List *l)
+{
+	return ListStorageOf(l->values)->count > 1;
+}
+
+//! \brief Translate a list position to a storage slot
+//!
+//! Lists are ring buffers, the first element is stored at List::head
+//! and elements wrap around the end of the storage array.
+//!
+//! \param l The list
+//! \param i Zero-based position of the element
+//!
+//! \return Index of the element in the storage array
+static inline int64_t ListSlot(const List *l, int64_t i)
+{
+	int64_t slot = l->head + i;
+	return slot >= l->capacity ? slot - l->capacity : slot;
+}
+
+//! \brief Get the size of an element in the storage array of a list
+static inline size_t ListElementSize(const List *l)
+{
+	return (l->ref.flags & LIST_PACKED) ? sizeof(double) : sizeof(Value);
+}
+
+//! \brief Get a pointer to an element in the storage array of a list
+static inline uint8_t *ListSlotPtr(List *l, int64_t i)
+{
+	return (uint8_t *)l->values + ListSlot(l, i) * ListElementSize(l);
+}
+
+//! \brief Get an element of a list
+//!
+//! \param l The list
+//! \param i Zero-based position of the element
+//! \param tmp Storage for unpacked elements, must not hold a reference
+//!
+//! \return The element, either in the list or in tmp
+static inline const Value &ListElement(const List *l, int64_t i, Value &tmp)
+{
+	if (l->ref.flags & LIST_PACKED)
+	{
+		InitializeValue(tmp);
+		return UnpackNumber(tmp, l->numbers[ListSlot(l, i)]);
 	}
 
-	return *lstr == *rstr;
+	return l->values[ListSlot(l, i)];
 }
 
-bool StringEquals(const char *lstr, const char *rstr)
+//! \brief Convert a packed list to generic storage
+//!
+//! \param l The list
+//!
+//! \return true on success, false if allocation failed
+static bool ListUnpack(List *l)
 {
-	if (lstr == rstr)
+	if (!(l->ref.flags & LIST_PACKED))
 		return true;
 
-	const char *lstart = lstr;
-	while (*lstart && isspace(*lstart))
-		lstart++;
+	assert(!ListShared(l));
 
-	const char *lend = lstart;
-	while (*lend && !isspace(*lend))
-		lend++;
+	Value *values = (Value *)ListStorageAlloc(l->capacity, sizeof(Value));
+	if (!values)
+		return false;
 
-	const char *rstart = rstr;
-	while (*rstart && isspace(*rstart))
-		rstart++;
+	for (int64_t i = 0; i < l->len; i++)
+	{
+		InitializeValue(values[i]);
+		UnpackNumber(values[i], l->numbers[ListSlot(l, i)]);
+	}
 
-	const char *rend = rstart;
-	while (*rend && !isspace(*rend))
-		rend++;
+	ListStorageFree(l->numbers);
+	l->values = values;
+	l->head = 0;
+	l->ref.flags &= ~LIST_PACKED;
+
+	return true;
+}
+
+//! \brief Release the storage of a list
+//!
+//! The elements are only released if no other list shares them.
+//!
+//! \param l The list
+static void ListReleaseStorage(List *l)
+{
+	ListStorage *storage = ListStorageOf(l->values);
+	if (--storage->count > 0)
+		return;
+
+	if (!(l->ref.flags & LIST_PACKED))
+	{
+		for (int64_t i = 0; i < l->len; i++)
+			ReleaseValue(l->values[ListSlot(l, i)]);
+	}
 
-	if (lend - lstart != rend - rstart)
+	ListStorageFree(l->values);
+}
+
+//! \brief Give a list its own copy of shared storage
+//!
+//! Must be called before a list is modified.
+//!
+//! \param l The list
+//!
+//! \return true on success, false if allocation failed
+static bool ListDetach(List *l)
+{
+	if (!ListShared(l))
+		return true;
+
+	bool packed = l->ref.flags & LIST_PACKED;
+
+	void *elements = ListStorageAlloc(l->capacity, packed ? sizeof(double) : sizeof(Value));
+	if (!elements)
 		return false;
 
-	size_t len = lend - lstart;
-	for (size_t i = 0; i < len; i++)
+	if (packed)
 	{
-		if (tolower(lstart[i]) != tolower(rstart[i]))
-			return false;
+		double *numbers = (double *)elements;
+		for (int64_t i = 0; i < l->len; i++)
+			numbers[i] = l->numbers[ListSlot(l, i)];
+	}
+	else
+	{
+		Value *values = (Value *)elements;
+		for (int64_t i = 0; i < l->len; i++)
+		{
+			InitializeValue(values[i]);
+			Assign(values[i], l->values[ListSlot(l, i)]);
+		}
 	}
 
+	// the index only holds positions, so it is still valid
+	ListStorageOf(l->values)->count--;
+	l->values = (Value *)elements;
+	l->head = 0;
+
 	return true;
 }
 
+bool StringEqualsRaw(const char *lstr, const char *rstr)
+{
+	size_t len = strlen(lstr);
+	if (strlen(rstr) != len)
+		return false;
+	return StrEqualsFold(lstr, rstr, len);
+}
+
+//! \brief Compare spans with Scratch semantics
+//!
+//! \param lstr The left span
+//! \param llen The length of the left span
+//! \param rstr The right span
+//! \param rlen The length of the right span
+//!
+//! \return true if the spans are equal, ignoring case and leading and
+//! trailing whitespace
+static bool StringSpanEquals(const char *lstr, size_t llen, const char *rstr, size_t rlen)
+{
+	const char *lend = lstr + llen;
+	const char *rend = rstr + rlen;
+
+	StrTrim(lstr, lend);
+	StrTrim(rstr, rend);
+
+	if (lend - lstr != rend - rstr)
+		return false;
+	return StrEqualsFold(lstr, rstr, lend - lstr);
+}
+
+bool StringEquals(const char *lstr, const char *rstr)
+{
+	if (lstr == rstr)
+		return true;
+	return StringSpanEquals(lstr, strlen(lstr), rstr, strlen(rstr));
+}
+
+//! \brief Finalize a 64-bit hash
+static inline uint64_t MixHash(uint64_t h)
+{
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdull;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ull;
+	h ^= h >> 33;
+	return h;
+}
+
+static inline uint64_t HashNumber(double d)
+{
+	if (d == 0.0)
+		d = 0.0; // -0 == 0
+
+	uint64_t bits;
+	memcpy(&bits, &d, sizeof(bits));
+	return MixHash(bits);
+}
+
+uint64_t HashValue(const Value &v)
+{
+	double d;
+
+	switch (v.type)
+	{
+	default:
+	case ValueType_None:
+		return 0;
+	case ValueType_Integer:
+	case ValueType_Real:
+	case ValueType_Bool:
+		return HashNumber(ToReal(v));
+	case ValueType_String: {
+		if (StringToNumber(v.u.string, &d))
+			return HashNumber(d);
+
+		// same normalization as StringEquals
+		const char *begin = v.u.string->str;
+		const char *end = begin + v.u.string->len;
+		StrTrim(begin, end);
+		return StrHashFold(begin, end - begin);
+	}
+	case ValueType_List:
+		return MixHash(v.u.list->len);
+	}
+}
+
 bool Truth(const Value &val)
 {
 	switch (val.type)
@@ -89,6 +380,8 @@ bool Equals(const Value &lhs, const Value &rhs)
 			return lhs.u.integer == rhs.u.real;
 		if (rhs.type == ValueType_Bool)
 			return rhs.u.boolean ? lhs.u.integer == 1 : lhs.u.integer == 0;
+		if (rhs.type == ValueType_String)
+			return Equals(rhs, lhs);
 		return false;
 	case ValueType_Real:
 		if (rhs.type == ValueType_Real)
@@ -97,6 +390,8 @@ bool Equals(const Value &lhs, const Value &rhs)
 			return lhs.u.real == rhs.u.integer;
 		if (rhs.type == ValueType_Bool)
 			return rhs.u.boolean ? lhs.u.real == 1.0 : lhs.u.real == 0.0;
+		if (rhs.type == ValueType_String)
+			return Equals(rhs, lhs);
 		return false;
 	case ValueType_Bool:
 		if (rhs.type == ValueType_Bool)
@@ -106,10 +401,22 @@ bool Equals(const Value &lhs, const Value &rhs)
 		else if (rhs.type == ValueType_Real)
 			return lhs.u.boolean ? 1.0 == rhs.u.real : 0.0 == rhs.u.real;
 		return false;
-	case ValueType_String:
-		if (rhs.type == ValueType_String && lhs.u.string->hash == rhs.u.string->hash)
-			return StringEquals(lhs.u.string->str, rhs.u.string->str);
-		return false;
+	case ValueType_String: {
+		double a, b;
+		if (rhs.type == ValueType_Integer || rhs.type == ValueType_Real)
+			return StringToNumber(lhs.u.string, &a) && a == ToReal(rhs);
+
+		if (rhs.type != ValueType_String)
+			return false;
+
+		if (StringToNumber(lhs.u.string, &a) && StringToNumber(rhs.u.string, &b))
+			return a == b;
+
+		if (lhs.u.string == rhs.u.string)
+			return true;
+
+		return StringSpanEquals(lhs.u.string->str, lhs.u.string->len, rhs.u.string->str, rhs.u.string->len);
+	}
 	case ValueType_List:
 		if (rhs.type != ValueType_List)
 			return false;
@@ -122,7 +429,8 @@ bool Equals(const Value &lhs, const Value &rhs)
 
 		for (int64_t i = 0; i < lhs.u.list->len; i++)
 		{
-			if (!Equals(lhs.u.list->values[i], rhs.u.list->values[i]))
+			Value ltmp, rtmp;
+			if (!Equals(ListElement(lhs.u.list, i, ltmp), ListElement(rhs.u.list, i, rtmp)))
 				return false;
 		}
 
@@ -168,11 +476,7 @@ Value &SetChar(Value &lhs, char c)
 	if (c == 0)
 		return SetEmpty(lhs);
 
-	AllocString(lhs, 1);
-	if (lhs.type != ValueType_String)
-		return SetEmpty(lhs);
-	lhs.u.string->str[0] = c;
-	return lhs;
+	return SetString(lhs, &c, 1);
 }
 
 Value &SetString(Value &lhs, const char *rhs, size_t len)
@@ -186,6 +490,7 @@ Value &SetString(Value &lhs, const char *rhs, size_t len)
 
 	memcpy(lhs.u.string->str, rhs, len);
 	lhs.u.string->hash = HashString(lhs.u.string->str);
+	CacheStringAscii(lhs.u.string);
 	return lhs;
 }
 
@@ -208,81 +513,452 @@ Value &SetStaticString(Value &lhs, String *rhs)
 	return lhs;
 }
 
-static std::string Trim(const std::string &str, const std::string &ws = " \t\n\r")
+//! \brief Strip leading and trailing whitespace from a span
+static inline void TrimSpan(const char *&begin, const char *&end)
 {
-	size_t start = str.find_first_not_of(ws);
-	if (start == std::string::npos)
-		return "";
-
-	size_t end = str.find_last_not_of(ws);
-	return str.substr(start, end - start + 1);
+	StrTrim(begin, end);
 }
 
-static int ParseString(Value &lhs, const std::string &rhs)
+// exactly representable powers of 10
+static const double kPowersOf10[] = {
+	1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+	1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+//! \brief Scan a number with Scratch semantics
+//!
+//! \param str The string to scan, need not be null-terminated
+//! \param len The length of the string
+//! \param real Receives the value of the number, or 0 if invalid
+//! \param integer Receives the value of the number if it is an integer
+//! \param isInteger Set to true if the number is a decimal integer that
+//! fits in an int64_t
+//!
+//! \return true if the whole string is a valid number
+static bool ScanNumber(const char *str, int64_t len, double *real, int64_t *integer, bool *isInteger)
 {
-	std::string str = Trim(rhs);
-	if (str.size() != 0)
+	const char *p = str;
+	const char *end = str + len;
+
+	*real = 0.0;
+	*isInteger = false;
+
+	TrimSpan(p, end);
+	if (p == end)
+		return false;
+
+	// hexadecimal, octal and binary literals (unsigned only)
+	if (end - p > 2 && p[0] == '0')
 	{
-		char *end;
+		int base = 0;
+		switch (p[1])
+		{
+		case 'x':
+		case 'X':
+			base = 16;
+			break;
+		case 'o':
+		case 'O':
+			base = 8;
+			break;
+		case 'b':
+		case 'B':
+			base = 2;
+			break;
+		}
 
-		int64_t integer = strtoll(str.c_str(), &end, 10);
-		if (*end == 0)
+		if (base != 0)
 		{
-			SetInteger(lhs, integer);
-			return ValueType_Integer;
+			double v = 0.0;
+			for (const char *q = p + 2; q < end; q++)
+			{
+				int d;
+				if (*q >= '0' && *q <= '9')
+					d = *q - '0';
+				else if (*q >= 'a' && *q <= 'f')
+					d = *q - 'a' + 10;
+				else if (*q >= 'A' && *q <= 'F')
+					d = *q - 'A' + 10;
+				else
+					return false;
+
+				if (d >= base)
+					return false;
+
+				v = v * base + d;
+			}
+
+			*real = v;
+			return true;
 		}
+	}
+
+	bool negative = false;
+	if (*p == '+' || *p == '-')
+		negative = *p++ == '-';
+
+	if (end - p == 8 && !memcmp(p, "Infinity", 8))
+	{
+		*real = negative ? -INFINITY : INFINITY;
+		return true;
+	}
+
+	const char *start = p;
+
+	uint64_t mantissa = 0;
+	int digits = 0; // significant digits in mantissa
+	int64_t exponent = 0;
+	bool hasDigits = false;
+	bool exact = true; // no digits were dropped
+	bool isDecimal = false; // has a fraction or exponent
+
+	for (; p < end && (unsigned)(*p - '0') < 10; p++)
+	{
+		int d = *p - '0';
+		hasDigits = true;
 
-		double real = strtod(str.c_str(), &end);
-		if (*end == 0)
+		if (digits < 19)
 		{
-			SetReal(lhs, real);
-			return ValueType_Real;
+			mantissa = mantissa * 10 + d;
+			if (mantissa)
+				digits++;
 		}
+		else
+		{
+			exponent++;
+			if (d) exact = false;
+		}
+	}
 
-		if (str.size() == 4)
+	if (p < end && *p == '.')
+	{
+		isDecimal = true;
+		for (p++; p < end && (unsigned)(*p - '0') < 10; p++)
 		{
-			size_t i;
-			for (i = 0; i < 4; i++)
-				if (tolower(str[i]) != TRUE_STRING[i])
-					break;
+			int d = *p - '0';
+			hasDigits = true;
 
-			if (i == 4)
+			if (digits < 19)
 			{
-				SetBool(lhs, true);
-				return ValueType_Bool;
+				mantissa = mantissa * 10 + d;
+				if (mantissa)
+					digits++;
+				exponent--;
 			}
+			else if (d)
+				exact = false;
 		}
+	}
 
-		if (str.size() == 5)
+	if (!hasDigits)
+		return false;
+
+	if (p < end && (*p == 'e' || *p == 'E'))
+	{
+		isDecimal = true;
+		p++;
+
+		bool negExp = false;
+		if (p < end && (*p == '+' || *p == '-'))
+			negExp = *p++ == '-';
+
+		if (p == end || (unsigned)(*p - '0') >= 10)
+			return false;
+
+		int64_t e = 0;
+		for (; p < end && (unsigned)(*p - '0') < 10; p++)
 		{
-			size_t i;
-			for (i = 0; i < 5; i++)
-				if (tolower(str[i]) != FALSE_STRING[i])
-					break;
+			if (e < 100000)
+				e = e * 10 + (*p - '0');
+		}
 
-			if (i == 5)
-			{
-				SetBool(lhs, false);
-				return ValueType_Bool;
-			}
+		exponent += negExp ? -e : e;
+	}
+
+	if (p != end)
+		return false;
+
+	if (!isDecimal && exact && exponent == 0 && mantissa <= INT64_MAX)
+	{
+		*isInteger = true;
+		*integer = negative ? -(int64_t)mantissa : (int64_t)mantissa;
+	}
+
+	double v;
+	if (mantissa == 0)
+		v = 0.0;
+	else if (exact && mantissa <= (1ull << 53) && exponent >= -22 && exponent <= 22)
+	{
+		// both operands are exact, so the result is correctly rounded
+		v = static_cast<double>(mantissa);
+		v = exponent < 0 ? v / kPowersOf10[-exponent] : v * kPowersOf10[exponent];
+	}
+	else
+	{
+		// slow path, copy to the stack so strtod sees a terminated string
+		char buf[128];
+		size_t n = end - start;
+		if (n < sizeof(buf))
+		{
+			memcpy(buf, start, n);
+			buf[n] = 0;
+			v = strtod(buf, nullptr);
 		}
+		else
+			v = static_cast<double>(mantissa) * pow(10.0, static_cast<double>(exponent));
+	}
+
+	*real = negative ? -v : v;
+	return true;
+}
+
+bool ParseNumber(const char *str, int64_t len, double *result)
+{
+	int64_t integer;
+	bool isInteger;
+	return ScanNumber(str, len, result, &integer, &isInteger);
+}
+
+bool StringToNumber(const String *s, double *result)
+{
+	if (!(s->ref.flags & STRING_NUMBER_CACHED))
+	{
+		if (s->ref.flags & VALUE_STATIC)
+			return ParseNumber(s->str, s->len, result); // may be read-only
+		CacheStringNumber(const_cast<String *>(s));
+	}
+
+	*result = s->number;
+	return (s->ref.flags & STRING_NUMBER_VALID) != 0;
+}
+
+void CacheStringNumber(String *s)
+{
+	double number;
+	bool valid = ParseNumber(s->str, s->len, &number);
+
+	s->number = number;
+	s->ref.flags &= ~STRING_NUMBER_VALID;
+	s->ref.flags |= STRING_NUMBER_CACHED | (valid ? STRING_NUMBER_VALID : 0);
+}
+
+//! \brief Offsets of the code points in a non-ASCII string
+struct StringIndex
+{
+	int64_t chars; // number of code points in the string
+	int64_t size; // size of the allocation in bytes
+	int64_t offsets[1]; // byte offset of every STRING_INDEX_STRIDE-th code point
+};
+
+void CacheStringAscii(String *s)
+{
+	bool ascii = StrIsAscii(s->str, s->len);
+
+	s->ref.flags &= ~STRING_ASCII;
+	s->ref.flags |= STRING_ASCII_CACHED | (ascii ? STRING_ASCII : 0);
+}
+
+//! \brief Check whether a string only contains ASCII characters
+//!
+//! \param s The string
+//!
+//! \return true if the string only contains ASCII characters
+static bool StringIsAscii(const String *s)
+{
+	if (!(s->ref.flags & STRING_ASCII_CACHED))
+	{
+		if (s->ref.flags & VALUE_STATIC)
+			return StrIsAscii(s->str, s->len); // may be read-only
+		CacheStringAscii(const_cast<String *>(s));
+	}
+
+	return (s->ref.flags & STRING_ASCII) != 0;
+}
+
+//! \brief Skip to the start of the next code point
+//!
+//! \param s The string
+//! \param pos Position to start from
+//!
+//! \return The position of the first code point start after pos, or
+//! the length of the string if there is none
+static inline int64_t NextCodePoint(const String *s, int64_t pos)
+{
+	for (pos++; pos < s->len && !IsCodePointStart(s->str[pos]); pos++)
+		;
+	return pos;
+}
+
+//! \brief Get the offset index of a string, building it if necessary
+//!
+//! \param s The string
+//!
+//! \return The index, or nullptr if the string is static or the index
+//! could not be allocated
+static StringIndex *StringGetIndex(const String *s)
+{
+	if (s->index)
+		return s->index;
+
+	if (s->ref.flags & VALUE_STATIC)
+		return nullptr; // may be read-only
+
+	int64_t chars = StrCountCodePoints(s->str, s->len);
+	int64_t size = offsetof(StringIndex, offsets) + (chars / STRING_INDEX_STRIDE + 1) * sizeof(int64_t);
+	if (!HeapFits(s->heap, size))
+		return nullptr;
+
+	StringIndex *index = (StringIndex *)malloc(size);
+	if (!index)
+		return nullptr;
+
+	HeapAdd(s->heap, size);
+
+	index->chars = chars;
+	index->size = size;
+	index->offsets[chars / STRING_INDEX_STRIDE] = s->len;
+
+	int64_t n = 0;
+	for (int64_t i = 0; i < s->len; i++)
+	{
+		if (!IsCodePointStart(s->str[i]))
+			continue;
+
+		if (n % STRING_INDEX_STRIDE == 0)
+			index->offsets[n / STRING_INDEX_STRIDE] = i;
+		n++;
+	}
+
+	const_cast<String *>(s)->index = index;
+	return index;
+}
+
+//! \brief Free the offset index of a string
+//!
+//! \param s The string
+static void StringDropIndex(String *s)
+{
+	if (!s->index)
+		return;
+
+	HeapSub(s->heap, s->index->size);
+	free(s->index);
+	s->index = nullptr;
+}
+
+//! \brief Find the bytes of a code point in a string
+//!
+//! \param s The string
+//! \param index The 0-based index of the code point
+//! \param begin Receives the offset of the code point
+//! \param end Receives the offset after the code point
+//!
+//! \return true if the code point exists, false if index is out of range
+static bool StringCodePoint(const String *s, int64_t index, int64_t *begin, int64_t *end)
+{
+	if (index < 0)
+		return false;
+
+	if (StringIsAscii(s))
+	{
+		if (index >= s->len)
+			return false;
+
+		*begin = index;
+		*end = index + 1;
+		return true;
+	}
+
+	int64_t pos;
+	StringIndex *si = StringGetIndex(s);
+	if (si)
+	{
+		if (index >= si->chars)
+			return false;
+
+		pos = si->offsets[index / STRING_INDEX_STRIDE];
+		index %= STRING_INDEX_STRIDE;
+	}
+	else
+	{
+		// no index, scan from the first code point
+		pos = IsCodePointStart(s->str[0]) ? 0 : NextCodePoint(s, 0);
+	}
+
+	for (; index > 0 && pos < s->len; index--)
+		pos = NextCodePoint(s, pos);
+
+	if (pos >= s->len)
+		return false;
+
+	*begin = pos;
+	*end = NextCodePoint(s, pos);
+	return true;
+}
+
+static int ParseString(Value &lhs, const char *rhs, size_t len)
+{
+	double real;
+	int64_t integer;
+	bool isInteger;
+
+	if (ScanNumber(rhs, len, &real, &integer, &isInteger))
+	{
+		if (isInteger)
+		{
+			SetInteger(lhs, integer);
+			return ValueType_Integer;
+		}
+
+		SetReal(lhs, real);
+		return ValueType_Real;
+	}
+
+	const char *begin = rhs;
+	const char *end = rhs + len;
+	TrimSpan(begin, end);
+
+	size_t n = end - begin;
+	if (n == TRUE_SIZE && StrEqualsFold(begin, TRUE_STRING, TRUE_SIZE))
+	{
+		SetBool(lhs, true);
+		return ValueType_Bool;
+	}
+
+	if (n == FALSE_SIZE && StrEqualsFold(begin, FALSE_STRING, FALSE_SIZE))
+	{
+		SetBool(lhs, false);
+		return ValueType_Bool;
 	}
 
 	return ValueType_None;
 }
 
+//! \brief Set a string that is known not to be a number
+static Value &SetNonNumericString(Value &lhs, const char *rhs, size_t len)
+{
+	SetString(lhs, rhs, len);
+	if (lhs.type == ValueType_String)
+	{
+		lhs.u.string->number = 0.0;
+		lhs.u.string->ref.flags |= STRING_NUMBER_CACHED;
+	}
+	return lhs;
+}
+
 Value &SetParsedString(Value &lhs, const std::string &rhs)
 {
-	if (ParseString(lhs, rhs) != ValueType_None)
+	if (ParseString(lhs, rhs.data(), rhs.size()) != ValueType_None)
 		return lhs;
-	return SetString(lhs, rhs);
+	return SetNonNumericString(lhs, rhs.data(), rhs.size());
 }
 
 Value &SetParsedString(Value &lhs, const char *rhs)
 {
-	if (ParseString(lhs, rhs) != ValueType_None)
+	size_t len = strlen(rhs);
+	if (ParseString(lhs, rhs, len) != ValueType_None)
 		return lhs;
-	return SetString(lhs, rhs);
+	return SetNonNumericString(lhs, rhs, len);
 }
 
 Value &SetIntPtr(Value &lhs, intptr_t intptr)
@@ -300,6 +976,186 @@ Value &SetEmpty(Value &lhs)
 	return lhs;
 }
 
+struct ListIndex
+{
+	int64_t mask; // number of buckets - 1
+	int64_t capacity; // capacity of next and hashes
+	int64_t *buckets; // first position + 1 in each bucket, 0 if empty
+	int64_t *next; // next position + 1 in the same bucket, 0 if last
+	uint64_t *hashes; // hash of each element
+};
+
+//! \brief Get the size of the allocations of a hash index
+static inline int64_t ListIndexSize(int64_t buckets, int64_t capacity)
+{
+	return sizeof(ListIndex) + buckets * sizeof(int64_t) + capacity * (sizeof(int64_t) + sizeof(uint64_t));
+}
+
+//! \brief Drop the hash index of a list
+//!
+//! Called when elements are moved, the index will be rebuilt if the
+//! list is searched often enough.
+static void ListDropIndex(List *l)
+{
+	ListIndex *index = l->index;
+	if (index)
+	{
+		HeapSub(l->heap, ListIndexSize(index->mask + 1, index->capacity));
+
+		free(index->buckets);
+		free(index->next);
+		free(index->hashes);
+		free(index);
+		l->index = nullptr;
+	}
+
+	l->searches = 0;
+}
+
+static inline void ListIndexLink(ListIndex *index, int64_t i, uint64_t h)
+{
+	int64_t b = static_cast<int64_t>(h & index->mask);
+	index->hashes[i] = h;
+	index->next[i] = index->buckets[b];
+	index->buckets[b] = i + 1;
+}
+
+static void ListIndexUnlink(ListIndex *index, int64_t i)
+{
+	int64_t *link = &index->buckets[index->hashes[i] & index->mask];
+	while (*link)
+	{
+		if (*link == i + 1)
+		{
+			*link = index->next[i];
+			return;
+		}
+
+		link = &index->next[*link - 1];
+	}
+}
+
+//! \brief Build the hash index of a list
+//!
+//! \return true on success, false if allocation failed
+static bool ListBuildIndex(List *l)
+{
+	ListDropIndex(l);
+
+	int64_t buckets = INITIAL_CAPACITY;
+	while (buckets < l->len * 2)
+		buckets *= 2;
+
+	// the index is optional, so it never raises
+	int64_t size = ListIndexSize(buckets, l->capacity);
+	if (!HeapFits(l->heap, size))
+		return false;
+
+	ListIndex *index = (ListIndex *)calloc(1, sizeof(ListIndex));
+	if (!index)
+		return false;
+
+	HeapAdd(l->heap, size);
+
+	index->mask = buckets - 1;
+	index->capacity = l->capacity;
+	index->buckets = (int64_t *)calloc(buckets, sizeof(int64_t));
+	index->next = (int64_t *)malloc(index->capacity * sizeof(int64_t));
+	index->hashes = (uint64_t *)malloc(index->capacity * sizeof(uint64_t));
+
+	l->index = index;
+	if (!index->buckets || !index->next || !index->hashes)
+	{
+		ListDropIndex(l);
+		return false;
+	}
+
+	Value tmp;
+	for (int64_t i = l->len - 1; i >= 0; i--)
+		ListIndexLink(index, i, HashValue(ListElement(l, i, tmp)));
+
+	return true;
+}
+
+//! \brief Update the hash index after an element was stored
+//!
+//! \param l The list
+//! \param i Position of the element
+//! \param added Whether the element was appended, rather than replaced
+static void ListUpdateIndex(List *l, int64_t i, bool added)
+{
+	ListIndex *index = l->index;
+	if (!index)
+		return;
+
+	if (added)
+	{
+		if (l->len > index->mask + 1)
+		{
+			// keep the load factor below 1
+			ListBuildIndex(l);
+			return;
+		}
+
+		if (l->len > index->capacity)
+		{
+			int64_t capacity = l->capacity;
+			int64_t grow = ListIndexSize(0, capacity) - ListIndexSize(0, index->capacity);
+			if (!HeapFits(l->heap, grow))
+			{
+				ListDropIndex(l);
+				return;
+			}
+
+			int64_t *next = (int64_t *)realloc(index->next, capacity * sizeof(int64_t));
+			if (next)
+				index->next = next;
+
+			uint64_t *hashes = (uint64_t *)realloc(index->hashes, capacity * sizeof(uint64_t));
+			if (hashes)
+				index->hashes = hashes;
+
+			if (!next || !hashes)
+			{
+				ListDropIndex(l);
+				return;
+			}
+
+			HeapAdd(l->heap, grow);
+			index->capacity = capacity;
+		}
+	}
+	else
+		ListIndexUnlink(index, i);
+
+	Value tmp;
+	ListIndexLink(index, i, HashValue(ListElement(l, i, tmp)));
+}
+
+//! \brief Find a value using the hash index
+//!
+//! \return The one-based position of the first match, or 0
+static int64_t ListIndexFind(const List *l, const Value &v)
+{
+	const ListIndex *index = l->index;
+
+	uint64_t h = HashValue(v);
+	int64_t first = 0;
+
+	// chains are not ordered by position, so visit the whole chain
+	for (int64_t p = index->buckets[h & index->mask]; p; p = index->next[p - 1])
+	{
+		if (index->hashes[p - 1] != h || (first && p > first))
+			continue;
+
+		Value tmp;
+		if (Equals(ListElement(l, p - 1, tmp), v))
+			first = p;
+	}
+
+	return first;
+}
+
 Value &ListGet(Value &lhs, const Value &list, int64_t index)
 {
 	if (index < 1 || list.type != ValueType_List)
@@ -309,7 +1165,11 @@ Value &ListGet(Value &lhs, const Value &list, int64_t index)
 	if (index > l->len)
 		return SetEmpty(lhs);
 
-	return Assign(lhs, l->values[index - 1]);
+	int64_t slot = ListSlot(l, index - 1);
+	if (l->ref.flags & LIST_PACKED)
+		return UnpackNumber(lhs, l->numbers[slot]);
+
+	return Assign(lhs, l->values[slot]);
 }
 
 void ListSet(Value &list, int64_t index, const Value &v)
@@ -321,7 +1181,48 @@ void ListSet(Value &list, int64_t index, const Value &v)
 	if (index > l->len)
 		return;
 
-	Assign(l->values[index - 1], v);
+	if (!ListDetach(l))
+		return;
+
+	if (l->ref.flags & LIST_PACKED)
+	{
+		double d;
+		if (IsPackable(v, &d))
+		{
+			l->numbers[ListSlot(l, index - 1)] = d;
+			ListUpdateIndex(l, index - 1, false);
+			return;
+		}
+
+		if (!ListUnpack(l))
+			return;
+	}
+
+	Assign(l->values[ListSlot(l, index - 1)], v);
+	ListUpdateIndex(l, index - 1, false);
+}
+
+//! \brief Get the number a value compares equal to in a packed list
+//!
+//! \return true if the value can equal a number
+static bool PackedKey(const Value &v, double *d)
+{
+	switch (v.type)
+	{
+	default:
+		return false;
+	case ValueType_Integer:
+		*d = static_cast<double>(v.u.integer);
+		return true;
+	case ValueType_Real:
+		*d = v.u.real;
+		return true;
+	case ValueType_Bool:
+		*d = v.u.boolean ? 1.0 : 0.0;
+		return true;
+	case ValueType_String:
+		return StringToNumber(v.u.string, d);
+	}
 }
 
 int64_t ListIndexOf(const Value &list, const Value &v)
@@ -329,10 +1230,50 @@ int64_t ListIndexOf(const Value &list, const Value &v)
 	if (list.type != ValueType_List)
 		return 0;
 
-	List *l = list.u.list;
-	for (int64_t i = 0; i < l->len; i++)
+	List *l = list.u.list;
+
+	if (!l->index && l->len >= LIST_INDEX_THRESHOLD && ++l->searches >= LIST_INDEX_SEARCHES)
+		ListBuildIndex(l);
+
+	if (l->index)
+		return ListIndexFind(l, v);
+
+	// the ring buffer is scanned as two contiguous runs, the second
+	// starting at the beginning of the storage array
+	int64_t run = std::min(l->len, l->capacity - l->head);
+
+	if (l->ref.flags & LIST_PACKED)
+	{
+		double d;
+		if (!PackedKey(v, &d))
+			return 0;
+
+		const double *numbers = l->numbers + l->head;
+		for (int64_t i = 0; i < run; i++)
+		{
+			if (numbers[i] == d)
+				return i + 1;
+		}
+
+		for (int64_t i = run; i < l->len; i++)
+		{
+			if (l->numbers[i - run] == d)
+				return i + 1;
+		}
+
+		return 0;
+	}
+
+	const Value *values = l->values + l->head;
+	for (int64_t i = 0; i < run; i++)
+	{
+		if (Equals(values[i], v))
+			return i + 1;
+	}
+
+	for (int64_t i = run; i < l->len; i++)
 	{
-		if (Equals(l->values[i], v))
+		if (Equals(l->values[i - run], v))
 			return i + 1;
 	}
 
@@ -351,43 +1292,144 @@ bool ListContainsValue(const Value &list, const Value &v)
 	return ListIndexOf(list, v) != 0;
 }
 
-static bool ListGrow(const Value &list)
+//! \brief Ensure a list can hold a number of elements
+//!
+//! \param l The list
+//! \param n The number of elements
+//!
+//! \return true on success, false if allocation failed
+static bool ListReserve(List *l, int64_t n)
 {
-	assert(list.type == ValueType_List);
+	assert(!ListShared(l));
 
-	List *l = list.u.list;
+	if (n <= l->capacity)
+		return true;
 
-	int64_t newLen = l->len + 1;
-	if (l->capacity < newLen)
-	{
-		int64_t newCapacity = l->capacity * 2;
-		if (newCapacity < newLen)
-			newCapacity = newLen;
+	int64_t capacity = l->capacity;
+	int64_t newCapacity = capacity * 2;
+	if (newCapacity < n)
+		newCapacity = n;
 
-		Value *newValues = (Value *)realloc(l->values, newCapacity * sizeof(Value));
-		if (!newValues)
-			return false;
+	size_t elemSize = ListElementSize(l);
 
-		l->values = newValues;
-		l->capacity = newCapacity;
-	}
+	int64_t size = sizeof(ListStorage) + newCapacity * elemSize;
+	int64_t oldSize = ListStorageOf(l->values)->size;
+	HeapStats *heap = ListStorageOf(l->values)->heap;
+	if (!HeapReserve(heap, size - oldSize))
+		return false;
+
+	ListStorage *storage = (ListStorage *)realloc(ListStorageOf(l->values), size);
+	if (!storage)
+		return false;
 
-	InitializeValue(l->values[l->len]); // uninitialized data
-	l->len = newLen;
+	HeapAdd(heap, size - oldSize);
+	storage->size = size;
+
+	uint8_t *values = (uint8_t *)(storage + 1);
+
+	// move the wrapped run after the first, newCapacity >= capacity + len
+	int64_t wrapped = l->head + l->len - capacity;
+	if (wrapped > 0)
+		memcpy(values + capacity * elemSize, values, wrapped * elemSize);
+
+	l->values = (Value *)values;
+	l->capacity = newCapacity;
 
 	return true;
 }
 
+//! \brief Open an uninitialized slot in a list
+//!
+//! Elements are shifted towards whichever end of the list is closer,
+//! so inserting at either end is O(1).
+//!
+//! \param l The list, must have room for another element
+//! \param i Zero-based position of the new slot
+static void ListOpenSlot(List *l, int64_t i)
+{
+	size_t elemSize = ListElementSize(l);
+
+	l->len++;
+
+	if (i < l->len / 2)
+	{
+		// shift the front
+		l->head = l->head == 0 ? l->capacity - 1 : l->head - 1;
+		for (int64_t j = 0; j < i; j++)
+			memcpy(ListSlotPtr(l, j), ListSlotPtr(l, j + 1), elemSize);
+	}
+	else
+	{
+		// shift the back
+		for (int64_t j = l->len - 1; j > i; j--)
+			memcpy(ListSlotPtr(l, j), ListSlotPtr(l, j - 1), elemSize);
+	}
+}
+
+//! \brief Remove a slot from a list
+//!
+//! The element in the slot must already have been released.
+//!
+//! \param l The list
+//! \param i Zero-based position of the slot
+static void ListCloseSlot(List *l, int64_t i)
+{
+	size_t elemSize = ListElementSize(l);
+
+	if (i < l->len / 2)
+	{
+		// shift the front
+		for (int64_t j = i; j > 0; j--)
+			memcpy(ListSlotPtr(l, j), ListSlotPtr(l, j - 1), elemSize);
+		l->head = l->head + 1 == l->capacity ? 0 : l->head + 1;
+	}
+	else
+	{
+		// shift the back
+		for (int64_t j = i; j < l->len - 1; j++)
+			memcpy(ListSlotPtr(l, j), ListSlotPtr(l, j + 1), elemSize);
+	}
+
+	l->len--;
+}
+
 void ListAppend(const Value &list, const Value &v)
 {
 	if (list.type != ValueType_List)
 		return;
 
-	if (!ListGrow(list))
+	List *l = list.u.list;
+
+	if (!ListDetach(l))
+		return;
+
+	double d;
+	if (l->ref.flags & LIST_PACKED)
+	{
+		if (IsPackable(v, &d))
+		{
+			if (ListReserve(l, l->len + 1))
+			{
+				l->numbers[ListSlot(l, l->len)] = d;
+				l->len++;
+				ListUpdateIndex(l, l->len - 1, true);
+			}
+			return;
+		}
+
+		if (!ListUnpack(l))
+			return;
+	}
+
+	if (!ListReserve(l, l->len + 1))
 		return;
 
-	List *l = list.u.list;	
-	Assign(l->values[l->len - 1], v);
+	Value &slot = l->values[ListSlot(l, l->len)];
+	InitializeValue(slot);
+	Assign(slot, v);
+	l->len++;
+
+	ListUpdateIndex(l, l->len - 1, true);
 }
 
 void ListDelete(const Value &list, int64_t index)
@@ -399,15 +1441,15 @@ void ListDelete(const Value &list, int64_t index)
 	if (index > l->len)
 		return;
 
-	int64_t i = index - 1;
+	if (!ListDetach(l))
+		return;
 
-	ReleaseValue(l->values[i]);
+	ListDropIndex(l); // positions shift
 
-	for (; i < l->len; i++)
-		l->values[i] = l->values[i + 1]; // direct assignment, no need to retain/release
+	if (!(l->ref.flags & LIST_PACKED))
+		ReleaseValue(l->values[ListSlot(l, index - 1)]);
 
-	l->len--;
-	InitializeValue(l->values[l->len]); // clear the last value
+	ListCloseSlot(l, index - 1);
 }
 
 void ListDelete(const Value &list, const Value &index)
@@ -441,9 +1483,39 @@ void ListClear(const Value &list)
 		return;
 
 	List *l = list.u.list;
-	for (int64_t i = 0; i < l->len; i++)
-		ReleaseValue(l->values[i]);
+
+	ListDropIndex(l);
+
+	if (ListShared(l) || !(l->ref.flags & LIST_PACKED))
+	{
+		// the list is empty, so it can be packed again, clearing does
+		// not raise if the new storage does not fit
+		double *numbers = nullptr;
+		if (HeapFits(GetCurrentHeap(), sizeof(ListStorage) + INITIAL_CAPACITY * sizeof(double)))
+			numbers = (double *)ListStorageAlloc(INITIAL_CAPACITY, sizeof(double));
+		if (numbers)
+		{
+			ListReleaseStorage(l);
+			l->numbers = numbers;
+			l->capacity = INITIAL_CAPACITY;
+			l->ref.flags |= LIST_PACKED;
+		}
+		else
+		{
+			// clear the existing storage instead
+			if (!ListDetach(l))
+				return;
+
+			if (!(l->ref.flags & LIST_PACKED))
+			{
+				for (int64_t i = 0; i < l->len; i++)
+					ReleaseValue(l->values[ListSlot(l, i)]);
+			}
+		}
+	}
+
 	l->len = 0;
+	l->head = 0;
 }
 
 void ListInsert(const Value &list, int64_t index, const Value &v)
@@ -456,203 +1528,246 @@ void ListInsert(const Value &list, int64_t index, const Value &v)
 	if (index > l->len + 1)
 		return;
 
-	if (!ListGrow(list))
+	int64_t target = index - 1;
+
+	if (!ListDetach(l))
 		return;
 
-	int64_t target = index - 1;
-	for (int64_t i = l->len - 1; i > target; i--)
-		l->values[i] = l->values[i - 1]; // direct assignment, no need to retain/release
+	ListDropIndex(l); // positions shift
+
+	double d;
+	if (l->ref.flags & LIST_PACKED)
+	{
+		if (IsPackable(v, &d))
+		{
+			if (!ListReserve(l, l->len + 1))
+				return;
+
+			ListOpenSlot(l, target);
+			l->numbers[ListSlot(l, target)] = d;
+			return;
+		}
+
+		if (!ListUnpack(l))
+			return;
+	}
 
-	InitializeValue(l->values[target]); // prevents double release
-	Assign(l->values[target], v);
+	if (!ListReserve(l, l->len + 1))
+		return;
+
+	ListOpenSlot(l, target);
+
+	Value &slot = l->values[ListSlot(l, target)];
+	InitializeValue(slot); // prevents double release
+	Assign(slot, v);
 }
 
-Value &CvtString(Value &v)
+StringView GetStringView(const Value &v, char *scratch, size_t size)
 {
-	char buf[64];
-	int cch;
+	StringView view;
 
 	switch (v.type)
 	{
 	default:
-	case ValueType_String:
+	case ValueType_None:
+		view.str = "", view.len = 0;
 		break;
 	case ValueType_Integer:
-		cch = snprintf(buf, sizeof(buf), "%lld", v.u.integer);
-		SetString(v, buf, cch);
+		view.len = snprintf(scratch, size, "%lld", static_cast<long long>(v.u.integer));
+		view.str = scratch;
 		break;
 	case ValueType_Real:
-		if (v.u.real == NAN)
-		{
-			SetString(v, "NaN");
-			break;
-		}
-
-		if (v.u.real == INFINITY)
-		{
-			SetString(v, "Infinity");
-			break;
-		}
-
-		if (v.u.real == -INFINITY)
+		if (std::isnan(v.u.real))
+			view.str = "NaN", view.len = 3;
+		else if (std::isinf(v.u.real))
+			view.str = v.u.real > 0 ? "Infinity" : "-Infinity", view.len = v.u.real > 0 ? 8 : 9;
+		else
 		{
-			SetString(v, "-Infinity");
-			break;
+			view.len = snprintf(scratch, size, "%.8g", v.u.real);
+			view.str = scratch;
 		}
-
-		cch = snprintf(buf, sizeof(buf), "%.8g", v.u.real);
-		SetString(v, buf, cch);
 		break;
 	case ValueType_Bool:
-		SetString(v, v.u.boolean ? TRUE_STRING : FALSE_STRING);
+		view.str = v.u.boolean ? TRUE_STRING : FALSE_STRING;
+		view.len = v.u.boolean ? TRUE_SIZE : FALSE_SIZE;
+		break;
+	case ValueType_String:
+		view.str = v.u.string->str, view.len = v.u.string->len;
 		break;
 	case ValueType_List:
-		SetString(v, "<list>");
+		view.str = "<list>", view.len = 6;
 		break;
 	}
 
-	return v;
+	return view;
 }
 
-int64_t ValueLength(const Value &v)
+Value &CvtString(Value &v)
 {
-	Value tmp;
-	int64_t len;
+	if (v.type == ValueType_String)
+		return v;
 
-	switch (v.type)
+	char buf[64];
+	StringView view = GetStringView(v, buf);
+	return SetString(v, view.str, view.len);
+}
+
+int64_t ValueLength(const Value &v)
+{
+	if (v.type == ValueType_String)
 	{
-	default:
-	case ValueType_None:
-		return 0;
-	case ValueType_Integer:
-	case ValueType_Real:
-	case ValueType_List:
-		InitializeValue(tmp);
-		Assign(tmp, v), CvtString(tmp);
-		len = tmp.u.string->len; // will always be type ValueType_String
-		ReleaseValue(tmp);
-		return len;
-	case ValueType_Bool:
-		return v.u.boolean ? TRUE_SIZE : FALSE_SIZE - 1;
-	case ValueType_String:
-		return v.u.string->len;
+		const String *str = v.u.string;
+		if (StringIsAscii(str))
+			return str->len;
+
+		StringIndex *index = StringGetIndex(str);
+		return index ? index->chars : StrCountCodePoints(str->str, str->len);
 	}
+
+	char buf[64];
+	return GetStringView(v, buf).len;
 }
 
 Value &ConcatValue(Value &lhs, const Value &rhs)
 {
-	Value a, b;
-	InitializeValue(a);
-	InitializeValue(b);
+	char rbuf[64];
+	StringView rview = GetStringView(rhs, rbuf);
+	const char *s2 = rview.str;
+	int64_t len2 = rview.len;
 
-	// convert each value to a string
-	Assign(a, lhs), CvtString(a);
-	Assign(b, rhs), CvtString(b);
+	if (len2 == 0)
+		return CvtString(lhs);
 
-	int64_t len1, len2;
-	const char *s1, *s2;
+	if (lhs.type == ValueType_String && !(lhs.flags & VALUE_STATIC))
+	{
+		String *s = lhs.u.string;
+		if (s->ref.count == 1 && !(s->ref.flags & VALUE_STATIC))
+		{
+			// sole owner, append in place
+			int64_t len1 = s->len;
+			int64_t newLen = len1 + len2;
 
-	// get the raw strings (CvtString already performed conversion)
-	s1 = GetRawString(a, &len1);
-	s2 = GetRawString(b, &len2);
+			if (newLen > s->capacity)
+			{
+				int64_t newCapacity = s->capacity * 2;
+				if (newCapacity < newLen)
+					newCapacity = newLen;
 
-	// allocate a new string
-	AllocString(lhs, len1 + len2);
-	if (lhs.type != ValueType_String)
-	{
-		ReleaseValue(b);
-		ReleaseValue(a);
-		return lhs;
-	}
+				bool alias = rhs.type == ValueType_String && rhs.u.string == s;
 
-	// copy the strings into the new string
-	memcpy(lhs.u.string->str, s1, len1);
-	memcpy(lhs.u.string->str + len1, s2, len2);
+				int64_t grow = newCapacity - s->capacity;
+				if (!HeapReserve(s->heap, grow))
+					return lhs;
 
-	ReleaseValue(b);
-	ReleaseValue(a);
-	return lhs;
-}
+				String *ns = (String *)realloc(s, STRING_SIZE(newCapacity));
+				if (!ns)
+					return lhs;
 
-char ValueCharAt(const Value &v, int64_t index)
-{
-	if (index < 1)
-		return 0;
+				HeapAdd(ns->heap, grow);
 
-	Value a;
-	InitializeValue(a);
+				s = lhs.u.string = ns;
+				s->capacity = newCapacity;
 
-	Assign(a, v), CvtString(a);
+				if (alias)
+					s2 = s->str;
+			}
 
-	int64_t len;
-	const char *s = GetRawString(a, &len);
+			memcpy(s->str + len1, s2, len2);
+			s->str[newLen] = 0;
+			s->len = newLen;
+			s->hash = HashStringAppend(static_cast<uint32_t>(s->hash), s2, len2);
+			s->ref.flags &= ~(STRING_NUMBER_CACHED | STRING_NUMBER_VALID);
 
-	if (index > len)
-	{
-		ReleaseValue(a);
-		return 0;
+			if ((s->ref.flags & STRING_ASCII) && !StrIsAscii(s2, len2))
+				s->ref.flags &= ~(STRING_ASCII_CACHED | STRING_ASCII);
+			StringDropIndex(s);
+
+			return lhs;
+		}
 	}
 
-	char c = s[index - 1];
+	char lbuf[64];
+	StringView lview = GetStringView(lhs, lbuf);
+	const char *s1 = lview.str;
+	int64_t len1 = lview.len;
 
-	ReleaseValue(a);
-	return c;
-}
+	Value result;
+	InitializeValue(result);
 
-bool ValueContains(const Value &lhs, const Value &rhs)
-{
-	Value a, b;
-	InitializeValue(a);
-	InitializeValue(b);
+	AllocString(result, len1 + len2);
+	if (result.type != ValueType_String)
+		return lhs;
 
-	Assign(a, lhs), CvtString(a);
-	Assign(b, rhs), CvtString(b);
+	memcpy(result.u.string->str, s1, len1);
+	memcpy(result.u.string->str + len1, s2, len2);
+	result.u.string->hash = HashStringAppend(STRING_HASH_SEED, result.u.string->str, len1 + len2);
+	CacheStringAscii(result.u.string);
 
-	int64_t len1, len2;
-	const char *s1, *s2;
+	// rhs may be referenced by lhs, so release lhs after copying
+	ReleaseValue(lhs);
+	lhs = result;
 
-	s1 = GetRawString(a, &len1);
-	s2 = GetRawString(b, &len2);
+	return lhs;
+}
 
-	if (len2 == 0)
+Value &ValueCharAt(Value &lhs, const Value &v, int64_t index)
+{
+	const char *str;
+	int64_t len;
+	char buf[64];
+
+	if (v.type == ValueType_String)
 	{
-		ReleaseValue(b);
-		ReleaseValue(a);
-		return true;
-	}
+		int64_t begin, end;
+		if (!StringCodePoint(v.u.string, index - 1, &begin, &end))
+			return SetEmpty(lhs);
 
-	int64_t i, j;
-	for (i = 0; i < len1; i++)
+		str = v.u.string->str + begin;
+		len = end - begin;
+	}
+	else
 	{
-		char c = tolower(s1[i]);
-		for (j = 0; j < len2; j++)
-		{
-			if (c != tolower(s2[j]))
-				break;
-		}
+		StringView view = GetStringView(v, buf);
+		if (index < 1 || index > view.len)
+			return SetEmpty(lhs);
 
-		if (j == len2)
-		{
-			ReleaseValue(b);
-			ReleaseValue(a);
-			return true;
-		}
+		str = view.str + index - 1;
+		len = 1;
 	}
 
-	ReleaseValue(b);
-	ReleaseValue(a);
-	return false;
+	// v may be referenced by lhs, so release lhs after copying
+	Value result;
+	InitializeValue(result);
+	SetString(result, str, len);
+
+	ReleaseValue(lhs);
+	lhs = result;
+
+	return lhs;
+}
+
+bool ValueContains(const Value &lhs, const Value &rhs)
+{
+	char lbuf[64], rbuf[64];
+	StringView lview = GetStringView(lhs, lbuf);
+	StringView rview = GetStringView(rhs, rbuf);
+
+	return StrFindFold(lview.str, lview.len, rview.str, rview.len) != nullptr;
 }
 
 int64_t ToInteger(const Value &v)
 {
+	double d;
+
 	switch (v.type)
 	{
 	default:
 	case ValueType_None:
-	case ValueType_String:
 	case ValueType_List:
 		return 0;
+	case ValueType_String:
+		StringToNumber(v.u.string, &d);
+		return static_cast<int64_t>(round(d));
 	case ValueType_Real:
 		return static_cast<int64_t>(round(v.u.real));
 	case ValueType_Integer:
@@ -664,13 +1779,17 @@ int64_t ToInteger(const Value &v)
 
 double ToReal(const Value &v)
 {
+	double d;
+
 	switch (v.type)
 	{
 	default:
 	case ValueType_None:
-	case ValueType_String:
 	case ValueType_List:
 		return 0.0;
+	case ValueType_String:
+		StringToNumber(v.u.string, &d);
+		return d;
 	case ValueType_Real:
 		return v.u.real;
 	case ValueType_Integer:
@@ -683,32 +1802,10 @@ double ToReal(const Value &v)
 const char *ToString(const Value &v, int64_t *len)
 {
 	static SCRATCH3_STORAGE char buf[64];
-	int cch;
 
-	switch (v.type)
-	{
-	default:
-	case ValueType_None:
-		if (len) *len = 0;
-		return "";
-	case ValueType_Integer:
-		cch = snprintf(buf, sizeof(buf), "%lld", v.u.integer);
-		if (len) *len = cch;
-		return buf;
-	case ValueType_Real:
-		cch = snprintf(buf, sizeof(buf), "%.8g", v.u.real);
-		if (len) *len = cch;
-		return buf;
-	case ValueType_Bool:
-		if (len) *len = v.u.boolean ? TRUE_SIZE : FALSE_SIZE;
-		return v.u.boolean ? TRUE_STRING : FALSE_STRING;
-	case ValueType_String:
-		if (len) *len = v.u.string->len;
-		return v.u.string->str;
-	case ValueType_List:
-		if (len) *len = 6;
-		return "<list>";
-	}
+	StringView view = GetStringView(v, buf);
+	if (len) *len = view.len;
+	return view.str;
 }
 
 IntVector4 ToRGBA(const Value &v)
@@ -778,8 +1875,52 @@ const char *GetRawString(const Value &v, int64_t *len)
 	}
 }
 
+//! \brief Get the numeric value of a value for comparison
+//!
+//! \return true if the value should be compared numerically
+static bool ComparableNumber(const Value &v, double *result)
+{
+	switch (v.type)
+	{
+	default:
+	case ValueType_None:
+	case ValueType_List:
+		*result = 0.0;
+		return false;
+	case ValueType_String:
+		return StringToNumber(v.u.string, result);
+	case ValueType_Integer:
+	case ValueType_Real:
+	case ValueType_Bool:
+		*result = ToReal(v);
+		return true;
+	}
+}
+
+//! \brief Compare two values where at least one is a string
+//!
+//! Values are compared numerically if both are valid numbers,
+//! otherwise they are compared as case-insensitive strings.
+//!
+//! \return Negative if lhs < rhs, positive if lhs > rhs, 0 otherwise
+static int CompareMixed(const Value &lhs, const Value &rhs)
+{
+	double a, b;
+	if (ComparableNumber(lhs, &a) && ComparableNumber(rhs, &b))
+		return (a > b) - (a < b);
+
+	char lbuf[64], rbuf[64];
+	StringView lview = GetStringView(lhs, lbuf);
+	StringView rview = GetStringView(rhs, rbuf);
+
+	return StrCompareFold(lview.str, lview.len, rview.str, rview.len);
+}
+
 Value &ValueAdd(Value &lhs, const Value &rhs)
 {
+	if (lhs.type == ValueType_String || rhs.type == ValueType_String)
+		return SetReal(lhs, ToReal(lhs) + ToReal(rhs));
+
 	switch (lhs.type)
 	{
 	default:
@@ -817,6 +1958,9 @@ Value &ValueAdd(Value &lhs, const Value &rhs)
 
 Value &ValueSub(Value &lhs, const Value &rhs)
 {
+	if (lhs.type == ValueType_String || rhs.type == ValueType_String)
+		return SetReal(lhs, ToReal(lhs) - ToReal(rhs));
+
 	switch (lhs.type)
 	{
 	default:
@@ -850,6 +1994,9 @@ Value &ValueSub(Value &lhs, const Value &rhs)
 
 Value &ValueMul(Value &lhs, const Value &rhs)
 {
+	if (lhs.type == ValueType_String || rhs.type == ValueType_String)
+		return SetReal(lhs, ToReal(lhs) * ToReal(rhs));
+
 	switch (lhs.type)
 	{
 	default:
@@ -883,6 +2030,9 @@ Value &ValueMul(Value &lhs, const Value &rhs)
 
 Value &ValueDiv(Value &lhs, const Value &rhs)
 {
+	if (lhs.type == ValueType_String || rhs.type == ValueType_String)
+		return SetReal(lhs, ToReal(lhs) / ToReal(rhs)); // IEEE semantics match handle_div0
+
 	switch (rhs.type) // Notice switch on rhs
 	{
 	default:
@@ -904,9 +2054,9 @@ Value &ValueDiv(Value &lhs, const Value &rhs)
 
 		if (lhs.type == ValueType_Real)
 			return SetReal(lhs, lhs.u.real / rhs.u.real);
-		if (rhs.type == ValueType_Integer)
+		if (lhs.type == ValueType_Integer)
 			return SetReal(lhs, lhs.u.integer / rhs.u.real);
-		if (rhs.type == ValueType_Bool)
+		if (lhs.type == ValueType_Bool)
 			return lhs.u.boolean ? SetReal(lhs, 1.0 / rhs.u.real) : SetInteger(lhs, 0);
 		return SetInteger(lhs, 0);
 	case ValueType_Bool:
@@ -948,6 +2098,9 @@ handle_div0:
 
 Value &ValueMod(Value &lhs, const Value &rhs)
 {
+	if (lhs.type == ValueType_String || rhs.type == ValueType_String)
+		return SetReal(lhs, fmod(ToReal(lhs), ToReal(rhs)));
+
 	switch (rhs.type) // Notice switch on rhs
 	{
 	default:
@@ -983,6 +2136,8 @@ Value &ValueNeg(Value &lhs)
 	{
 	default:
 		return SetInteger(lhs, 0);
+	case ValueType_String:
+		return SetReal(lhs, -ToReal(lhs));
 	case ValueType_Integer:
 		return SetInteger(lhs, -lhs.u.integer);
 	case ValueType_Real:
@@ -994,6 +2149,9 @@ Value &ValueNeg(Value &lhs)
 
 Value &ValueGreater(Value &lhs, const Value &rhs)
 {
+	if (lhs.type == ValueType_String || rhs.type == ValueType_String)
+		return SetBool(lhs, CompareMixed(lhs, rhs) > 0);
+
 	switch (lhs.type)
 	{
 	default:
@@ -1027,6 +2185,9 @@ Value &ValueGreater(Value &lhs, const Value &rhs)
 
 Value &ValueLess(Value &lhs, const Value &rhs)
 {
+	if (lhs.type == ValueType_String || rhs.type == ValueType_String)
+		return SetBool(lhs, CompareMixed(lhs, rhs) < 0);
+
 	switch (lhs.type)
 	{
 	default:
@@ -1062,15 +2223,33 @@ Value &ValueDeepCopy(Value &lhs, const Value &rhs)
 {
 	if (rhs.type == ValueType_List)
 	{
-		AllocList(lhs, rhs.u.list->len);
-		if (lhs.type != ValueType_List)
+		List *r = rhs.u.list;
+
+		// the copy shares storage with rhs until either is modified
+		HeapStats *heap = GetCurrentHeap();
+		if (!HeapReserve(heap, sizeof(List)))
 			return SetEmpty(lhs);
 
-		List *l = lhs.u.list;
-		List *r = rhs.u.list;
+		List *l = (List *)calloc(1, sizeof(List));
+		if (!l)
+			return SetEmpty(lhs);
+
+		HeapAdd(heap, sizeof(List));
+
+		l->ref.count = 1;
+		l->heap = heap;
+		l->ref.flags = r->ref.flags & LIST_PACKED;
+		l->len = r->len;
+		l->capacity = r->capacity;
+		l->head = r->head;
+		l->values = r->values;
 
-		for (int64_t i = 0; i < r->len; i++)
-			ValueDeepCopy(l->values[i], r->values[i]);
+		ListStorageOf(r->values)->count++;
+
+		// rhs may be an element of lhs, so replace lhs last
+		ReleaseValue(lhs);
+		lhs.type = ValueType_List;
+		lhs.u.list = l;
 
 		return lhs;
 	}
@@ -1085,15 +2264,23 @@ Value &AllocString(Value &v, int64_t len)
 
 	ReleaseValue(v);
 
+	HeapStats *heap = GetCurrentHeap();
+	if (!HeapReserve(heap, STRING_SIZE(len)))
+		return v;
+
 	v.type = ValueType_String;
-	v.u.string = (String *)calloc(1, offsetof(String, str) + len + 1);
+	v.u.string = (String *)calloc(1, STRING_SIZE(len));
 	if (!v.u.string)
 	{
 		v.type = ValueType_None;
 		return v;
 	}
 
+	HeapAdd(heap, STRING_SIZE(len));
+
 	v.u.string->len = len;
+	v.u.string->capacity = len;
+	v.u.string->heap = heap;
 	v.u.ref->count = 1;
 
 	return v;
@@ -1106,6 +2293,14 @@ Value &AllocList(Value &v, int64_t len)
 	if (len < 0)
 		len = 0;
 
+	int64_t capacity = std::max<int64_t>(INITIAL_CAPACITY, len);
+	size_t elemSize = len == 0 ? sizeof(double) : sizeof(Value);
+
+	// check the whole allocation up front, so nothing leaks if this raises
+	HeapStats *heap = GetCurrentHeap();
+	if (!HeapReserve(heap, sizeof(List) + sizeof(ListStorage) + capacity * elemSize))
+		return v;
+
 	v.type = ValueType_List;
 	v.u.list = (List *)calloc(1, sizeof(List));
 	if (!v.u.list)
@@ -1114,14 +2309,23 @@ Value &AllocList(Value &v, int64_t len)
 		return v;
 	}
 
+	HeapAdd(heap, sizeof(List));
+
 	List *list = v.u.list;
 
 	list->ref.count = 1;
+	list->heap = heap;
 	list->len = len;
-	list->capacity = std::max<int64_t>(INITIAL_CAPACITY, len);
-	list->values = (Value *)calloc(list->capacity, sizeof(Value));
+	list->capacity = capacity;
+
+	// empty lists start packed, until a non-number is stored
+	if (len == 0)
+		list->ref.flags = LIST_PACKED;
+
+	list->values = (Value *)ListStorageAlloc(capacity, elemSize);
 	if (!list->values)
 	{
+		HeapSub(heap, sizeof(List));
 		free(list);
 		v.type = ValueType_None;
 		return v;
@@ -1133,6 +2337,22 @@ Value &AllocList(Value &v, int64_t len)
 	return v;
 }
 
+Value &AllocNumberList(Value &v, const double *numbers, int64_t len)
+{
+	AllocList(v, 0);
+	if (v.type != ValueType_List || len <= 0)
+		return v;
+
+	List *l = v.u.list;
+	if (!ListReserve(l, len))
+		return v;
+
+	memcpy(l->numbers, numbers, len * sizeof(double));
+	l->len = len;
+
+	return v;
+}
+
 Value &RetainValue(Value &v)
 {
 	if (!(v.flags & VALUE_STATIC))
@@ -1161,6 +2381,7 @@ void ReleaseValue(Value &v)
 	}
 
 	v.type = ValueType_None;
+	v.flags = 0;
 	v.u.ref = nullptr;
 }
 
@@ -1171,6 +2392,8 @@ void FreeValue(Value &v)
 	if (v.type == ValueType_String)
 	{
 		assert(v.u.ref->count == 0);
+		StringDropIndex(v.u.string);
+		HeapSub(v.u.string->heap, STRING_SIZE(v.u.string->capacity));
 		free(v.u.string);
 		v.u.ref = nullptr;
 		v.type = ValueType_None;
@@ -1179,8 +2402,14 @@ void FreeValue(Value &v)
 	{
 		assert(v.u.ref->count == 0);
 
-		for (int64_t i = 0; i < v.u.list->len; i++)
-			ReleaseValue(v.u.list->values[i]);
-		free(v.u.list);
+		List *l = v.u.list;
+
+		ListDropIndex(l);
+		ListReleaseStorage(l);
+		HeapSub(l->heap, sizeof(List));
+		free(l);
+
+		v.u.ref = nullptr;
+		v.type = ValueType_None;
 	}
 }
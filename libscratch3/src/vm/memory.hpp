@@ -11,8 +11,29 @@
 // initial capacity for lists
 #define INITIAL_CAPACITY 8
 
+// minimum length of a list before searches build a hash index
+#define LIST_INDEX_THRESHOLD 32
+
+// number of searches of a list before a hash index is built
+#define LIST_INDEX_SEARCHES 4
+
+// code points between entries of a string offset index
+#define STRING_INDEX_STRIDE 32
+
 #define VALUE_STATIC 0x01 // value is statically allocated
 
+// largest magnitude at which every integer is exactly representable as a double
+#define MAX_EXACT_INTEGER (1ll << 53)
+
+/* Reference::flags for strings */
+#define STRING_NUMBER_CACHED 0x02 // String::number has been computed
+#define STRING_NUMBER_VALID 0x04 // string is a valid number, stored in String::number
+#define STRING_ASCII_CACHED 0x08 // STRING_ASCII has been computed
+#define STRING_ASCII 0x10 // string only contains ASCII characters
+
+/* Reference::flags for lists */
+#define LIST_PACKED 0x02 // elements are numbers, stored in List::numbers
+
 using namespace mutil;
 
 enum ValueType
@@ -38,7 +59,10 @@ enum ValueType
 
 struct Reference;
 struct String;
+struct StringIndex;
 struct List;
+struct ListIndex;
+struct HeapStats;
 
 struct Value
 {
@@ -71,7 +95,11 @@ struct String
 {
 	Reference ref;
 	int64_t len; // length of the string (excluding null terminator)
+	int64_t capacity; // maximum length str can hold without reallocation
 	int64_t hash; // hash of the string
+	double number; // cached numeric value, see STRING_NUMBER_* flags in ref.flags
+	StringIndex *index; // code point offsets of non-ASCII strings, built lazily (may be null)
+	HeapStats *heap; // heap the string is accounted against (may be null)
 	char str[1]; // string data, null-terminated
 };
 
@@ -80,9 +108,37 @@ struct List
 	Reference ref;
 	int64_t len; // number of elements in the list
 	int64_t capacity; // capacity of the list
-	Value *values; // array of values, of length capacity
+	int64_t head; // index of the first element, elements wrap around capacity
+
+	union
+	{
+		Value *values; // ring buffer of values, of length capacity (copy-on-write)
+		double *numbers; // ring buffer of numbers, of length capacity (LIST_PACKED, copy-on-write)
+	};
+
+	ListIndex *index; // hash index for searches, built lazily (may be null)
+	int64_t searches; // number of searches since the index was dropped
+	HeapStats *heap; // heap the list and its index are accounted against (may be null)
 };
 
+//! \brief Heap usage of a virtual machine
+//!
+//! Strings and lists, including list storage and hash indices, are
+//! accounted against the heap returned by GetCurrentHeap when they
+//! were allocated. Each allocation records its heap, so it is freed
+//! from the same heap regardless of which virtual machine is running.
+//! Allocations made while no virtual machine is running are not
+//! accounted.
+struct HeapStats
+{
+	int64_t used; // bytes allocated
+	int64_t peak; // largest value of used
+	int64_t limit; // maximum value of used, 0 for no limit
+	int64_t failures; // number of allocations denied by the limit
+};
+
+#define STRING_HASH_SEED 1315423911
+
 //! \brief Hash a string
 //!
 //! \param s The string to hash
@@ -90,12 +146,30 @@ struct List
 //! \return The hash of the string
 constexpr uint32_t HashString(const char *s)
 {
-	uint32_t hash = 1315423911;
+	uint32_t hash = STRING_HASH_SEED;
 	while (*s)
 		hash ^= ((hash << 5) + *s++ + (hash >> 2));
 	return hash;
 }
 
+//! \brief Continue hashing a string
+//!
+//! HashStringAppend(HashString(a), b, strlen(b)) is equal to
+//! HashString(a + b), so appending to a string does not require
+//! rehashing its existing contents.
+//!
+//! \param hash The hash of the preceding characters
+//! \param s The characters to append
+//! \param len The number of characters to append
+//!
+//! \return The hash of the combined string
+constexpr uint32_t HashStringAppend(uint32_t hash, const char *s, int64_t len)
+{
+	for (int64_t i = 0; i < len; i++)
+		hash ^= ((hash << 5) + s[i] + (hash >> 2));
+	return hash;
+}
+
 //! \brief Compare strings case-insensitively
 //!
 //! \param lstr The left string
@@ -130,6 +204,59 @@ bool Truth(const Value &val);
 //! \return true if the values are equal, false otherwise
 bool Equals(const Value &lhs, const Value &rhs);
 
+//! \brief Parse a number with Scratch semantics
+//!
+//! Accepts decimal numbers with an optional sign, fraction and
+//! exponent, hexadecimal, octal and binary literals (0x, 0o, 0b) and
+//! Infinity, surrounded by optional whitespace. The string does not
+//! need to be null-terminated and no memory is allocated.
+//!
+//! \param str The string to parse
+//! \param len The length of the string
+//! \param result Receives the parsed number, or 0 if the string is
+//! not a valid number
+//!
+//! \return true if the string is a valid number, false otherwise
+bool ParseNumber(const char *str, int64_t len, double *result);
+
+//! \brief Get the numeric value of a string
+//!
+//! The result is cached in the string, so subsequent calls are
+//! constant time. Statically allocated strings must have their cache
+//! populated ahead of time (see CacheStringNumber), otherwise they are
+//! parsed on every call.
+//!
+//! \param s The string
+//! \param result Receives the numeric value, or 0 if the string is
+//! not a valid number
+//!
+//! \return true if the string is a valid number, false otherwise
+bool StringToNumber(const String *s, double *result);
+
+//! \brief Populate the numeric cache of a string
+//!
+//! \param s The string
+void CacheStringNumber(String *s);
+
+//! \brief Populate the ASCII flag of a string
+//!
+//! Statically allocated strings must have the flag populated ahead of
+//! time, otherwise they are scanned on every indexing operation.
+//!
+//! \param s The string
+void CacheStringAscii(String *s);
+
+//! \brief Hash a value consistently with Equals
+//!
+//! Values that compare equal with Equals have the same hash, so
+//! numbers hash by their numeric value (including numeric strings)
+//! and other strings hash case-insensitively.
+//!
+//! \param v The value to hash
+//!
+//! \return The hash of the value
+uint64_t HashValue(const Value &v);
+
 //
 /////////////////////////////////////////////////////////////////////
 // Assignment operations
@@ -171,9 +298,53 @@ void ListInsert(const Value &list, int64_t index, const Value &v);
 //
 
 Value &CvtString(Value &v);
+
+//! \brief Get the length of a value as a string
+//!
+//! Strings are measured in UTF-8 code points. ASCII strings take
+//! constant time, other strings are counted once and cached in their
+//! offset index.
+//!
+//! \param v The value
+//!
+//! \return The number of characters in the value
 int64_t ValueLength(const Value &v);
+
+//! \brief Concatenate two values as strings
+//!
+//! If lhs is a string which is not shared (its reference count is 1),
+//! rhs is appended in place and the string grows geometrically, so
+//! repeated appends run in amortized linear time. Otherwise, a new
+//! string is allocated.
+//!
+//! \param lhs The left value, receives the result
+//! \param rhs The right value
+//!
+//! \return lhs
 Value &ConcatValue(Value &lhs, const Value &rhs);
-char ValueCharAt(const Value &v, int64_t index);
+
+//! \brief Get a character of a value as a string
+//!
+//! Strings are indexed by UTF-8 code point. ASCII strings are indexed
+//! directly, other strings build a sparse index of code point offsets
+//! on first use, so later lookups only scan STRING_INDEX_STRIDE code
+//! points at most.
+//!
+//! \param lhs Receives the character as a string, or an empty value
+//! if index is out of range
+//! \param v The value, may alias lhs
+//! \param index The 1-based index of the character
+//!
+//! \return lhs
+Value &ValueCharAt(Value &lhs, const Value &v, int64_t index);
+
+//! \brief Check whether a value contains another, ignoring case
+//!
+//! \param lhs The value to search
+//! \param rhs The value to search for
+//!
+//! \return true if the string representation of lhs contains the
+//! string representation of rhs
 bool ValueContains(const Value &lhs, const Value &rhs);
 
 //
@@ -187,6 +358,41 @@ const char *ToString(const Value &v, int64_t *len = nullptr);
 IntVector4 ToRGBA(const Value &v);
 IntVector3 ToRGB(const Value &v);
 
+// minimum size of the scratch buffer passed to GetStringView
+#define STRING_VIEW_SCRATCH 32
+
+//! \brief Read-only view of the string representation of a value
+struct StringView
+{
+	const char *str; // characters, null-terminated
+	int64_t len; // number of characters, excluding the null terminator
+};
+
+//! \brief Get the string representation of a value without allocating
+//!
+//! Strings are viewed in place, numbers are formatted into scratch and
+//! other values are viewed as string literals.
+//!
+//! \param v Value to view
+//! \param scratch Buffer to format numbers into
+//! \param size Size of scratch, at least STRING_VIEW_SCRATCH
+//!
+//! \return A view which is valid while v and scratch are unchanged
+StringView GetStringView(const Value &v, char *scratch, size_t size);
+
+//! \brief Get the string representation of a value without allocating
+//!
+//! \param v Value to view
+//! \param scratch Buffer to format numbers into
+//!
+//! \return A view which is valid while v and scratch are unchanged
+template <size_t N>
+inline StringView GetStringView(const Value &v, char (&scratch)[N])
+{
+	static_assert(N >= STRING_VIEW_SCRATCH, "scratch buffer is too small");
+	return GetStringView(v, scratch, N);
+}
+
 //! \brief Returns a trivial string representation of a value
 //! 
 //! If the value requires processing to convert to a string (such
@@ -214,6 +420,185 @@ Value &ValueNeg(Value &lhs);
 Value &ValueGreater(Value &lhs, const Value &rhs);
 Value &ValueLess(Value &lhs, const Value &rhs);
 
+//
+/////////////////////////////////////////////////////////////////////
+// Number operators
+//
+// Used by the typed opcodes, which the compiler emits when both
+// operands are inferred to be numbers. Numbers own no storage, so the
+// result is written in place. If an operand is not a number after
+// all, they fall back to the generic operator.
+//
+
+//! \brief Check whether a value is an integer or a real
+//!
+//! \param v The value
+//!
+//! \return true if v is a number
+constexpr bool IsNumber(const Value &v)
+{
+	return v.type == ValueType_Integer || v.type == ValueType_Real;
+}
+
+//! \brief Get a number as a real
+//!
+//! \param v The value, must be a number
+//!
+//! \return The value of v
+constexpr double NumberToReal(const Value &v)
+{
+	return v.type == ValueType_Integer ? static_cast<double>(v.u.integer) : v.u.real;
+}
+
+inline Value &NumberAdd(Value &lhs, const Value &rhs)
+{
+	if (lhs.type == ValueType_Integer && rhs.type == ValueType_Integer)
+		lhs.u.integer += rhs.u.integer;
+	else if (IsNumber(lhs) && IsNumber(rhs))
+	{
+		lhs.u.real = NumberToReal(lhs) + NumberToReal(rhs);
+		lhs.type = ValueType_Real;
+	}
+	else
+		ValueAdd(lhs, rhs);
+	return lhs;
+}
+
+inline Value &NumberSub(Value &lhs, const Value &rhs)
+{
+	if (lhs.type == ValueType_Integer && rhs.type == ValueType_Integer)
+		lhs.u.integer -= rhs.u.integer;
+	else if (IsNumber(lhs) && IsNumber(rhs))
+	{
+		lhs.u.real = NumberToReal(lhs) - NumberToReal(rhs);
+		lhs.type = ValueType_Real;
+	}
+	else
+		ValueSub(lhs, rhs);
+	return lhs;
+}
+
+inline Value &NumberMul(Value &lhs, const Value &rhs)
+{
+	if (lhs.type == ValueType_Integer && rhs.type == ValueType_Integer)
+		lhs.u.integer *= rhs.u.integer;
+	else if (IsNumber(lhs) && IsNumber(rhs))
+	{
+		lhs.u.real = NumberToReal(lhs) * NumberToReal(rhs);
+		lhs.type = ValueType_Real;
+	}
+	else
+		ValueMul(lhs, rhs);
+	return lhs;
+}
+
+inline Value &NumberDiv(Value &lhs, const Value &rhs)
+{
+	// division by zero is left to ValueDiv
+	if (IsNumber(lhs) && IsNumber(rhs) && NumberToReal(rhs) != 0.0)
+	{
+		lhs.u.real = NumberToReal(lhs) / NumberToReal(rhs);
+		lhs.type = ValueType_Real;
+	}
+	else
+		ValueDiv(lhs, rhs);
+	return lhs;
+}
+
+inline Value &NumberEquals(Value &lhs, const Value &rhs)
+{
+	if (IsNumber(lhs) && IsNumber(rhs))
+	{
+		bool result = lhs.type == ValueType_Integer && rhs.type == ValueType_Integer ?
+			lhs.u.integer == rhs.u.integer :
+			NumberToReal(lhs) == NumberToReal(rhs);
+		lhs.u.boolean = result;
+		lhs.type = ValueType_Bool;
+		return lhs;
+	}
+
+	return SetBool(lhs, Equals(lhs, rhs));
+}
+
+inline Value &NumberGreater(Value &lhs, const Value &rhs)
+{
+	if (IsNumber(lhs) && IsNumber(rhs))
+	{
+		bool result = lhs.type == ValueType_Integer && rhs.type == ValueType_Integer ?
+			lhs.u.integer > rhs.u.integer :
+			NumberToReal(lhs) > NumberToReal(rhs);
+		lhs.u.boolean = result;
+		lhs.type = ValueType_Bool;
+		return lhs;
+	}
+
+	return ValueGreater(lhs, rhs);
+}
+
+inline Value &NumberLess(Value &lhs, const Value &rhs)
+{
+	if (IsNumber(lhs) && IsNumber(rhs))
+	{
+		bool result = lhs.type == ValueType_Integer && rhs.type == ValueType_Integer ?
+			lhs.u.integer < rhs.u.integer :
+			NumberToReal(lhs) < NumberToReal(rhs);
+		lhs.u.boolean = result;
+		lhs.type = ValueType_Bool;
+		return lhs;
+	}
+
+	return ValueLess(lhs, rhs);
+}
+
+//! \brief Check whether a double holds an integer exactly
+//! representable as an Integer value
+//!
+//! Packed list elements for which this holds are read back as
+//! integers, everything else as reals.
+//!
+//! \param d The number
+//!
+//! \return true if d is whole and within MAX_EXACT_INTEGER
+inline bool IsPackedInteger(double d)
+{
+	return d >= -MAX_EXACT_INTEGER && d <= MAX_EXACT_INTEGER && d == static_cast<double>(static_cast<int64_t>(d));
+}
+
+//! \brief Check whether a value can be stored in a packed list
+//!
+//! Only values which read back with the same type and value are
+//! packed, so whole-number reals and -0.0 are left unpacked.
+//!
+//! \param v The value
+//! \param d Receives the value as a double
+//!
+//! \return true if v is a number that round trips through a double
+inline bool IsPackable(const Value &v, double *d)
+{
+	if (v.type == ValueType_Real && !IsPackedInteger(v.u.real))
+	{
+		*d = v.u.real;
+		return true;
+	}
+
+	if (v.type == ValueType_Integer && v.u.integer >= -MAX_EXACT_INTEGER && v.u.integer <= MAX_EXACT_INTEGER)
+	{
+		*d = static_cast<double>(v.u.integer);
+		return true;
+	}
+
+	return false;
+}
+
+//! \brief Copy a value, such that lists are not shared
+//!
+//! Copied lists share their storage with the original until either
+//! list is modified.
+//!
+//! \param lhs The destination
+//! \param rhs The value to copy
+//!
+//! \return lhs
 Value &ValueDeepCopy(Value &lhs, const Value &rhs);
 
 //
@@ -221,6 +606,24 @@ Value &ValueDeepCopy(Value &lhs, const Value &rhs);
 // Allocation operations
 //
 
+//! \brief Get the heap of the current virtual machine
+//!
+//! Defined by the virtual machine.
+//!
+//! \return The heap, or nullptr if no virtual machine is active, in
+//! which case allocations are not accounted
+HeapStats *GetCurrentHeap();
+
+//! \brief Handle an allocation that would exceed the heap limit
+//!
+//! Defined by the virtual machine. Raises OutOfMemory in the running
+//! script and does not return. If no script is running, the function
+//! returns and the allocation fails.
+//!
+//! \param heap The heap
+//! \param size Size of the allocation in bytes
+void HeapLimitExceeded(HeapStats *heap, int64_t size);
+
 //! \brief Allocate a string
 //!
 //! Allocates a String object with enough space to store a string of
@@ -247,6 +650,19 @@ Value &AllocString(Value &v, int64_t len);
 //! \return v
 Value &AllocList(Value &v, int64_t len);
 
+//! \brief Allocate a list of numbers
+//!
+//! The list is packed, as if the numbers were appended to an empty
+//! list one by one. The numbers must be in packed form, that is each
+//! element for which IsPackedInteger holds is an integer.
+//!
+//! \param v Value to store the list
+//! \param numbers The elements
+//! \param len Number of elements
+//!
+//! \return v
+Value &AllocNumberList(Value &v, const double *numbers, int64_t len);
+
 //! \brief Initialize a value
 //! 
 //! Only call this function on a value that has not been initialized.
@@ -561,9 +977,9 @@ public:
 		return *this;
 	}
 
-	constexpr bool IsZeroLike() const
+	inline bool IsZeroLike() const
 	{
-		if (_type == ValueType_None || _type == ValueType_String)
+		if (_type == ValueType_None)
 			return true;
 
 		if (!_hasValue)
@@ -573,6 +989,8 @@ public:
 		{
 		default:
 			return false;
+		case ValueType_String:
+			return ToReal(_value) == 0.0;
 		case ValueType_Integer:
 			return _value.u.integer == 0;
 		case ValueType_Real:
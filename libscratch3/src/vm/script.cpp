@@ -116,11 +116,37 @@ int ScriptMain()
 			Pop();
 			break;
 		}
-		case Op_listcreate:
+		case Op_catstatic: {
+			bc::VarId *id = (bc::VarId *)self->pc;
+			self->pc += sizeof(bc::VarId);
+			ConcatValue(VM->GetStaticVariable(id->ToInt()), StackAt(-1));
+			Pop();
+			break;
+		}
+		case Op_catfield: {
+			bc::VarId *id = (bc::VarId *)self->pc;
+			self->pc += sizeof(bc::VarId);
+			ConcatValue(sprite->GetField(id->ToInt()), StackAt(-1));
+			Pop();
+			break;
+		}
+		case Op_listcreate: {
 			i64 = *(int64_t *)self->pc;
 			self->pc += sizeof(int64_t);
-			AllocList(Push(), i64);
+
+			// items are pushed in reverse, first item on top
+			Value list;
+			InitializeValue(list);
+			AllocList(list, 0);
+			for (int64_t i = 0; i < i64; i++)
+				ListAppend(list, StackAt(-1 - static_cast<int>(i)));
+
+			for (int64_t i = 0; i < i64; i++)
+				Pop();
+
+			Push() = list; // transfer ownership
 			break;
+		}
 		case Op_jmp:
 			ui64 = *(uint64_t *)self->pc;
 			self->pc = bytecode + ui64;
@@ -255,21 +281,25 @@ int ScriptMain()
 			Pop();
 			break;
 		case Op_gt:
-			SetBool(StackAt(-2), ToReal(StackAt(-2)) > ToReal(StackAt(-1)));
+			ValueGreater(StackAt(-2), StackAt(-1));
 			Pop();
 			break;
-		case Op_ge:
-			SetBool(StackAt(-2), ToReal(StackAt(-2)) >= ToReal(StackAt(-1)));
+		case Op_ge: {
+			Value &v = ValueLess(StackAt(-2), StackAt(-1));
+			v.u.boolean = !v.u.boolean;
 			Pop();
 			break;
+		}
 		case Op_lt:
-			SetBool(StackAt(-2), ToReal(StackAt(-2)) < ToReal(StackAt(-1)));
+			ValueLess(StackAt(-2), StackAt(-1));
 			Pop();
 			break;
-		case Op_le:
-			SetBool(StackAt(-2), ToReal(StackAt(-2)) <= ToReal(StackAt(-1)));
+		case Op_le: {
+			Value &v = ValueGreater(StackAt(-2), StackAt(-1));
+			v.u.boolean = !v.u.boolean;
 			Pop();
 			break;
+		}
 		case Op_land:
 			SetBool(StackAt(-2), Truth(StackAt(-2)) && Truth(StackAt(-1)));
 			Pop();
@@ -301,6 +331,34 @@ int ScriptMain()
 			ValueMod(StackAt(-2), StackAt(-1));
 			Pop();
 			break;
+		case Op_addnum:
+			NumberAdd(StackAt(-2), StackAt(-1));
+			Pop();
+			break;
+		case Op_subnum:
+			NumberSub(StackAt(-2), StackAt(-1));
+			Pop();
+			break;
+		case Op_mulnum:
+			NumberMul(StackAt(-2), StackAt(-1));
+			Pop();
+			break;
+		case Op_divnum:
+			NumberDiv(StackAt(-2), StackAt(-1));
+			Pop();
+			break;
+		case Op_eqnum:
+			NumberEquals(StackAt(-2), StackAt(-1));
+			Pop();
+			break;
+		case Op_gtnum:
+			NumberGreater(StackAt(-2), StackAt(-1));
+			Pop();
+			break;
+		case Op_ltnum:
+			NumberLess(StackAt(-2), StackAt(-1));
+			Pop();
+			break;
 		case Op_neg:
 			ValueNeg(StackAt(-1));
 			break;
@@ -367,14 +425,14 @@ int ScriptMain()
 		case Op_strcat:
 			lhs = &StackAt(-2);
 			rhs = &StackAt(-1);
-			ConcatValue(*rhs, *lhs);
+			ConcatValue(*lhs, *rhs);
 			Pop();
 			break;
 		case Op_charat:
 			lhs = &StackAt(-2);
 			i64 = ToInteger(StackAt(-1));
 			Pop();
-			SetChar(*lhs, ValueCharAt(*lhs, i64));
+			ValueCharAt(*lhs, *lhs, i64);
 			break;
 		case Op_strlen:
 			lhs = &StackAt(-1);
@@ -383,7 +441,7 @@ int ScriptMain()
 		case Op_strstr:
 			lhs = &StackAt(-2);
 			rhs = &StackAt(-1);
-			SetBool(*lhs, ValueContains(*rhs, *lhs));
+			SetBool(*lhs, ValueContains(*lhs, *rhs));
 			Pop();
 			break;
 		case Op_inc:
@@ -863,16 +921,16 @@ int ScriptMain()
 			self->pc += sizeof(uint64_t); // skip event
 			break;
 		case Op_send: {
-			int64_t len;
-			const char *message = ToString(StackAt(-1), &len);
-			VM->Send(std::string(message, len));
+			char buf[64];
+			StringView message = GetStringView(StackAt(-1), buf);
+			VM->Send(std::string(message.str, message.len));
 			Pop();
 			break;
 		}
 		case Op_sendandwait: {
-			int64_t len;
-			const char *message = ToString(StackAt(-1), &len);
-			VM->SendAndWait(std::string(message, len));
+			char buf[64];
+			StringView message = GetStringView(StackAt(-1), buf);
+			VM->SendAndWait(std::string(message.str, message.len));
 			Pop();
 			break;
 		}
@@ -1016,18 +1074,15 @@ int ScriptMain()
 			Assign(Push(), VM->GetIO().GetAnswer());
 			break;
 		case Op_keypressed: {
-			Value &v = CvtString(StackAt(-1));
-			if (v.type != ValueType_String)
-			{
-				SetBool(v, false);
-				break;
-			}
+			Value &v = StackAt(-1);
+
+			char buf[64];
+			StringView s = GetStringView(v, buf);
 
-			String *s = v.u.string;
 			int scancode;
-			if (s->len == 1)
+			if (s.len == 1)
 			{
-				char c = tolower(s->str[0]);
+				char c = tolower(s.str[0]);
 				if (c >= 'a' && c <= 'z')
 					scancode = SDL_SCANCODE_A + (c - 'a');
 				else if (c >= '0' && c <= '9')
@@ -1038,17 +1093,17 @@ int ScriptMain()
 					break;
 				}
 			}
-			else if (StringEqualsRaw(s->str, "space"))
+			else if (StringEqualsRaw(s.str, "space"))
 				scancode = SDL_SCANCODE_SPACE;
-			else if (StringEqualsRaw(s->str, "up arrow"))
+			else if (StringEqualsRaw(s.str, "up arrow"))
 				scancode = SDL_SCANCODE_UP;
-			else if (StringEqualsRaw(s->str, "down arrow"))
+			else if (StringEqualsRaw(s.str, "down arrow"))
 				scancode = SDL_SCANCODE_DOWN;
-			else if (StringEqualsRaw(s->str, "right arrow"))
+			else if (StringEqualsRaw(s.str, "right arrow"))
 				scancode = SDL_SCANCODE_RIGHT;
-			else if (StringEqualsRaw(s->str, "left arrow"))
+			else if (StringEqualsRaw(s.str, "left arrow"))
 				scancode = SDL_SCANCODE_LEFT;
-			else if (StringEqualsRaw(s->str, "any"))
+			else if (StringEqualsRaw(s.str, "any"))
 				scancode = -1;
 			else
 			{
@@ -5,6 +5,8 @@
 #include <sndfile.h>
 #include <mutil/mutil.h>
 
+#include "../resource.hpp"
+
 using namespace mutil;
 
 struct SoundMemoryFile
@@ -64,6 +66,46 @@ static SF_VIRTUAL_IO _sfVirtualIo = {
 	mem_tell
 };
 
+float *DecodeSound(const uint8_t *data, size_t size, int *channels, int *sampleRate, unsigned long *frameCount)
+{
+	SoundMemoryFile fileData;
+	fileData.data = data;
+	fileData.size = size;
+	fileData.pos = 0;
+
+	SF_INFO info = {};
+	SNDFILE *file = sf_open_virtual(&_sfVirtualIo, SFM_READ, &info, &fileData);
+	if (!file)
+	{
+		printf("DecodeSound: sf_open_virtual failed\n");
+		return nullptr;
+	}
+
+	if (info.channels > 2)
+	{
+		printf("DecodeSound: max 2 channels per audio stream\n");
+		sf_close(file);
+		return nullptr;
+	}
+
+	float *samples = new float[info.frames * info.channels];
+	sf_count_t read = sf_readf_float(file, samples, info.frames);
+	if (read != info.frames)
+	{
+		printf("DecodeSound: sf_readf_float failed\n");
+		delete[] samples;
+		sf_close(file);
+		return nullptr;
+	}
+
+	sf_close(file);
+
+	*channels = info.channels;
+	*sampleRate = info.samplerate;
+	*frameCount = info.frames;
+	return samples;
+}
+
 void DSPController::SetPitch(double pitch)
 {
 	// 2^(1/12)
@@ -94,6 +136,8 @@ bool AbstractSound::Init(uint8_t *bytecode, size_t bytecodeSize, const bc::Sound
 
 	_data = bytecode + info->data;
 	_dataSize = info->dataSize;
+	_compressed = (info->flags & ASSET_COMPRESSED) != 0;
+	_baked = info->baked ? (const bc::BakedSound *)(bytecode + info->baked) : nullptr;
 
 	_streamed = stream;
 
@@ -105,6 +149,32 @@ bool AbstractSound::Load()
 	if (_audioStream)
 		return false; // already loaded, not an error
 
+	if (_source)
+	{
+		// decoded by the source, share its stream
+		_source->Load();
+
+		_streamSize = _source->_streamSize;
+		_audioStream = _source->_audioStream;
+		_frameCount = _source->_frameCount;
+		_nChannels = _source->_nChannels;
+		_sampleRate = _source->_sampleRate;
+
+		return _audioStream != nullptr;
+	}
+
+	if (_baked)
+	{
+		// decoded by the compiler, play straight from the program
+		_frameCount = _baked->frameCount;
+		_nChannels = _baked->channels;
+		_sampleRate = _baked->sampleRate;
+		_streamSize = _frameCount * _nChannels;
+		_audioStream = const_cast<float *>(_baked->samples);
+
+		return true;
+	}
+
 	if (_dataSize == 0)
 	{
 		_streamSize = 0;
@@ -116,49 +186,49 @@ bool AbstractSound::Load()
 		return true;
 	}
 
-	SoundMemoryFile fileData;
-	fileData.data = _data;
-	fileData.size = _dataSize;
-	fileData.pos = 0;
+	if (!_compressed)
+		return Decode(_data);
 
-	SF_INFO info = {};
-	SNDFILE *file = sf_open_virtual(&_sfVirtualIo, SFM_READ, &info, &fileData);
-	if (!file)
+	// only needed while decoding
+	uint8_t *data = DecompressAsset(_data, _dataSize);
+	if (!data)
 	{
-		printf("Sound::Load: sf_open_virtual failed (%s)\n", _name.u.string->str);
+		printf("Sound::Load: failed to decompress (%s)\n", _name.u.string->str);
 		return false;
 	}
 
-	_nChannels = info.channels;
-	if (_nChannels > 2)
-	{
-		printf("Sound::Load: max 2 channels per audio stream (%s)\n", _name.u.string->str);
-		sf_close(file);
-		return false;
-	}
-
-	_frameCount = info.frames;
-	_sampleRate = info.samplerate;
+	bool result = Decode(data);
+	free(data);
+	return result;
+}
 
-	_streamSize = _frameCount * _nChannels;
-	_audioStream = new float[_streamSize];
-	sf_count_t read = sf_readf_float(file, _audioStream, _frameCount);
-	if (read != _frameCount)
+bool AbstractSound::Decode(const uint8_t *data)
+{
+	_audioStream = DecodeSound(data, _dataSize, &_nChannels, &_sampleRate, &_frameCount);
+	if (!_audioStream)
 	{
-		printf("Sound::Load: sf_readf_float failed\n");
-		delete[] _audioStream, _audioStream = nullptr;
-		sf_close(file);
+		printf("Sound::Decode: failed to decode (%s)\n", _name.u.string->str);
 		return false;
 	}
 
-	sf_close(file);
+	_streamSize = _frameCount * _nChannels;
 
 	return true;
 }
 
+void AbstractSound::SetSource(AbstractSound *source)
+{
+	assert(!_audioStream);
+	assert(source != this && source->_data == _data);
+
+	_source = source;
+}
+
 AbstractSound::AbstractSound() :
 	_streamed(false),
-	_data(nullptr), _dataSize(0),
+	_source(nullptr),
+	_data(nullptr), _dataSize(0), _compressed(false),
+	_baked(nullptr),
 	_streamSize(0), _audioStream(nullptr),
 	_frameCount(0), _nChannels(0), _sampleRate(0),
 	_voiceCount(0)
@@ -179,9 +249,12 @@ void AbstractSound::Cleanup()
 		abort();
 	}
 
-	if (_audioStream)
-		delete[] _audioStream, _audioStream = nullptr;
+	if (_audioStream && !_source && !_baked)
+		delete[] _audioStream;
+	_audioStream = nullptr;
 
+	_source = nullptr;
+	_baked = nullptr;
 	_streamed = false;
 
 	ReleaseValue(_name);
@@ -99,6 +99,18 @@ struct STEREO_SAMPLE
 
 class Voice;
 
+//! \brief Decode audio data into interleaved samples.
+//!
+//! \param data The audio data, in any format libsndfile can read.
+//! \param size The size of the data.
+//! \param channels Receives the number of channels, at most 2.
+//! \param sampleRate Receives the sample rate.
+//! \param frameCount Receives the number of frames.
+//!
+//! \return The samples, which must be freed with delete[], or nullptr
+//! if the data could not be decoded.
+float *DecodeSound(const uint8_t *data, size_t size, int *channels, int *sampleRate, unsigned long *frameCount);
+
 //! \brief Represents a sound.
 class AbstractSound final
 {
@@ -120,6 +132,18 @@ public:
 	//! \return Whether the sound was successfully loaded.
 	bool Load();
 
+	//! \brief Share the decoded audio of another sound.
+	//!
+	//! Sounds with the same data share a single audio stream. Must be
+	//! called after Init and before Load.
+	//!
+	//! \param source A sound with the same data, which must outlive
+	//! this sound.
+	void SetSource(AbstractSound *source);
+
+	constexpr const uint8_t *GetData() const { return _data; }
+	constexpr uint64_t GetDataSize() const { return _dataSize; }
+
 	constexpr size_t GetStreamSize() const { return _streamSize; }
 	constexpr const float *GetAudioStream() const { return _audioStream; }
 	constexpr unsigned long GetFrameCount() const { return _frameCount; }
@@ -141,9 +165,13 @@ private:
 
 	bool _streamed; // true if the sound is streamed
 
+	AbstractSound *_source; // sound owning the audio stream, null if this sound owns it
+
 	// data
 	uint8_t *_data; // full audio data
-	uint64_t _dataSize; // size of the data
+	uint64_t _dataSize; // size of the uncompressed data
+	bool _compressed; // whether _data is a bc::CompressedData
+	const bc::BakedSound *_baked; // decoded audio in the program, null if not baked
 
 	// stream
 	size_t _streamSize; // size of the stream buffer (in bytes)
@@ -154,6 +182,13 @@ private:
 
 	size_t _voiceCount; // number of voices playing this sound
 
+	//! \brief Decode the sound data into the audio stream.
+	//!
+	//! \param data The uncompressed sound data, only used during the call.
+	//!
+	//! \return Whether the sound was decoded.
+	bool Decode(const uint8_t *data);
+
 	//! \brief Release resources.
 	void Cleanup();
 };
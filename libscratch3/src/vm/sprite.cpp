@@ -109,9 +109,14 @@ Sprite *AbstractSprite::Instantiate(Sprite *tmpl)
         inst->_dsp = tmpl->_dsp;
         inst->_gec = tmpl->_gec;
 
-        // Copy fields from template
+        // Copy fields from template, clones get their own lists
         for (uint32_t i = 0; i < _nFields; i++)
-            Assign(inst->_fields[i], tmpl->_fields[i]);
+        {
+            if (tmpl->_fields[i].type == ValueType_List)
+                ValueDeepCopy(inst->_fields[i], tmpl->_fields[i]);
+            else
+                Assign(inst->_fields[i], tmpl->_fields[i]);
+        }
     }
     else
     {
@@ -126,7 +131,12 @@ Sprite *AbstractSprite::Instantiate(Sprite *tmpl)
         inst->_costume = _info->currentCostume;
         // No initializers for GEC and DSP
 
-        // TODO: read initial field values from sprite info
+        if (_info->fields)
+        {
+            const bc::InitialValue *fields = (const bc::InitialValue *)(VM->GetBytecode() + _info->fields);
+            for (uint32_t i = 0; i < _nFields; i++)
+                VM->LoadInitialValue(inst->_fields[i], fields[i]);
+        }
     }
 
     inst->InvalidateTransform();
@@ -0,0 +1,329 @@
+#include "strkernel.hpp"
+
+#include <cstring>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define STRKERNEL_SSE
+#define STRKERNEL_AVX2
+#elif defined(__SSE4_1__)
+#include <smmintrin.h>
+#define STRKERNEL_SSE
+#endif
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+//! \brief Index of the lowest set bit, x must not be 0
+static inline int LowestBit(uint32_t x)
+{
+#if defined(_MSC_VER)
+	unsigned long index;
+	_BitScanForward(&index, x);
+	return static_cast<int>(index);
+#else
+	return __builtin_ctz(x);
+#endif
+}
+
+//! \brief Number of set bits
+static inline int CountBits(uint32_t x)
+{
+#if defined(_MSC_VER)
+	return static_cast<int>(__popcnt(x));
+#else
+	return __builtin_popcount(x);
+#endif
+}
+
+//! \brief Index of the highest set bit, x must not be 0
+static inline int HighestBit(uint32_t x)
+{
+#if defined(_MSC_VER)
+	unsigned long index;
+	_BitScanReverse(&index, x);
+	return static_cast<int>(index);
+#else
+	return 31 - __builtin_clz(x);
+#endif
+}
+
+#if defined(STRKERNEL_AVX2)
+
+#define VEC_SIZE 32
+#define VEC_FULL 0xffffffffu
+
+typedef __m256i Vec;
+
+static inline Vec VecLoad(const char *p) { return _mm256_loadu_si256((const __m256i *)p); }
+static inline Vec VecSet(char c) { return _mm256_set1_epi8(c); }
+static inline uint32_t VecMask(Vec v) { return static_cast<uint32_t>(_mm256_movemask_epi8(v)); }
+static inline Vec VecEq(Vec a, Vec b) { return _mm256_cmpeq_epi8(a, b); }
+static inline Vec VecGt(Vec a, Vec b) { return _mm256_cmpgt_epi8(a, b); }
+static inline Vec VecAnd(Vec a, Vec b) { return _mm256_and_si256(a, b); }
+static inline Vec VecOr(Vec a, Vec b) { return _mm256_or_si256(a, b); }
+
+#elif defined(STRKERNEL_SSE)
+
+#define VEC_SIZE 16
+#define VEC_FULL 0xffffu
+
+typedef __m128i Vec;
+
+static inline Vec VecLoad(const char *p) { return _mm_loadu_si128((const __m128i *)p); }
+static inline Vec VecSet(char c) { return _mm_set1_epi8(c); }
+static inline uint32_t VecMask(Vec v) { return static_cast<uint32_t>(_mm_movemask_epi8(v)); }
+static inline Vec VecEq(Vec a, Vec b) { return _mm_cmpeq_epi8(a, b); }
+static inline Vec VecGt(Vec a, Vec b) { return _mm_cmpgt_epi8(a, b); }
+static inline Vec VecAnd(Vec a, Vec b) { return _mm_and_si128(a, b); }
+static inline Vec VecOr(Vec a, Vec b) { return _mm_or_si128(a, b); }
+
+#endif
+
+#if defined(STRKERNEL_SSE)
+
+//! \brief Fold the ASCII letters in a vector to lowercase
+static inline Vec VecFold(Vec v)
+{
+	// bytes >= 0x80 are negative, so they are never in range
+	Vec upper = VecAnd(VecGt(v, VecSet('A' - 1)), VecGt(VecSet('Z' + 1), v));
+	return VecOr(v, VecAnd(upper, VecSet('a' - 'A')));
+}
+
+//! \brief Get a mask of the whitespace characters in a vector
+static inline uint32_t VecSpaceMask(Vec v)
+{
+	Vec control = VecAnd(VecGt(v, VecSet('\t' - 1)), VecGt(VecSet('\r' + 1), v));
+	return VecMask(VecOr(VecEq(v, VecSet(' ')), control));
+}
+
+//! \brief Get a mask of the characters that are equal, ignoring case
+static inline uint32_t VecEqualsFold(const char *lhs, const char *rhs)
+{
+	return VecMask(VecEq(VecFold(VecLoad(lhs)), VecFold(VecLoad(rhs))));
+}
+
+#endif
+
+bool StrEqualsFold(const char *lhs, const char *rhs, size_t len)
+{
+	size_t i = 0;
+
+#if defined(STRKERNEL_SSE)
+	for (; i + VEC_SIZE <= len; i += VEC_SIZE)
+	{
+		if (VecEqualsFold(lhs + i, rhs + i) != VEC_FULL)
+			return false;
+	}
+#endif
+
+	for (; i < len; i++)
+	{
+		if (FoldChar(lhs[i]) != FoldChar(rhs[i]))
+			return false;
+	}
+
+	return true;
+}
+
+int StrCompareFold(const char *lhs, size_t llen, const char *rhs, size_t rlen)
+{
+	size_t len = llen < rlen ? llen : rlen;
+	size_t i = 0;
+
+#if defined(STRKERNEL_SSE)
+	for (; i + VEC_SIZE <= len; i += VEC_SIZE)
+	{
+		uint32_t mismatch = ~VecEqualsFold(lhs + i, rhs + i) & VEC_FULL;
+		if (mismatch)
+		{
+			i += LowestBit(mismatch);
+			break;
+		}
+	}
+#endif
+
+	for (; i < len; i++)
+	{
+		unsigned char lc = FoldChar(lhs[i]);
+		unsigned char rc = FoldChar(rhs[i]);
+		if (lc != rc)
+			return lc - rc;
+	}
+
+	return (llen > rlen) - (llen < rlen);
+}
+
+const char *StrFindFold(const char *str, size_t len, const char *pattern, size_t plen)
+{
+	if (plen == 0)
+		return str;
+
+	if (plen > len)
+		return nullptr;
+
+	char first = FoldChar(pattern[0]);
+	size_t i = 0;
+
+#if defined(STRKERNEL_SSE)
+	// compare the first and last characters of the pattern at each
+	// position in the block, only candidates are compared in full
+	Vec vfirst = VecSet(first);
+	Vec vlast = VecSet(FoldChar(pattern[plen - 1]));
+
+	for (; i + plen - 1 + VEC_SIZE <= len; i += VEC_SIZE)
+	{
+		Vec head = VecEq(VecFold(VecLoad(str + i)), vfirst);
+		Vec tail = VecEq(VecFold(VecLoad(str + i + plen - 1)), vlast);
+
+		uint32_t candidates = VecMask(VecAnd(head, tail));
+		while (candidates)
+		{
+			size_t pos = i + LowestBit(candidates);
+			if (StrEqualsFold(str + pos, pattern, plen))
+				return str + pos;
+			candidates &= candidates - 1;
+		}
+	}
+#endif
+
+	for (; i + plen <= len; i++)
+	{
+		if (FoldChar(str[i]) == first && StrEqualsFold(str + i, pattern, plen))
+			return str + i;
+	}
+
+	return nullptr;
+}
+
+void StrTrim(const char *&begin, const char *&end)
+{
+#if defined(STRKERNEL_SSE)
+	while (end - begin >= VEC_SIZE)
+	{
+		uint32_t text = ~VecSpaceMask(VecLoad(begin)) & VEC_FULL;
+		if (text)
+		{
+			begin += LowestBit(text);
+			break;
+		}
+
+		begin += VEC_SIZE;
+	}
+
+	while (end - begin >= VEC_SIZE)
+	{
+		uint32_t text = ~VecSpaceMask(VecLoad(end - VEC_SIZE)) & VEC_FULL;
+		if (text)
+		{
+			end -= VEC_SIZE - 1 - HighestBit(text);
+			break;
+		}
+
+		end -= VEC_SIZE;
+	}
+#endif
+
+	while (begin < end && IsSpaceChar(*begin))
+		begin++;
+	while (end > begin && IsSpaceChar(end[-1]))
+		end--;
+}
+
+bool StrIsAscii(const char *str, size_t len)
+{
+	size_t i = 0;
+
+#if defined(STRKERNEL_SSE)
+	for (; i + VEC_SIZE <= len; i += VEC_SIZE)
+	{
+		// the mask holds the high bit of each byte
+		if (VecMask(VecLoad(str + i)))
+			return false;
+	}
+#endif
+
+	for (; i < len; i++)
+	{
+		if (static_cast<unsigned char>(str[i]) >= 0x80)
+			return false;
+	}
+
+	return true;
+}
+
+size_t StrCountCodePoints(const char *str, size_t len)
+{
+	size_t count = 0;
+	size_t i = 0;
+
+#if defined(STRKERNEL_SSE)
+	// continuation bytes are 0x80-0xbf, which are less than -64 as signed bytes
+	Vec limit = VecSet(static_cast<char>(0xc0));
+	for (; i + VEC_SIZE <= len; i += VEC_SIZE)
+	{
+		uint32_t continuation = VecMask(VecGt(limit, VecLoad(str + i)));
+		count += VEC_SIZE - CountBits(continuation);
+	}
+#endif
+
+	for (; i < len; i++)
+	{
+		if (IsCodePointStart(str[i]))
+			count++;
+	}
+
+	return count;
+}
+
+//! \brief Mix a 16 byte block into a hash
+static inline uint64_t HashBlock(uint64_t h, const char *block)
+{
+	uint64_t lo, hi;
+	memcpy(&lo, block, sizeof(lo));
+	memcpy(&hi, block + sizeof(lo), sizeof(hi));
+
+	h ^= lo * 0x9e3779b97f4a7c15ull;
+	h = ((h << 27) | (h >> 37)) * 0xff51afd7ed558ccdull;
+	h ^= hi * 0xc2b2ae3d27d4eb4full;
+	h = ((h << 31) | (h >> 33)) * 0x165667b19e3779f9ull;
+	return h;
+}
+
+uint64_t StrHashFold(const char *str, size_t len)
+{
+	uint64_t h = 0xcbf29ce484222325ull ^ (len * 0x100000001b3ull);
+	char block[16];
+	size_t i = 0;
+
+	// blocks are folded before hashing, so the scalar and vector paths
+	// produce the same hash
+	for (; i + sizeof(block) <= len; i += sizeof(block))
+	{
+#if defined(STRKERNEL_SSE)
+		__m128i v = _mm_loadu_si128((const __m128i *)(str + i));
+		__m128i upper = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('A' - 1)), _mm_cmpgt_epi8(_mm_set1_epi8('Z' + 1), v));
+		_mm_storeu_si128((__m128i *)block, _mm_or_si128(v, _mm_and_si128(upper, _mm_set1_epi8('a' - 'A'))));
+#else
+		for (size_t j = 0; j < sizeof(block); j++)
+			block[j] = FoldChar(str[i + j]);
+#endif
+		h = HashBlock(h, block);
+	}
+
+	if (i < len)
+	{
+		memset(block, 0, sizeof(block));
+		for (size_t j = 0; i + j < len; j++)
+			block[j] = FoldChar(str[i + j]);
+		h = HashBlock(h, block);
+	}
+
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdull;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ull;
+	h ^= h >> 33;
+	return h;
+}
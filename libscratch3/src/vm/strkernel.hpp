@@ -0,0 +1,108 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// String kernels used by comparisons and searches. Each kernel has an
+// SSE4.1 and an AVX2 implementation, selected at compile time, and a
+// scalar fallback. Case folding only applies to ASCII letters.
+
+//! \brief Fold an ASCII character to lowercase
+//!
+//! \param c The character
+//!
+//! \return The lowercase character, or c if it is not an uppercase
+//! ASCII letter
+constexpr char FoldChar(char c)
+{
+	return (c >= 'A' && c <= 'Z') ? static_cast<char>(c + ('a' - 'A')) : c;
+}
+
+//! \brief Check whether a character is whitespace
+//!
+//! Matches isspace in the C locale.
+//!
+//! \param c The character
+//!
+//! \return true if c is ' ', '\t', '\n', '\v', '\f' or '\r'
+constexpr bool IsSpaceChar(char c)
+{
+	return c == ' ' || static_cast<unsigned char>(c - '\t') <= '\r' - '\t';
+}
+
+//! \brief Compare spans case-insensitively
+//!
+//! \param lhs The left span
+//! \param rhs The right span
+//! \param len The length of both spans
+//!
+//! \return true if the spans are equal, ignoring case
+bool StrEqualsFold(const char *lhs, const char *rhs, size_t len);
+
+//! \brief Order spans case-insensitively
+//!
+//! \param lhs The left span
+//! \param llen The length of the left span
+//! \param rhs The right span
+//! \param rlen The length of the right span
+//!
+//! \return Negative if lhs < rhs, positive if lhs > rhs, 0 otherwise
+int StrCompareFold(const char *lhs, size_t llen, const char *rhs, size_t rlen);
+
+//! \brief Find a span in another span case-insensitively
+//!
+//! \param str The span to search
+//! \param len The length of str
+//! \param pattern The span to search for
+//! \param plen The length of pattern
+//!
+//! \return Pointer to the first occurrence of pattern in str, or
+//! nullptr if there is none
+const char *StrFindFold(const char *str, size_t len, const char *pattern, size_t plen);
+
+//! \brief Strip leading and trailing whitespace from a span
+//!
+//! \param begin The start of the span, receives the first character
+//! that is not whitespace
+//! \param end The end of the span, receives the position after the
+//! last character that is not whitespace
+void StrTrim(const char *&begin, const char *&end);
+
+//! \brief Check whether a span only contains ASCII characters
+//!
+//! \param str The span
+//! \param len The length of the span
+//!
+//! \return true if no byte in the span is 0x80 or above
+bool StrIsAscii(const char *str, size_t len);
+
+//! \brief Check whether a byte starts a UTF-8 code point
+//!
+//! \param c The byte
+//!
+//! \return true if c is not a continuation byte
+constexpr bool IsCodePointStart(char c)
+{
+	return (static_cast<unsigned char>(c) & 0xc0) != 0x80;
+}
+
+//! \brief Count the UTF-8 code points in a span
+//!
+//! Bytes which are not continuation bytes start a code point, so
+//! invalid sequences are counted without being rejected.
+//!
+//! \param str The span
+//! \param len The length of the span
+//!
+//! \return The number of code points
+size_t StrCountCodePoints(const char *str, size_t len);
+
+//! \brief Hash a span case-insensitively
+//!
+//! Spans that compare equal with StrEqualsFold have equal hashes.
+//!
+//! \param str The span
+//! \param len The length of the span
+//!
+//! \return The hash
+uint64_t StrHashFold(const char *str, size_t len);
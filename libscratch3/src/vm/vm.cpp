@@ -242,16 +242,6 @@ int VirtualMachine::Load(const std::string &name, uint8_t *bytecode, size_t size
 		Sprite *sprite = as.Instantiate(nullptr);
 		_baseSprites[as.GetName()] = sprite;
 
-		// Create initializer, if any
-		if (si.initializer.offset)
-		{
-			_initScripts.emplace_back();
-
-			SCRIPT_ALLOC_INFO &ai = _initScripts.back();
-			ai.sprite = sprite;
-			ai.info = &si.initializer;
-		}
-
 		// Create script stubs
 		bc::Script *scripts = (bc::Script *)(bytecode + si.scripts);
 		for (bc::uint64 j = 0; j < si.numScripts; j++)
@@ -278,6 +268,33 @@ int VirtualMachine::Load(const std::string &name, uint8_t *bytecode, size_t size
 		return SCRATCH3_ERROR_INVALID_PROGRAM;
 	}
 
+	// the compiler stores each asset once, so costumes and sounds with
+	// the same data can share the decoded form of the first one
+	std::unordered_map<const uint8_t *, Costume *> costumeData;
+	for (AbstractSprite *as = _abstractSprites; as < _abstractSprites + _nAbstractSprites; as++)
+	{
+		for (Costume *c = as->GetCostumes(); c < as->GetCostumes() + as->CostumeCount(); c++)
+		{
+			if (c->GetDataSize() == 0)
+				continue;
+
+			auto r = costumeData.emplace(c->GetData(), c);
+			if (!r.second)
+				c->SetSource(r.first->second);
+		}
+	}
+
+	std::unordered_map<const uint8_t *, AbstractSound *> soundData;
+	for (AbstractSound *snd : _sounds)
+	{
+		if (snd->GetDataSize() == 0)
+			continue;
+
+		auto r = soundData.emplace(snd->GetData(), snd);
+		if (!r.second)
+			snd->SetSource(r.first->second);
+	}
+
 	VM = nullptr;
 	return SCRATCH3_ERROR_SUCCESS;
 }
@@ -423,37 +440,14 @@ int VirtualMachine::VMStart()
 
 	_epoch = ls_time64();
 
-	// Run initialization scripts
-	//
-	// These scripts are run only once and set the initial values
-	// for a sprite's variables. Anything may be done here, but
-	// if an initialization script ever yields, the VM will panic.
-	// The only way a script should return control is by terminating.
-	for (SCRIPT_ALLOC_INFO &ai : _initScripts)
-	{
-		Script *script = AllocScript(ai);
-		RestartScript(script);
-
-		// Run the script
-		_current = script;
-		ls_fiber_switch(script->fiber);
-		_current = nullptr;
-
-		if (_panicing)
-			longjmp(_panicJmp, 1);
-
-		if (script->except != Exception_None)
-		{
-			printf("<EXCEPTION> %s: %s\n", ExceptionString(script->except), script->exceptMessage);
-			Panic("Initialization script raised an exception");
-		}
-
-		if (script->state != TERMINATED)
-			Panic("Initialization script did not terminate");
-
-		FreeScript(script);
-	}
-	_initScripts.clear();
+	// Set the initial values of static variables, the values of the
+	// fields are set when the sprites are instantiated
+	bc::Header *header = (bc::Header *)_bytecode;
+	bc::uint64 count = *(bc::uint64 *)(_bytecode + header->rdata);
+	const bc::InitialValue *init = (const bc::InitialValue *)(_bytecode + header->rdata + sizeof(bc::uint64));
+	Value *vars = (Value *)(_bytecode + header->data);
+	for (bc::uint64 i = 0; i < count; i++)
+		LoadInitialValue(vars[i], init[i]);
 
 	SendFlagClicked();
 
@@ -612,6 +606,40 @@ Value &VirtualMachine::GetStaticVariable(uint32_t id)
 	return vars[id];
 }
 
+Value &VirtualMachine::LoadInitialValue(Value &lhs, const bc::InitialValue &iv)
+{
+	switch (iv.type)
+	{
+	default:
+		ReleaseValue(lhs);
+		return lhs;
+	case ValueType_Integer:
+		return SetInteger(lhs, iv.u.integer);
+	case ValueType_Real:
+		return SetReal(lhs, iv.u.real);
+	case ValueType_Bool:
+		return SetBool(lhs, iv.u.boolean);
+	case ValueType_String:
+		return SetStaticString(lhs, (String *)(_bytecode + iv.u.ref));
+	case ValueType_List: {
+		const bc::InitialList *list = (const bc::InitialList *)(_bytecode + iv.u.ref);
+		if (list->packed)
+			return AllocNumberList(lhs, (const double *)(list + 1), list->count);
+
+		AllocList(lhs, list->count);
+		if (lhs.type != ValueType_List)
+			return lhs;
+
+		// elements are never lists
+		const bc::InitialValue *elements = (const bc::InitialValue *)(list + 1);
+		for (bc::uint64 i = 0; i < list->count; i++)
+			LoadInitialValue(lhs.u.list->values[i], elements[i]);
+
+		return lhs;
+	}
+	}
+}
+
 Sprite *VirtualMachine::FindSprite(const Value &name)
 {
 	assert(VM == this);
@@ -949,6 +977,9 @@ VirtualMachine::VirtualMachine(Scratch3 *S, const Scratch3VMOptions *options) :
 	_current = nullptr;
 	_epoch = 0;
 
+	memset(&_heap, 0, sizeof(_heap));
+	_heap.limit = static_cast<int64_t>(_options.heapLimit);
+
 	_interpreterTime = 0;
 	_deltaExecution = 0;
 
@@ -1263,4 +1294,15 @@ void VirtualMachine::Scheduler()
 	_waitingScripts = waitingScripts;
 }
 
+HeapStats *GetCurrentHeap()
+{
+	return VM ? &VM->GetHeap() : nullptr;
+}
+
+void HeapLimitExceeded(HeapStats *heap, int64_t size)
+{
+	if (VM && VM->GetCurrentScript())
+		Raise(OutOfMemory, "Heap limit exceeded");
+}
+
 SCRATCH3_STORAGE VirtualMachine *VM = nullptr;
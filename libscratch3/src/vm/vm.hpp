@@ -198,6 +198,16 @@ public:
 	//! \return A reference to the variable
 	Value &GetStaticVariable(uint32_t id);
 
+	//! \brief Set a value to an initial value from the bytecode
+	//!
+	//! Strings refer to the bytecode, lists are copied to the heap.
+	//!
+	//! \param lhs The value
+	//! \param iv The initial value
+	//!
+	//! \return lhs
+	Value &LoadInitialValue(Value &lhs, const bc::InitialValue &iv);
+
 	//
 	/////////////////////////////////////////////////////////////////
 	// Internals
@@ -205,6 +215,20 @@ public:
 
 	constexpr uint8_t *GetBytecode() const { return _bytecode; }
 	constexpr size_t GetBytecodeSize() const { return _bytecodeSize; }
+
+	//! \brief Find the block an instruction was compiled from
+	//!
+	//! Only programs compiled with debug information have a source
+	//! map.
+	//!
+	//! \param pc Pointer to the instruction, such as Script::pc
+	//!
+	//! \return The source map entry covering the instruction, or
+	//! nullptr if there is none
+	inline const bc::SourceMapEntry *FindSourceLocation(const uint8_t *pc) const
+	{
+		return bc::FindSourceMapEntry(_bytecode, pc - _bytecode);
+	}
 	constexpr const std::string &GetProgramName() const { return _progName; }
 
 	inline double GetTime() const { return ls_time64() - _epoch; }
@@ -289,6 +313,9 @@ public:
 
 	constexpr const Scratch3VMOptions &GetOptions() const { return _options; }
 
+	constexpr HeapStats &GetHeap() { return _heap; }
+	constexpr const HeapStats &GetHeap() const { return _heap; }
+
 	void OnClick(int64_t x, int64_t y);
 	void OnKeyDown(int scancode);
 
@@ -330,7 +357,6 @@ private:
 
 	std::vector<SCRIPT_ALLOC_INFO> _scriptStubs; // Script start stubs
 
-	std::vector<SCRIPT_ALLOC_INFO> _initScripts; // Initialization scripts
 	std::vector<Script *> _flagListeners; // Flag listeners
 	std::unordered_map<std::string, std::vector<Script *>> _messageListeners; // Message listeners
 	std::unordered_map<SDL_Scancode, std::vector<Script *>> _keyListeners; // Key listeners
@@ -389,6 +415,8 @@ private:
 
 	Script *_current; // Currently executing script
 
+	HeapStats _heap; // Heap usage of strings and lists
+
 	double _epoch; // VM start time
 
 	long long _interpreterTime; // Time taken to run the interpreter once (ns)
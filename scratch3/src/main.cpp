@@ -7,53 +7,6 @@
 
 #include <scratch3/scratch3.h>
 
-static void *ReadFile(const char *file, size_t *size)
-{
-	ls_handle fh;
-	void *data;
-	size_t len;
-	int rc;
-
-	fh = ls_open(file, LS_FILE_READ, 0, LS_OPEN_EXISTING);
-	if (!fh)
-	{
-		ls_perror("ls_open");
-		return nullptr;
-	}
-
-	struct ls_stat st;
-	rc = ls_stat(file, &st);
-	if (rc == -1)
-	{
-		ls_perror("ls_stat");
-		ls_close(fh);
-		return nullptr;
-	}
-
-	data = malloc(st.size);
-	if (!data)
-	{
-		printf("Failed to allocate memory\n");
-		ls_close(fh);
-		return nullptr;
-	}
-
-	len = ls_read(fh, data, st.size);
-
-	if (len == -1)
-	{
-		ls_perror("ls_read");
-		ls_close(fh);
-		free(data);
-		return nullptr;
-	}
-
-	ls_close(fh);
-
-	*size = len;
-	return data;
-}
-
 static void Usage()
 {
 	printf("Usage: scratch3 [options...] <project>\n\n");
@@ -74,6 +27,11 @@ static void Usage()
 	printf("  -b, --borderless           Set borderless\n");
 	printf("  -a, --free-aspect          Don't lock aspect ratio\n");
 	printf("  -u, --suspend              Suspend VM on start\n");
+	printf("  -M, --max-memory <MiB>     Limit memory used by strings and lists\n");
+	printf("  -j, --jobs <count>         Number of compiler threads, default one per core\n");
+	printf("  -C, --cache <dir>          Cache compiled sprites in an existing directory\n");
+	printf("  -z, --compress             Compress SVG and WAV assets in the binary\n");
+	printf("  -B, --bake                 Store decoded assets in the binary, for faster startup\n");
 }
 
 static void Version()
@@ -110,6 +68,11 @@ struct Options
 	bool borderless = false;
 	bool freeAspectRatio = false;
 	bool suspend = false;
+	size_t maxMemory = 0;
+	int jobs = 0;
+	char *cacheDir = nullptr;
+	bool compressAssets = false;
+	bool bakeAssets = false;
 
 	void Parse(int argc, char *argv[])
 	{
@@ -166,6 +129,37 @@ struct Options
 				}
 				height = atoi(argv[++i]);
 			}
+			else if (!strcmp(arg, "--max-memory") || !strcmp(arg, "-M"))
+			{
+				if (i + 1 >= argc)
+				{
+					fprintf(stderr, "Missing argument for --max-memory\n");
+					exit(1);
+				}
+				maxMemory = strtoull(argv[++i], nullptr, 10) * 1024 * 1024;
+			}
+			else if (!strcmp(arg, "--jobs") || !strcmp(arg, "-j"))
+			{
+				if (i + 1 >= argc)
+				{
+					fprintf(stderr, "Missing argument for --jobs\n");
+					exit(1);
+				}
+				jobs = atoi(argv[++i]);
+			}
+			else if (!strcmp(arg, "--cache") || !strcmp(arg, "-C"))
+			{
+				if (i + 1 >= argc)
+				{
+					fprintf(stderr, "Missing argument for --cache\n");
+					exit(1);
+				}
+				cacheDir = argv[++i];
+			}
+			else if (!strcmp(arg, "--compress"))
+				compressAssets = true;
+			else if (!strcmp(arg, "--bake"))
+				bakeAssets = true;
 			else if (!strcmp(arg, "--resizable"))
 				resizable = true;
 			else if (!strcmp(arg, "--stream"))
@@ -234,10 +228,19 @@ struct Options
 					case 'u':
 						suspend = true;
 						break;
+					case 'z':
+						compressAssets = true;
+						break;
+					case 'B':
+						bakeAssets = true;
+						break;
 					case 'o':
 					case 'F':
 					case 'W':
 					case 'H':
+					case 'M':
+					case 'j':
+					case 'C':
 					case 'O':
 						printf("Cannot use -%c in this context\n", c);
 						exit(1);
@@ -338,15 +341,8 @@ int main(int argc, char *argv[])
 
 	Scratch3SetLog(S, Scratch3GetStdoutLog(), SCRATCH3_SEVERITY_INFO, nullptr);
 
-	size_t size;
-	void *data = ReadFile(opts.file, &size);
-	if (!data)
-	{
-		printf("Failed to read project\n");
-		exit(1);
-	}
-
-	rc = Scratch3Load(S, GetName(opts.file).c_str(), data, size);
+	// mapped, so compiled programs run without being copied
+	rc = Scratch3LoadFile(S, GetName(opts.file).c_str(), opts.file);
 	if (rc != SCRATCH3_ERROR_SUCCESS)
 	{
 		printf("Failed to load project: %s\n", Scratch3GetErrorString(rc));
@@ -357,12 +353,21 @@ int main(int argc, char *argv[])
 	memset(&compileOptions, 0, sizeof(compileOptions));
 	compileOptions.debug = opts.debugCompile ? 1 : 0;
 	compileOptions.optimization = opts.optimization;
+	compileOptions.jobs = opts.jobs;
+	compileOptions.cacheDir = opts.cacheDir;
+	compileOptions.compressAssets = opts.compressAssets ? 1 : 0;
+	compileOptions.bakeAssets = opts.bakeAssets ? 1 : 0;
 
-	rc = Scratch3Compile(S, &compileOptions);
-	if (rc != SCRATCH3_ERROR_SUCCESS)
+	// compiled programs are loaded as is
+	size_t binaryLen;
+	if (!Scratch3GetProgram(S, &binaryLen))
 	{
-		printf("Failed to compile project: %s\n", Scratch3GetErrorString(rc));
-		exit(1);
+		rc = Scratch3Compile(S, &compileOptions);
+		if (rc != SCRATCH3_ERROR_SUCCESS)
+		{
+			printf("Failed to compile project: %s\n", Scratch3GetErrorString(rc));
+			exit(1);
+		}
 	}
 
 	if (opts.onlyCompile)
@@ -383,6 +388,7 @@ int main(int argc, char *argv[])
 	vmOptions.fullscreen = opts.fullscreen;
 	vmOptions.borderless = opts.borderless;
 	vmOptions.freeAspectRatio = opts.freeAspectRatio;
+	vmOptions.heapLimit = opts.maxMemory;
 
 	rc = Scratch3VMInit(S, &vmOptions);
 	if (rc != SCRATCH3_ERROR_SUCCESS)
@@ -14,7 +14,6 @@ struct InstructionInfo
 {
 	const bc::Sprite *sprite;
 	uint64_t index;
-	bool isInitializer;
 };
 
 static void usage()
@@ -25,16 +24,23 @@ static void usage()
 	printf("  -s, --summary      Show a summary of the program\n");
 	printf("  -d, --disassemble  Disassemble the program\n");
 	printf("  -t, --table        Show the sprite table\n");
+	printf("  -m, --map          Show the source map\n");
+	printf("  -l, --lookup <off> Show the block the instruction at a hex offset\n");
+	printf("                     was compiled from\n");
 }
 
 static InstructionInfo *GetInstructionInfo(uint8_t *fileData, size_t fileSize, uint64_t offset);
 static void ShowSummary(uint8_t *fileData, size_t fileSize);
 static void ShowDissasembly(uint8_t *fileData, size_t fileSize);
 static void ShowTable(uint8_t *fileData, size_t fileSize);
+static void ShowSourceMap(uint8_t *fileData, size_t fileSize);
+static void ShowLookup(uint8_t *fileData, size_t fileSize, uint64_t offset);
 
 int main(int argc, char *argv[])
 {
-	bool summarize = false, disas = false, table = false;
+	bool summarize = false, disas = false, table = false, map = false;
+	bool lookup = false;
+	uint64_t lookupOffset = 0;
 
 	const char *file = nullptr;
 	for (int i = 1; i < argc; i++)
@@ -56,6 +62,21 @@ int main(int argc, char *argv[])
 		{
 			table = true;
 		}
+		else if (!strcmp(argv[i], "--map"))
+		{
+			map = true;
+		}
+		else if (!strcmp(argv[i], "--lookup") || !strcmp(argv[i], "-l"))
+		{
+			if (i + 1 >= argc)
+			{
+				usage();
+				return 1;
+			}
+
+			lookup = true;
+			lookupOffset = strtoull(argv[++i], nullptr, 16);
+		}
 		else if (argv[i][0] != '-')
 		{
 			file = argv[i];
@@ -76,6 +97,8 @@ int main(int argc, char *argv[])
 					disas = true;
 				else if (*c == 't')
 					table = true;
+				else if (*c == 'm')
+					map = true;
 			}
 		}
 	}
@@ -115,6 +138,18 @@ int main(int argc, char *argv[])
 		ShowTable(fileData, size);
 	}
 
+	if (map)
+	{
+		printf("\n");
+		ShowSourceMap(fileData, size);
+	}
+
+	if (lookup)
+	{
+		printf("\n");
+		ShowLookup(fileData, size, lookupOffset);
+	}
+
 	return 0;
 }
 
@@ -175,6 +210,8 @@ static void ShowDissasembly(uint8_t *fileData, size_t fileSize)
 
 	uint8_t *textEnd = text + header->text_size;
 
+	const bc::SourceMapEntry *block = nullptr; // block of the last instruction
+
 	uint8_t *ptr = text;
 	while (ptr < textEnd)
 	{
@@ -186,17 +223,18 @@ static void ShowDissasembly(uint8_t *fileData, size_t fileSize)
 			if (ptr != text)
 				printf("\n");
 
-			printf("    %8s  ", (char *)(fileData + info->sprite->name));
-			if (info->isInitializer)
-				printf("<init>\n");
-			else
-				printf("script %llu\n", info->index);
+			printf("    %8s  script %llu\n", (char *)(fileData + info->sprite->name), info->index);
 		}
 		else if (opcode == Op_enter)
 		{
 			printf("\n              <proc>\n");
 		}
 
+		const bc::SourceMapEntry *entry = bc::FindSourceMapEntry(fileData, ptr - fileData);
+		if (entry && entry != block)
+			printf("              ; %s %s\n", (char *)(fileData + entry->opcode), (char *)(fileData + entry->block));
+		block = entry;
+
 		printf("    %8X  ", (uint32_t)(ptr - fileData));
 
 		ptr++;
@@ -235,6 +273,14 @@ static void ShowDissasembly(uint8_t *fileData, size_t fileSize)
 			printf("addfield %u\n", ((bc::VarId *)ptr)->ToInt());
 			ptr += sizeof(bc::VarId);
 			break;
+		case Op_catstatic:
+			printf("catstatic %u\n", ((bc::VarId *)ptr)->ToInt());
+			ptr += sizeof(bc::VarId);
+			break;
+		case Op_catfield:
+			printf("catfield %u\n", ((bc::VarId *)ptr)->ToInt());
+			ptr += sizeof(bc::VarId);
+			break;
 		case Op_listcreate:
 			printf("listcreate %llu\n", *(uint64_t *)ptr);
 			ptr += sizeof(uint64_t);
@@ -349,6 +395,27 @@ static void ShowDissasembly(uint8_t *fileData, size_t fileSize)
 		case Op_mod:
 			printf("mod\n");
 			break;
+		case Op_addnum:
+			printf("addnum\n");
+			break;
+		case Op_subnum:
+			printf("subnum\n");
+			break;
+		case Op_mulnum:
+			printf("mulnum\n");
+			break;
+		case Op_divnum:
+			printf("divnum\n");
+			break;
+		case Op_eqnum:
+			printf("eqnum\n");
+			break;
+		case Op_gtnum:
+			printf("gtnum\n");
+			break;
+		case Op_ltnum:
+			printf("ltnum\n");
+			break;
 		case Op_neg:
 			printf("neg\n");
 			break;
@@ -941,7 +1008,7 @@ static void ShowTable(uint8_t *fileData, size_t fileSize)
 		printf("    %8s  Is Stage\n", sprite.isStage ? "true" : "false");
 		printf("    %8s  Draggable\n", sprite.draggable ? "true" : "false");
 		printf("    %8s  Rotation Style\n", GetRotationStyle(sprite.rotationStyle));
-		printf("    %8llX  Initializer\n", sprite.initializer.offset);
+		printf("    %8llu  Fields\n", sprite.numFields);
 		printf("    %8llu  Scripts\n", sprite.numScripts);
 		// Don't display additional information about scripts
 
@@ -955,10 +1022,12 @@ static void ShowTable(uint8_t *fileData, size_t fileSize)
 			printf("              %s\n", (char *)(fileData + costume.name));
 			printf("              %8s  Format\n", (char *)(fileData + costume.format));
 			printf("              %8d  Bitmap Resolution\n", costume.bitmapResolution);
+			printf("              %8s  Compressed\n", (costume.flags & ASSET_COMPRESSED) ? "true" : "false");
 			printf("              %8lg  Rotation Center X\n", costume.rotationCenterX);
 			printf("              %8lg  Rotation Center Y\n", costume.rotationCenterY);
 			printf("              %8llu  Size\n", costume.dataSize);
 			printf("              %8llX  Offset\n", costume.data);
+			printf("              %8llX  Baked\n", costume.baked);
 		}
 
 		printf("    %8llu  Sounds\n", sprite.numSounds);
@@ -972,21 +1041,73 @@ static void ShowTable(uint8_t *fileData, size_t fileSize)
 			printf("              %8s  Format\n", (char *)(fileData + sound.format));
 			printf("              %8lg  Rate\n", sound.rate);
 			printf("              %8llu  Sample Count\n", sound.sampleCount);
+			printf("              %8s  Compressed\n", (sound.flags & ASSET_COMPRESSED) ? "true" : "false");
 			printf("              %8llu  Size\n", sound.dataSize);
 			printf("              %8llX  Offset\n", sound.data);
+			printf("              %8llX  Baked\n", sound.baked);
 		}
 
 		printf("\n");
 	}
 }
 
+static void ShowSourceMap(uint8_t *fileData, size_t fileSize)
+{
+	bc::Header *header = (bc::Header *)fileData;
+
+	printf("  Source Map\n\n");
+
+	if (header->debug_size < sizeof(bc::DebugInfo))
+	{
+		printf("    No source map, compile with debug information\n");
+		return;
+	}
+
+	bc::DebugInfo *info = (bc::DebugInfo *)(fileData + header->debug);
+
+	printf("    %8llu  Entry Count\n\n", info->count);
+
+	for (bc::uint64 i = 0; i < info->count; i++)
+	{
+		bc::SourceMapEntry &entry = info->entries[i];
+		if (entry.start == entry.end)
+			continue; // code was optimized out
+
+		printf("    %8llX-%-8llX  %s", entry.start, entry.end, (char *)(fileData + entry.sprite));
+		if (entry.proc)
+			printf(" \"%s\"", (char *)(fileData + entry.proc));
+		printf("  %s %s (script %s)\n", (char *)(fileData + entry.opcode),
+			(char *)(fileData + entry.block), (char *)(fileData + entry.script));
+	}
+}
+
+static void ShowLookup(uint8_t *fileData, size_t fileSize, uint64_t offset)
+{
+	printf("  Lookup %llX\n\n", offset);
+
+	const bc::SourceMapEntry *entry = bc::FindSourceMapEntry(fileData, offset);
+	if (!entry)
+	{
+		printf("    No block\n");
+		return;
+	}
+
+	printf("    %8s  Sprite\n", (char *)(fileData + entry->sprite));
+	printf("    %8s  Script\n", (char *)(fileData + entry->script));
+	printf("    %8s  Block\n", (char *)(fileData + entry->block));
+	printf("    %8s  Opcode\n", (char *)(fileData + entry->opcode));
+	if (entry->proc)
+		printf("    %8s  Procedure\n", (char *)(fileData + entry->proc));
+	printf("    %8llX  Start\n", entry->start);
+	printf("    %8llX  End\n", entry->end);
+}
+
 static InstructionInfo *GetInstructionInfo(uint8_t *fileData, size_t fileSize, uint64_t offset)
 {
 	static InstructionInfo info;
 
 	info.sprite = nullptr;
 	info.index = 0;
-	info.isInitializer = false;
 
 	bc::Header *header = (bc::Header *)fileData;
 	bc::SpriteTable *st = (bc::SpriteTable *)(fileData + header->stable);
@@ -995,14 +1116,6 @@ static InstructionInfo *GetInstructionInfo(uint8_t *fileData, size_t fileSize, u
 	{
 		bc::Sprite &ste = st->sprites[i];
 
-		if (ste.initializer.offset == offset)
-		{
-			info.sprite = &ste;
-			info.index = 0;
-			info.isInitializer = true;
-			return &info;
-		}
-
 		bc::Script *scripts = (bc::Script *)(fileData + ste.scripts);
 		for (bc::uint64 j = 0; j < ste.numScripts; j++)
 		{
@@ -1011,7 +1124,6 @@ static InstructionInfo *GetInstructionInfo(uint8_t *fileData, size_t fileSize, u
 			{
 				info.sprite = &ste;
 				info.index = j;
-				info.isInitializer = false;
 				return &info;
 			}
 		}